@@ -0,0 +1,403 @@
+#ifdef SOIL_SENSOR_SIMULATED_BUS
+#include "I2CSimulation.h"
+#include "SoilMoistureI2cSensor.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+// Model of one Chirp sensor. Values are latched into the read registers when a conversion
+// completes, as the sensor firmware does.
+typedef struct SimulatedSoilSensor {
+	I2C_DeviceAddress address;
+	I2C_DeviceAddress pendingAddress; // Written by SET_ADDRESS, applied on reset.
+	uint8_t version;
+	uint8_t registerPointer;
+	uint16_t capacitance, latchedCapacitance;
+	int16_t temperature, latchedTemperature; // Tenths of degrees.
+	uint16_t light, latchedLight;
+	uint64_t busyUntilMs;
+	uint64_t lightBusyUntilMs;
+	uint64_t offlineUntilMs; // Rebooting after a reset or waking up.
+	bool asleep;
+	uint64_t awakeSinceMs; // Start of the current awake period not yet counted in the stats.
+} SimulatedSoilSensor;
+
+#define I2C_SIMULATION_DEFAULT_CONFIG { .conversionMs = 100, .lightConversionMs = 300, .resetMs = 500, .wakeMs = 10, .seed = 1 }
+
+// A TCA9548A: one control register whose bits connect the downstream channels.
+typedef struct SimulatedI2CMux {
+	I2C_DeviceAddress address;
+	uint8_t channelMask;
+} SimulatedI2CMux;
+
+static const I2CSimulationConfig defaultConfig = I2C_SIMULATION_DEFAULT_CONFIG;
+
+static pthread_mutex_t simulationLock = PTHREAD_MUTEX_INITIALIZER;
+static I2CSimulationConfig config = I2C_SIMULATION_DEFAULT_CONFIG;
+static SimulatedSoilSensor sensors[I2C_SIMULATION_MAX_SENSORS];
+static int sensorCount = 0;
+static SimulatedI2CMux muxes[I2C_SIMULATION_MAX_MUXES];
+static int muxCount = 0;
+static bool pumpRunning = false;
+static uint32_t busSpeedHz = I2C_BUS_SPEED_STANDARD;
+static I2CSimulationStats simulationStats;
+
+static uint64_t NowMs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / (1000 * 1000);
+}
+
+static bool Chance(uint32_t perMille) {
+	return perMille > 0 && (uint32_t)(rand_r(&config.seed) % 1000) < perMille;
+}
+
+static SimulatedSoilSensor* FindSensor(I2C_DeviceAddress address) {
+	for (int i = 0; i < sensorCount; i++) {
+		if (sensors[i].address == address) {
+			return &sensors[i];
+		}
+	}
+	return NULL;
+}
+
+static SimulatedI2CMux* FindMux(I2C_DeviceAddress address) {
+	for (int i = 0; i < muxCount; i++) {
+		if (muxes[i].address == address) {
+			return &muxes[i];
+		}
+	}
+	return NULL;
+}
+
+// Finds the sensor answering on a bus address: one directly on the bus, or one behind a mux
+// whose channel is selected.
+static SimulatedSoilSensor* RouteToSensor(I2C_DeviceAddress deviceAddress) {
+	for (int i = 0; i < sensorCount; i++) {
+		if (I2C_DEVICE_ADDRESS(sensors[i].address) != deviceAddress) {
+			continue;
+		}
+		I2C_DeviceAddress muxAddress = I2C_MUX_ADDRESS(sensors[i].address);
+		if (muxAddress == 0) {
+			return &sensors[i];
+		}
+		SimulatedI2CMux* mux = FindMux(muxAddress);
+		if (mux != NULL && (mux->channelMask & (1u << I2C_MUX_CHANNEL(sensors[i].address)))) {
+			return &sensors[i];
+		}
+	}
+	return NULL;
+}
+
+// Sleeps for the time the transfer occupies the bus: 9 clocks per byte plus the address byte.
+static void SpendBusTime(size_t bytes) {
+	uint64_t busTimeUs = (uint64_t)(bytes + 1) * 9 * 1000000 / busSpeedHz + config.latencyUs;
+	simulationStats.busTimeUs += busTimeUs;
+	struct timespec delay = { (time_t)(busTimeUs / 1000000), (long)(busTimeUs % 1000000) * 1000 };
+	nanosleep(&delay, NULL);
+}
+
+// Handles a transfer to a mux. Returns false if address is not a mux.
+static bool TransferToMux(I2C_DeviceAddress address, const uint8_t* writeData, size_t writeLength,
+	uint8_t* readData, size_t readLength, ssize_t* result) {
+	SimulatedI2CMux* mux = FindMux(address);
+	if (mux == NULL) {
+		return false;
+	}
+	simulationStats.transfers++;
+	simulationStats.bytes += (uint32_t)(writeLength + readLength);
+	simulationStats.muxTransfers++;
+	SpendBusTime(writeLength + readLength);
+	if (writeLength > 0) {
+		mux->channelMask = writeData[writeLength - 1];
+	}
+	if (readLength > 0) {
+		memset(readData, mux->channelMask, readLength);
+	}
+	*result = (ssize_t)(writeLength + readLength);
+	return true;
+}
+
+static void CompleteConversions(SimulatedSoilSensor* sensor, uint64_t nowMs) {
+	if (sensor->busyUntilMs != 0 && nowMs >= sensor->busyUntilMs) {
+		sensor->latchedCapacitance = sensor->capacitance;
+		sensor->latchedTemperature = sensor->temperature;
+		sensor->busyUntilMs = 0;
+	}
+	if (sensor->lightBusyUntilMs != 0 && nowMs >= sensor->lightBusyUntilMs) {
+		sensor->latchedLight = sensor->light;
+		sensor->lightBusyUntilMs = 0;
+	}
+}
+
+// Adds the time since the last call to the awake time of a sensor which is not asleep.
+static void AccountAwakeTime(SimulatedSoilSensor* sensor, uint64_t nowMs) {
+	if (!sensor->asleep) {
+		simulationStats.sensorAwakeMs += nowMs - sensor->awakeSinceMs;
+	}
+	sensor->awakeSinceMs = nowMs;
+}
+
+// Finds the addressed sensor and applies injected faults. Returns NULL for a NACK.
+static SimulatedSoilSensor* BeginTransfer(I2C_DeviceAddress address, size_t bytes, bool* corrupt) {
+	uint64_t nowMs = NowMs();
+	SimulatedSoilSensor* sensor = RouteToSensor(address);
+
+	// A sleeping sensor wakes on being addressed but does not acknowledge that transfer.
+	if (sensor != NULL && sensor->asleep) {
+		AccountAwakeTime(sensor, nowMs);
+		sensor->asleep = false;
+		sensor->offlineUntilMs = nowMs + config.wakeMs;
+		simulationStats.wakeUps++;
+	}
+
+	simulationStats.transfers++;
+	simulationStats.bytes += (uint32_t)bytes;
+	*corrupt = false;
+	if (sensor != NULL && pumpRunning && Chance(config.pumpSpikePerMille)) {
+		simulationStats.pumpSpikes++;
+		*corrupt = rand_r(&config.seed) & 1;
+		if (!*corrupt) {
+			sensor = NULL;
+		}
+	}
+	if (sensor != NULL && (nowMs < sensor->offlineUntilMs || Chance(config.nackPerMille))) {
+		sensor = NULL;
+	}
+	if (sensor == NULL) {
+		SpendBusTime(0);
+		simulationStats.nacks++;
+		errno = ENXIO;
+		return NULL;
+	}
+
+	SpendBusTime(bytes);
+	CompleteConversions(sensor, nowMs);
+	AccountAwakeTime(sensor, nowMs);
+	return sensor;
+}
+
+static void WriteRegister(SimulatedSoilSensor* sensor, const uint8_t* data, size_t length) {
+	uint64_t nowMs = NowMs();
+	sensor->registerPointer = data[0];
+	switch (data[0]) {
+	case SOILMOISTURESENSOR_GET_CAPACITANCE:
+	case SOILMOISTURESENSOR_GET_TEMPERATURE:
+		if (sensor->busyUntilMs == 0) {
+			sensor->busyUntilMs = nowMs + config.conversionMs;
+		}
+		break;
+	case SOILMOISTURESENSOR_SET_ADDRESS:
+		if (length > 1 && data[1] > 0 && data[1] < 128) {
+			sensor->pendingAddress = (sensor->address & ~(I2C_DeviceAddress)0x7F) | data[1];
+		}
+		break;
+	case SOILMOISTURESENSOR_MEASURE_LIGHT:
+		sensor->lightBusyUntilMs = nowMs + config.lightConversionMs;
+		break;
+	case SOILMOISTURESENSOR_SLEEP:
+		// Conversions in progress are abandoned; their values are never latched.
+		sensor->busyUntilMs = 0;
+		sensor->lightBusyUntilMs = 0;
+		sensor->asleep = true;
+		break;
+	case SOILMOISTURESENSOR_RESET:
+		sensor->address = sensor->pendingAddress;
+		sensor->asleep = false;
+		sensor->busyUntilMs = 0;
+		sensor->lightBusyUntilMs = 0;
+		sensor->offlineUntilMs = nowMs + config.resetMs;
+		break;
+	default:
+		break;
+	}
+}
+
+static void ReadRegister(SimulatedSoilSensor* sensor, uint8_t* data, size_t length) {
+	uint16_t value = 0;
+	switch (sensor->registerPointer) {
+	case SOILMOISTURESENSOR_GET_CAPACITANCE:
+		value = sensor->latchedCapacitance;
+		break;
+	case SOILMOISTURESENSOR_GET_TEMPERATURE:
+		value = (uint16_t)sensor->latchedTemperature;
+		break;
+	case SOILMOISTURESENSOR_GET_LIGHT:
+		value = sensor->latchedLight;
+		break;
+	case SOILMOISTURESENSOR_GET_ADDRESS:
+		value = (uint16_t)(sensor->address << 8);
+		break;
+	case SOILMOISTURESENSOR_GET_VERSION:
+		value = (uint16_t)(sensor->version << 8);
+		break;
+	case SOILMOISTURESENSOR_GET_BUSY:
+		value = (uint16_t)((sensor->busyUntilMs != 0 || sensor->lightBusyUntilMs != 0) << 8);
+		break;
+	default:
+		break;
+	}
+
+	// Registers are big endian; one byte reads return the high byte.
+	for (size_t i = 0; i < length; i++) {
+		data[i] = i == 0 ? (uint8_t)(value >> 8) : i == 1 ? (uint8_t)value : 0xFF;
+	}
+}
+
+void ResetI2CSimulation(const I2CSimulationConfig* newConfig) {
+	pthread_mutex_lock(&simulationLock);
+	config = newConfig != NULL ? *newConfig : defaultConfig;
+	memset(sensors, 0, sizeof(sensors));
+	sensorCount = 0;
+	memset(muxes, 0, sizeof(muxes));
+	muxCount = 0;
+	pumpRunning = false;
+	memset(&simulationStats, 0, sizeof(simulationStats));
+	pthread_mutex_unlock(&simulationLock);
+}
+
+int AddSimulatedSoilSensor(I2C_DeviceAddress address, uint8_t version, uint16_t capacitance,
+	int16_t temperatureDeciC, uint16_t light) {
+	int result = -1;
+	pthread_mutex_lock(&simulationLock);
+	if (sensorCount < I2C_SIMULATION_MAX_SENSORS && FindSensor(address) == NULL) {
+		SimulatedSoilSensor* sensor = &sensors[sensorCount++];
+		memset(sensor, 0, sizeof(*sensor));
+		sensor->address = address;
+		sensor->pendingAddress = address;
+		sensor->version = version;
+		sensor->capacitance = sensor->latchedCapacitance = capacitance;
+		sensor->temperature = sensor->latchedTemperature = temperatureDeciC;
+		sensor->light = sensor->latchedLight = light;
+		sensor->awakeSinceMs = NowMs();
+		result = 0;
+	}
+	pthread_mutex_unlock(&simulationLock);
+	return result;
+}
+
+int SetSimulatedSoilSensorValues(I2C_DeviceAddress address, uint16_t capacitance,
+	int16_t temperatureDeciC, uint16_t light) {
+	int result = -1;
+	pthread_mutex_lock(&simulationLock);
+	SimulatedSoilSensor* sensor = FindSensor(address);
+	if (sensor != NULL) {
+		// Conversions which completed earlier latched the old values.
+		CompleteConversions(sensor, NowMs());
+		sensor->capacitance = capacitance;
+		sensor->temperature = temperatureDeciC;
+		sensor->light = light;
+		result = 0;
+	}
+	pthread_mutex_unlock(&simulationLock);
+	return result;
+}
+
+int AddSimulatedI2CMux(I2C_DeviceAddress address) {
+	int result = -1;
+	pthread_mutex_lock(&simulationLock);
+	if (muxCount < I2C_SIMULATION_MAX_MUXES && FindMux(address) == NULL) {
+		muxes[muxCount].address = address;
+		muxes[muxCount].channelMask = 0;
+		muxCount++;
+		result = 0;
+	}
+	pthread_mutex_unlock(&simulationLock);
+	return result;
+}
+
+void SetSimulatedPumpRunning(bool running) {
+	pthread_mutex_lock(&simulationLock);
+	pumpRunning = running;
+	pthread_mutex_unlock(&simulationLock);
+}
+
+void GetI2CSimulationStats(I2CSimulationStats* stats) {
+	pthread_mutex_lock(&simulationLock);
+	*stats = simulationStats;
+	pthread_mutex_unlock(&simulationLock);
+}
+
+int I2CMaster_Open(I2C_InterfaceId id) {
+	return open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+
+int I2CMaster_SetBusSpeed(int fd, I2C_BusSpeed speedInHz) {
+	if (speedInHz == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&simulationLock);
+	busSpeedHz = speedInHz;
+	pthread_mutex_unlock(&simulationLock);
+	return 0;
+}
+
+int I2CMaster_SetTimeout(int fd, uint32_t timeoutInMs) {
+	return 0;
+}
+
+ssize_t I2CMaster_Write(int fd, I2C_DeviceAddress address, const uint8_t* data, size_t length) {
+	bool corrupt;
+	ssize_t result = -1;
+	pthread_mutex_lock(&simulationLock);
+	if (TransferToMux(address, data, length, NULL, 0, &result)) {
+		pthread_mutex_unlock(&simulationLock);
+		return result;
+	}
+	SimulatedSoilSensor* sensor = BeginTransfer(address, length, &corrupt);
+	if (sensor != NULL) {
+		if (length > 0 && !corrupt) {
+			WriteRegister(sensor, data, length);
+		}
+		result = (ssize_t)length;
+	}
+	pthread_mutex_unlock(&simulationLock);
+	return result;
+}
+
+ssize_t I2CMaster_WriteThenRead(int fd, I2C_DeviceAddress address, const uint8_t* writeData,
+	size_t lenWriteData, uint8_t* readData, size_t lenReadData) {
+	bool corrupt;
+	ssize_t result = -1;
+	pthread_mutex_lock(&simulationLock);
+	if (TransferToMux(address, writeData, lenWriteData, readData, lenReadData, &result)) {
+		pthread_mutex_unlock(&simulationLock);
+		return result;
+	}
+	SimulatedSoilSensor* sensor = BeginTransfer(address, lenWriteData + lenReadData, &corrupt);
+	if (sensor != NULL) {
+		if (lenWriteData > 0) {
+			sensor->registerPointer = writeData[0];
+		}
+		ReadRegister(sensor, readData, lenReadData);
+		if (corrupt) {
+			memset(readData, 0xFF, lenReadData);
+		}
+		result = (ssize_t)(lenWriteData + lenReadData);
+	}
+	pthread_mutex_unlock(&simulationLock);
+	return result;
+}
+
+ssize_t I2CMaster_Read(int fd, I2C_DeviceAddress address, uint8_t* buffer, size_t maxLength) {
+	bool corrupt;
+	ssize_t result = -1;
+	pthread_mutex_lock(&simulationLock);
+	if (TransferToMux(address, NULL, 0, buffer, maxLength, &result)) {
+		pthread_mutex_unlock(&simulationLock);
+		return result;
+	}
+	SimulatedSoilSensor* sensor = BeginTransfer(address, maxLength, &corrupt);
+	if (sensor != NULL) {
+		ReadRegister(sensor, buffer, maxLength);
+		if (corrupt) {
+			memset(buffer, 0xFF, maxLength);
+		}
+		result = (ssize_t)maxLength;
+	}
+	pthread_mutex_unlock(&simulationLock);
+	return result;
+}
+#endif
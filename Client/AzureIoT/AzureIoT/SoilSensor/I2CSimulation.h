@@ -0,0 +1,58 @@
+#pragma once
+#include <applibs/i2c.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "i2cAccess.h"
+
+// Define SOIL_SENSOR_SIMULATED_BUS to build I2CSimulation.c, which implements the I2CMaster_*
+// calls used by i2cAccess.c against simulated Chirp sensors. This lets the driver and the
+// control loop run and be timed on a Linux build machine. Link it instead of applibs' I2C;
+// host/Makefile builds the host tests this way, against the stub SDK headers in host/include.
+
+// Maximum number of simulated sensors and muxes.
+#define I2C_SIMULATION_MAX_SENSORS 64
+#define I2C_SIMULATION_MAX_MUXES 8
+
+typedef struct I2CSimulationConfig {
+	uint32_t latencyUs; // Added to every transfer, on top of the bus time at the set speed.
+	uint32_t conversionMs; // Capacitance and temperature conversion time, busy meanwhile.
+	uint32_t lightConversionMs; // Light conversion time.
+	uint32_t resetMs; // Time after a reset during which the sensor does not acknowledge.
+	uint32_t wakeMs; // Time after the waking transfer during which a sleeping sensor does not acknowledge.
+	uint32_t nackPerMille; // Probability of a NACK on any transfer.
+	uint32_t pumpSpikePerMille; // Probability of a NACK or corrupted read while the pump runs.
+	unsigned int seed; // Seed of the fault generator, for reproducible runs.
+} I2CSimulationConfig;
+
+// Transfers seen by the simulated bus.
+typedef struct I2CSimulationStats {
+	uint32_t transfers;
+	uint32_t bytes;
+	uint32_t nacks; // Injected and unknown address.
+	uint32_t pumpSpikes;
+	uint32_t muxTransfers; // Transfers to a mux control register.
+	uint32_t wakeUps; // Sleeping sensors woken by a transfer.
+	uint64_t sensorAwakeMs; // Summed over all sensors, up to the last transfer or sleep.
+	uint64_t busTimeUs; // Simulated time spent on the bus.
+} I2CSimulationStats;
+
+// Removes all sensors and applies config; NULL restores the defaults.
+void ResetI2CSimulation(const I2CSimulationConfig* config);
+
+// Adds a TCA9548A mux with all channels disconnected.
+int AddSimulatedI2CMux(I2C_DeviceAddress address);
+
+// Adds a Chirp sensor answering on address, which may be an I2C_MUXED_ADDRESS behind a mux
+// added with AddSimulatedI2CMux. temperatureDeciC is in tenths of a degree Celsius.
+// Returns 0 on success, or -1 if the address is taken or the table is full.
+int AddSimulatedSoilSensor(I2C_DeviceAddress address, uint8_t version, uint16_t capacitance,
+	int16_t temperatureDeciC, uint16_t light);
+
+// Sets the values latched by the sensor's next conversion.
+int SetSimulatedSoilSensorValues(I2C_DeviceAddress address, uint16_t capacitance,
+	int16_t temperatureDeciC, uint16_t light);
+
+// While running, transfers suffer pump noise spikes, see pumpSpikePerMille.
+void SetSimulatedPumpRunning(bool running);
+
+void GetI2CSimulationStats(I2CSimulationStats* stats);
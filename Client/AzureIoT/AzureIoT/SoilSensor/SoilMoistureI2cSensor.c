@@ -9,9 +9,12 @@ const uint8_t ctrlGetBusyData[] = { SOILMOISTURESENSOR_GET_BUSY, 0x00 };
 const uint8_t ctrlTemperatureData[] = { SOILMOISTURESENSOR_GET_TEMPERATURE, 0x00 };
 const uint8_t ctrlCapacitanceData[] = { SOILMOISTURESENSOR_GET_CAPACITANCE, 0x00 };
 const uint8_t ctrlResetData[] = { SOILMOISTURESENSOR_RESET, 0x00 };
+const uint8_t ctrlMeasureLightData[] = { SOILMOISTURESENSOR_MEASURE_LIGHT, 0x00 };
+const uint8_t ctrlLightData[] = { SOILMOISTURESENSOR_GET_LIGHT, 0x00 };
+const uint8_t ctrlSleepData[] = { SOILMOISTURESENSOR_SLEEP, 0x00 };
 
 void ResetSoilSensor(I2C_DeviceAddress sensorAddress) {
-	WriteI2CRegister8bit(sensorAddress, ctrlResetData);
+	WriteI2CRegisterAddress(sensorAddress, ctrlResetData);
 }
 
 void InitializeSoilSensor(I2C_DeviceAddress sensorAddress, bool waitForSensor) {
@@ -21,37 +24,144 @@ void InitializeSoilSensor(I2C_DeviceAddress sensorAddress, bool waitForSensor) {
 	}
 }
 
-void SetAddress(I2C_DeviceAddress sensorAddress, I2C_DeviceAddress desiredAddress, bool reset) {
-	ctrlSetAddressData[1] = (uint8_t)desiredAddress;
+// Polls until every sensor answers not busy or timeoutMs elapses. Returns the number of
+// sensors that became ready.
+static int WaitForSoilSensorsReady(const I2C_DeviceAddress* sensorAddresses, int sensorCount, int timeoutMs) {
+	static const struct timespec readyPollInterval = { 0, 10 * 1000 * 1000 };
+	uint64_t readyMask = 0;
+	int readyCount = 0;
+
+	// A rebooting sensor does not acknowledge its address, so any successful not-busy read
+	// means it is up.
+	for (int elapsedMs = 0; readyCount < sensorCount && elapsedMs < timeoutMs; elapsedMs += 10) {
+		nanosleep(&readyPollInterval, NULL);
+		for (int i = 0; i < sensorCount; i++) {
+			uint8_t busy;
+			if (!(readyMask & (1ull << i))
+				&& TryReadI2CRegister8bit(sensorAddresses[i], ctrlGetBusyData, &busy)
+				&& busy == 0) {
+				readyMask |= 1ull << i;
+				readyCount++;
+			}
+		}
+	}
+
+	for (int i = 0; i < sensorCount; i++) {
+		if (!(readyMask & (1ull << i))) {
+			Log_Debug("WARNING: Soil sensor (Address: %X) not ready after reset\n", sensorAddresses[i]);
+		}
+	}
+	return readyCount;
+}
+
+int InitializeSoilSensors(const I2C_DeviceAddress* sensorAddresses, int sensorCount, int timeoutMs) {
+	for (int i = 0; i < sensorCount; i++) {
+		ResetSoilSensor(sensorAddresses[i]);
+	}
+	return WaitForSoilSensorsReady(sensorAddresses, sensorCount, timeoutMs);
+}
+
+I2CStatus SetAddress(I2C_DeviceAddress sensorAddress, I2C_DeviceAddress desiredAddress, bool reset) {
+	I2CStatus status;
+	ctrlSetAddressData[1] = (uint8_t)I2C_DEVICE_ADDRESS(desiredAddress);
 	// Unclear why this has to be done twice,
 	// see https://github.com/Apollon77/I2CSoilMoistureSensor/blob/master/I2CSoilMoistureSensor.cpp
-	WriteI2CRegister8bit(sensorAddress, ctrlSetAddressData);
-	WriteI2CRegister8bit(sensorAddress, ctrlSetAddressData);
+	if ((status = WriteI2CRegister8bit(sensorAddress, ctrlSetAddressData)) != I2CStatus_Ok
+		|| (status = WriteI2CRegister8bit(sensorAddress, ctrlSetAddressData)) != I2CStatus_Ok) {
+		return status;
+	}
 	if (reset) {
-		ResetSoilSensor(sensorAddress);
+		status = WriteI2CRegisterAddress(sensorAddress, ctrlResetData);
+	}
+	return status;
+}
+
+I2CStatus ChangeSoilSensorAddress(I2C_DeviceAddress sensorAddress, I2C_DeviceAddress desiredAddress, int timeoutMs) {
+	I2CStatus status = SetAddress(sensorAddress, desiredAddress, true);
+	if (status != I2CStatus_Ok) {
+		return status;
 	}
+	if (WaitForSoilSensorsReady(&desiredAddress, 1, timeoutMs) != 1) {
+		return I2CStatus_Timeout;
+	}
+
+	uint8_t reportedAddress;
+	status = GetAddress(desiredAddress, &reportedAddress);
+	if (status == I2CStatus_Ok && reportedAddress != I2C_DEVICE_ADDRESS(desiredAddress)) {
+		Log_Debug("ERROR: Soil sensor (Address: %X) reports address %X\n", desiredAddress, reportedAddress);
+		status = I2CStatus_Error;
+	}
+	return status;
 }
 
-uint8_t GetVersion(I2C_DeviceAddress sensorAddress) {
-	uint8_t soilSensorVersion = ReadI2CRegister8bit(sensorAddress, ctrlVersionData);
-	Log_Debug("Soil sensor (Address: %X) firmware version: %X\n", sensorAddress, soilSensorVersion);
-	return soilSensorVersion;
+I2CStatus GetVersion(I2C_DeviceAddress sensorAddress, uint8_t* version) {
+	I2CStatus status = ReadI2CRegister8bit(sensorAddress, ctrlVersionData, version);
+	if (status == I2CStatus_Ok) {
+		Log_Debug("Soil sensor (Address: %X) firmware version: %X\n", sensorAddress, *version);
+	}
+	return status;
 }
 
-uint8_t GetAddress(I2C_DeviceAddress sensorAddress) {
-	uint8_t soilSensorAddress = ReadI2CRegister8bit(sensorAddress, ctrlGetAddressData);
-	Log_Debug("Soil sensor (Address: %X) i2c reporting address: %X\n", sensorAddress, soilSensorAddress);
-	return soilSensorAddress;
+I2CStatus GetAddress(I2C_DeviceAddress sensorAddress, uint8_t* reportedAddress) {
+	I2CStatus status = ReadI2CRegister8bit(sensorAddress, ctrlGetAddressData, reportedAddress);
+	if (status == I2CStatus_Ok) {
+		Log_Debug("Soil sensor (Address: %X) i2c reporting address: %X\n", sensorAddress, *reportedAddress);
+	}
+	return status;
 }
 
 bool IsBusy(I2C_DeviceAddress sensorAddress) {
-	return (ReadI2CRegister8bit(sensorAddress, ctrlGetBusyData) == 1);
+	uint8_t busy;
+	return ReadI2CRegister8bit(sensorAddress, ctrlGetBusyData, &busy) != I2CStatus_Ok || busy == 1;
 }
 
-float GetTemperature(I2C_DeviceAddress sensorAddress) {
-	return (float)ReadI2CRegister16bitSigned(sensorAddress, ctrlTemperatureData) / 10;
+// Writing the capacitance and temperature register addresses starts a new conversion; the
+// sensor reports busy until both results are ready.
+I2CStatus TriggerMeasurement(I2C_DeviceAddress sensorAddress) {
+	I2CStatus status = WriteI2CRegisterAddress(sensorAddress, ctrlCapacitanceData);
+	if (status != I2CStatus_Ok) {
+		return status;
+	}
+	return WriteI2CRegisterAddress(sensorAddress, ctrlTemperatureData);
 }
 
-unsigned int GetCapacitance(I2C_DeviceAddress sensorAddress) {
-	return ReadI2CRegister16bitUnsigned(sensorAddress, ctrlCapacitanceData);
+I2CStatus GetTemperature(I2C_DeviceAddress sensorAddress, int16_t* temperatureDeciC) {
+	return ReadI2CRegister16bitSigned(sensorAddress, ctrlTemperatureData, temperatureDeciC);
+}
+
+I2CStatus GetCapacitance(I2C_DeviceAddress sensorAddress, uint16_t* capacitance) {
+	return ReadI2CRegister16bitUnsigned(sensorAddress, ctrlCapacitanceData, capacitance);
+}
+
+I2CStatus TriggerLightMeasurement(I2C_DeviceAddress sensorAddress) {
+	return WriteI2CRegisterAddress(sensorAddress, ctrlMeasureLightData);
+}
+
+I2CStatus GetLight(I2C_DeviceAddress sensorAddress, uint16_t* light) {
+	return ReadI2CRegister16bitUnsigned(sensorAddress, ctrlLightData, light);
+}
+
+I2CStatus SleepSoilSensor(I2C_DeviceAddress sensorAddress) {
+	return WriteI2CRegisterAddress(sensorAddress, ctrlSleepData);
+}
+
+void WakeSoilSensor(I2C_DeviceAddress sensorAddress) {
+	// A single attempt, not counted as a failure: the sleeping sensor is expected not to answer.
+	uint8_t version;
+	TryReadI2CRegister8bit(sensorAddress, ctrlVersionData, &version);
+}
+
+void ReadSoilSensorSample(I2C_DeviceAddress sensorAddress, SoilSensorSample* sample) {
+	sample->address = sensorAddress;
+	sample->hasTemperature = false;
+	sample->hasCapacitance = false;
+	sample->hasLight = false;
+	clock_gettime(CLOCK_MONOTONIC, &sample->timestamp);
+
+	if (!IsBusy(sensorAddress)) {
+		sample->hasTemperature = GetTemperature(sensorAddress, &sample->temperatureDeciC) == I2CStatus_Ok;
+	}
+	if (!IsBusy(sensorAddress)) {
+		sample->hasCapacitance = GetCapacitance(sensorAddress, &sample->capacitance) == I2CStatus_Ok;
+	}
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "i2cAccess.h"
 #include <stdbool.h>
+#include <time.h>
 #include <applibs/log.h>
 
 //Soil Moisture Sensor Register Addresses
@@ -15,18 +16,63 @@
 #define SOILMOISTURESENSOR_SLEEP	        0x08 // (w)     n/a
 #define SOILMOISTURESENSOR_GET_BUSY	        0x09 // (r)	    1 bytes
 
+// Time a sensor needs after the transfer which woke it before it answers reliably.
+#define SOILMOISTURESENSOR_WAKE_MS 20
+
+// One reading of a soil sensor. A value is only valid if its has* flag is set; a sensor
+// reporting busy or failing to answer leaves it unset. Light is measured on a slower schedule
+// and reported in samples of its own.
+typedef struct SoilSensorSample {
+	I2C_DeviceAddress address;
+	struct timespec timestamp; // CLOCK_MONOTONIC time the reading was taken.
+	bool hasTemperature;
+	int16_t temperatureDeciC; // Tenths of a degree Celsius, as the sensor reports it.
+	bool hasCapacitance;
+	uint16_t capacitance; // Raw counts, higher is wetter.
+	bool hasLight;
+	uint16_t light; // Raw counts, higher is darker.
+} SoilSensorSample;
+
 void ResetSoilSensor(I2C_DeviceAddress sensorAddress);
 
 void InitializeSoilSensor(I2C_DeviceAddress sensorAddress, bool waitForSensor);
 
-void SetAddress(I2C_DeviceAddress sensorAddress, I2C_DeviceAddress desiredAddress, bool reset);
+// Resets all sensors at once, then polls until every sensor answers not busy or timeoutMs
+// elapses. Returns the number of sensors that became ready.
+int InitializeSoilSensors(const I2C_DeviceAddress* sensorAddresses, int sensorCount, int timeoutMs);
+
+I2CStatus SetAddress(I2C_DeviceAddress sensorAddress, I2C_DeviceAddress desiredAddress, bool reset);
 
-uint8_t GetVersion(I2C_DeviceAddress sensorAddress);
+// Moves a sensor to desiredAddress: writes the new address, resets the sensor, waits at most
+// timeoutMs for it to come back and verifies the address it reports. desiredAddress must be on
+// the same mux channel as sensorAddress.
+I2CStatus ChangeSoilSensorAddress(I2C_DeviceAddress sensorAddress, I2C_DeviceAddress desiredAddress, int timeoutMs);
 
-uint8_t GetAddress(I2C_DeviceAddress sensorAddress);
+I2CStatus GetVersion(I2C_DeviceAddress sensorAddress, uint8_t* version);
 
+I2CStatus GetAddress(I2C_DeviceAddress sensorAddress, uint8_t* reportedAddress);
+
+// A sensor which cannot be read is reported busy.
 bool IsBusy(I2C_DeviceAddress sensorAddress);
 
-float GetTemperature(I2C_DeviceAddress sensorAddress);
+I2CStatus TriggerMeasurement(I2C_DeviceAddress sensorAddress);
+
+I2CStatus GetTemperature(I2C_DeviceAddress sensorAddress, int16_t* temperatureDeciC);
+
+I2CStatus GetCapacitance(I2C_DeviceAddress sensorAddress, uint16_t* capacitance);
+
+// Starts a light conversion, which takes up to several seconds in the dark. The sensor reports
+// busy until it is done.
+I2CStatus TriggerLightMeasurement(I2C_DeviceAddress sensorAddress);
+
+I2CStatus GetLight(I2C_DeviceAddress sensorAddress, uint16_t* light);
+
+// Puts the sensor into its low-power sleep mode (firmware 2.6 or newer). Any transfer
+// addressed to the sensor wakes it again; see WakeSoilSensor.
+I2CStatus SleepSoilSensor(I2C_DeviceAddress sensorAddress);
+
+// Sends the transfer which wakes a sleeping sensor. The sensor ignores that transfer and is
+// only usable SOILMOISTURESENSOR_WAKE_MS later.
+void WakeSoilSensor(I2C_DeviceAddress sensorAddress);
 
-unsigned int GetCapacitance(I2C_DeviceAddress sensorAddress);
+void ReadSoilSensorSample(I2C_DeviceAddress sensorAddress, SoilSensorSample* sample);
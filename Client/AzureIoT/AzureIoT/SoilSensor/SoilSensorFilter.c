@@ -0,0 +1,56 @@
+#include "SoilSensorFilter.h"
+#include <string.h>
+
+void InitSoilSensorFilter(SoilSensorFilter* filter) {
+	memset(filter, 0, sizeof(*filter));
+}
+
+// Median of the readings in the window, by insertion sort of a copy; the window is tiny.
+static uint16_t WindowMedian(const SoilSensorFilter* filter) {
+	uint16_t sorted[SOILSENSOR_FILTER_WINDOW];
+	for (int i = 0; i < filter->windowCount; i++) {
+		int j = i;
+		for (; j > 0 && sorted[j - 1] > filter->window[i]; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = filter->window[i];
+	}
+	return sorted[filter->windowCount / 2];
+}
+
+bool UpdateSoilSensorFilter(SoilSensorFilter* filter, uint16_t* value) {
+	uint16_t reading = *value;
+	if (reading < SOILSENSOR_FILTER_MIN_VALID || reading > SOILSENSOR_FILTER_MAX_VALID) {
+		filter->rejectedCount++;
+		return false;
+	}
+
+	if (filter->windowCount > 0) {
+		int deviation = (int)reading - (int)WindowMedian(filter);
+		if (deviation > SOILSENSOR_FILTER_SPIKE_COUNTS || deviation < -SOILSENSOR_FILTER_SPIKE_COUNTS) {
+			filter->spikeCount++;
+		}
+	}
+
+	filter->window[filter->windowNext] = reading;
+	filter->windowNext = (uint8_t)((filter->windowNext + 1) % SOILSENSOR_FILTER_WINDOW);
+	if (filter->windowCount < SOILSENSOR_FILTER_WINDOW) {
+		filter->windowCount++;
+	}
+
+	int32_t median = (int32_t)WindowMedian(filter) << SOILSENSOR_FILTER_EMA_SHIFT;
+	if (filter->acceptedCount++ == 0) {
+		filter->ema = median;
+	}
+	else {
+		filter->ema += (median - filter->ema) / (1 << SOILSENSOR_FILTER_EMA_SHIFT);
+	}
+
+	// Round to the nearest count.
+	*value = (uint16_t)((filter->ema + (1 << (SOILSENSOR_FILTER_EMA_SHIFT - 1))) >> SOILSENSOR_FILTER_EMA_SHIFT);
+	return true;
+}
+
+uint32_t GetSoilSensorFilterGlitches(const SoilSensorFilter* filter) {
+	return filter->rejectedCount + filter->spikeCount;
+}
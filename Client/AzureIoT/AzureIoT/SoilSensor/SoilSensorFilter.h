@@ -0,0 +1,35 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Readings in the median window. Must be odd.
+#define SOILSENSOR_FILTER_WINDOW 5
+// The EMA moves 1/2^SOILSENSOR_FILTER_EMA_SHIFT of the way to each new median.
+#define SOILSENSOR_FILTER_EMA_SHIFT 2
+// Readings outside this range are sensor or bus faults and never enter the filter.
+#define SOILSENSOR_FILTER_MIN_VALID 1
+#define SOILSENSOR_FILTER_MAX_VALID 1000
+// A reading this far from the current median is counted as a spike. It still enters the
+// window, so that a genuine step, e.g. after watering, passes once it persists.
+#define SOILSENSOR_FILTER_SPIKE_COUNTS 100
+
+// Streaming median-of-N followed by an exponential moving average over one sensor's raw
+// readings. Fixed size, constant time per reading.
+typedef struct SoilSensorFilter {
+	uint16_t window[SOILSENSOR_FILTER_WINDOW];
+	uint8_t windowCount;
+	uint8_t windowNext;
+	int32_t ema; // Scaled by 2^SOILSENSOR_FILTER_EMA_SHIFT.
+	uint32_t acceptedCount;
+	uint32_t rejectedCount; // Out of range, dropped.
+	uint32_t spikeCount; // In range but far off the median, absorbed by it.
+} SoilSensorFilter;
+
+void InitSoilSensorFilter(SoilSensorFilter* filter);
+
+// Feeds a raw reading and stores the filtered value in *value. Returns false, leaving *value
+// untouched, if the reading was rejected as a glitch.
+bool UpdateSoilSensorFilter(SoilSensorFilter* filter, uint16_t* value);
+
+// Returns the glitches seen: rejected readings and spikes.
+uint32_t GetSoilSensorFilterGlitches(const SoilSensorFilter* filter);
@@ -0,0 +1,104 @@
+#include "SoilSensorHealth.h"
+#include <string.h>
+#include "SoilSensorFilter.h"
+
+static void SetDeadline(struct timespec* deadline, const struct timespec* now, long ms) {
+	deadline->tv_sec = now->tv_sec + ms / 1000;
+	deadline->tv_nsec = now->tv_nsec + (ms % 1000) * 1000 * 1000;
+	if (deadline->tv_nsec >= 1000 * 1000 * 1000) {
+		deadline->tv_nsec -= 1000 * 1000 * 1000;
+		deadline->tv_sec++;
+	}
+}
+
+static long QuarantineMs(uint8_t level) {
+	long ms = SOILSENSOR_HEALTH_QUARANTINE_MS;
+	for (uint8_t i = 0; i < level && ms < SOILSENSOR_HEALTH_MAX_QUARANTINE_MS; i++) {
+		ms *= 2;
+	}
+	return ms < SOILSENSOR_HEALTH_MAX_QUARANTINE_MS ? ms : SOILSENSOR_HEALTH_MAX_QUARANTINE_MS;
+}
+
+void InitSoilSensorHealth(SoilSensorHealth* health) {
+	memset(health, 0, sizeof(*health));
+	health->state = SoilSensorHealthState_Healthy;
+}
+
+bool IsSoilSensorAvailable(const SoilSensorHealth* health, const struct timespec* now) {
+	if (health->state != SoilSensorHealthState_Resetting && health->state != SoilSensorHealthState_Quarantined) {
+		return true;
+	}
+	return now->tv_sec > health->until.tv_sec
+		|| (now->tv_sec == health->until.tv_sec && now->tv_nsec >= health->until.tv_nsec);
+}
+
+SoilSensorHealthAction UpdateSoilSensorHealth(SoilSensorHealth* health, bool ok, const struct timespec* now) {
+	if (ok) {
+		if (health->state != SoilSensorHealthState_Healthy) {
+			health->state = SoilSensorHealthState_Healthy;
+			health->recoveryCount++;
+		}
+		health->failures = 0;
+		health->quarantineLevel = 0;
+		return SoilSensorHealthAction_None;
+	}
+
+	if (health->failures < UINT8_MAX) {
+		health->failures++;
+	}
+	switch (health->state) {
+	case SoilSensorHealthState_Healthy:
+		health->state = SoilSensorHealthState_Retrying;
+		health->retryCount++;
+		// The retry budget may be a single reading.
+		// fall through
+	case SoilSensorHealthState_Retrying:
+		if (health->failures < SOILSENSOR_HEALTH_MAX_RETRIES) {
+			return SoilSensorHealthAction_None;
+		}
+		health->state = SoilSensorHealthState_Resetting;
+		health->resetCount++;
+		SetDeadline(&health->until, now, SOILSENSOR_HEALTH_RESET_SETTLE_MS);
+		return SoilSensorHealthAction_Reset;
+	case SoilSensorHealthState_Resetting:
+	case SoilSensorHealthState_Quarantined:
+		health->state = SoilSensorHealthState_Quarantined;
+		health->quarantineCount++;
+		SetDeadline(&health->until, now, QuarantineMs(health->quarantineLevel));
+		if (health->quarantineLevel < UINT8_MAX) {
+			health->quarantineLevel++;
+		}
+		return SoilSensorHealthAction_None;
+	}
+	return SoilSensorHealthAction_None;
+}
+
+bool IsSoilSensorSamplePlausible(const SoilSensorSample* sample) {
+	if (!sample->hasTemperature && !sample->hasCapacitance) {
+		return false;
+	}
+	if (sample->hasTemperature
+		&& (sample->temperatureDeciC < SOILSENSOR_HEALTH_MIN_TEMPERATURE_DECI_C
+			|| sample->temperatureDeciC > SOILSENSOR_HEALTH_MAX_TEMPERATURE_DECI_C)) {
+		return false;
+	}
+	if (sample->hasCapacitance
+		&& (sample->capacitance < SOILSENSOR_FILTER_MIN_VALID || sample->capacitance > SOILSENSOR_FILTER_MAX_VALID)) {
+		return false;
+	}
+	return true;
+}
+
+const char* SoilSensorHealthStateToString(SoilSensorHealthState state) {
+	switch (state) {
+	case SoilSensorHealthState_Healthy:
+		return "Healthy";
+	case SoilSensorHealthState_Retrying:
+		return "Retrying";
+	case SoilSensorHealthState_Resetting:
+		return "Resetting";
+	case SoilSensorHealthState_Quarantined:
+		return "Quarantined";
+	}
+	return "Unknown";
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "SoilMoistureI2cSensor.h"
+
+// Consecutive failed readings after which a sensor is reset.
+#define SOILSENSOR_HEALTH_MAX_RETRIES 3
+// Time a sensor is left alone after a reset, while it reboots.
+#define SOILSENSOR_HEALTH_RESET_SETTLE_MS 1000
+// First quarantine; each further one without a recovery in between doubles it up to the maximum.
+#define SOILSENSOR_HEALTH_QUARANTINE_MS (10 * 1000)
+#define SOILSENSOR_HEALTH_MAX_QUARANTINE_MS (60 * 60 * 1000)
+// Plausible temperature range in tenths of a degree Celsius.
+#define SOILSENSOR_HEALTH_MIN_TEMPERATURE_DECI_C (-400)
+#define SOILSENSOR_HEALTH_MAX_TEMPERATURE_DECI_C 1250
+
+// Recovery ladder of one sensor: a failed reading is retried on the next period, repeated
+// failures reset the sensor, and a sensor still failing after its reset is quarantined with
+// exponential backoff. Any good reading makes it healthy again.
+typedef enum SoilSensorHealthState {
+	SoilSensorHealthState_Healthy,
+	SoilSensorHealthState_Retrying,
+	SoilSensorHealthState_Resetting,
+	SoilSensorHealthState_Quarantined
+} SoilSensorHealthState;
+
+typedef enum SoilSensorHealthAction {
+	SoilSensorHealthAction_None,
+	SoilSensorHealthAction_Reset // The caller must reset the sensor now.
+} SoilSensorHealthAction;
+
+// Updated by whoever samples the sensor; the event loop may read the counters for statistics.
+typedef struct SoilSensorHealth {
+	SoilSensorHealthState state;
+	uint8_t failures; // Consecutive failed readings.
+	uint8_t quarantineLevel; // Quarantines since the last recovery.
+	struct timespec until; // CLOCK_MONOTONIC end of reset settling or quarantine.
+	uint32_t retryCount; // Transitions to Retrying.
+	uint32_t resetCount; // Transitions to Resetting.
+	uint32_t quarantineCount; // Transitions to Quarantined.
+	uint32_t recoveryCount; // Transitions back to Healthy.
+} SoilSensorHealth;
+
+void InitSoilSensorHealth(SoilSensorHealth* health);
+
+// Returns false while the sensor settles after a reset or is quarantined; it must not be
+// read then.
+bool IsSoilSensorAvailable(const SoilSensorHealth* health, const struct timespec* now);
+
+// Records the outcome of reading the sensor and advances the ladder.
+SoilSensorHealthAction UpdateSoilSensorHealth(SoilSensorHealth* health, bool ok, const struct timespec* now);
+
+// A reading is good if it has a value and every value it has is within the sensor's range.
+bool IsSoilSensorSamplePlausible(const SoilSensorSample* sample);
+
+const char* SoilSensorHealthStateToString(SoilSensorHealthState state);
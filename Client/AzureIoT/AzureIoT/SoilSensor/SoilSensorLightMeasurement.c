@@ -0,0 +1,108 @@
+#include "SoilSensorLightMeasurement.h"
+#include <stddef.h>
+
+static const struct timespec lightPollPeriod = { 0, SOILSENSOR_LIGHT_POLL_MS * 1000 * 1000 };
+static const struct timespec lightWakePeriod = { 0, SOILMOISTURESENSOR_WAKE_MS * 1000 * 1000 };
+
+static void StopSoilSensorLightMeasurement(SoilSensorLightMeasurement* measurement) {
+	CancelSoftTimer(measurement->wheel, &measurement->pollTimer);
+	measurement->state = SoilSensorLightMeasurementState_Idle;
+	measurement->pendingMask = 0;
+}
+
+// Triggers every pending sensor at once and starts polling. Returns false if none was triggered.
+static bool TriggerSoilSensorLightMeasurement(SoilSensorLightMeasurement* measurement) {
+	for (int i = 0; i < measurement->sensorCount; i++) {
+		if ((measurement->pendingMask & (1ull << i))
+			&& TriggerLightMeasurement(measurement->addresses[i]) != I2CStatus_Ok) {
+			measurement->pendingMask &= ~(1ull << i);
+		}
+	}
+	if (measurement->pendingMask == 0) {
+		return false;
+	}
+	measurement->state = SoilSensorLightMeasurementState_Converting;
+	return SetSoftTimerToPeriod(measurement->wheel, &measurement->pollTimer, &lightPollPeriod) == 0;
+}
+
+static void SoilSensorLightMeasurementPollEventHandler(EventData* eventData) {
+	SoilSensorLightMeasurement* measurement =
+		(SoilSensorLightMeasurement*)((char*)eventData - offsetof(SoilSensorLightMeasurement, pollTimer.eventData));
+
+	if (measurement->state == SoilSensorLightMeasurementState_Waking) {
+		if (!TriggerSoilSensorLightMeasurement(measurement)) {
+			StopSoilSensorLightMeasurement(measurement);
+		}
+		return;
+	}
+
+	for (int i = 0; i < measurement->sensorCount; i++) {
+		if (!(measurement->pendingMask & (1ull << i)) || IsBusy(measurement->addresses[i])) {
+			continue;
+		}
+		measurement->pendingMask &= ~(1ull << i);
+
+		SoilSensorSample sample = { .address = measurement->addresses[i] };
+		clock_gettime(CLOCK_MONOTONIC, &sample.timestamp);
+		sample.hasLight = GetLight(measurement->addresses[i], &sample.light) == I2CStatus_Ok;
+		if (measurement->sleepAfterRead) {
+			SleepManagedSoilSensor(measurement->addresses[i], &measurement->powerStates[i]);
+		}
+		if (sample.hasLight) {
+			measurement->callback(measurement, i, &sample);
+		}
+	}
+
+	if (measurement->pendingMask != 0 && ++measurement->busyPolls >= SOILSENSOR_LIGHT_MAX_POLLS) {
+		Log_Debug("ERROR: Soil sensor light measurement timed out\n");
+		measurement->pendingMask = 0;
+	}
+	if (measurement->pendingMask == 0) {
+		StopSoilSensorLightMeasurement(measurement);
+	}
+}
+
+int StartSoilSensorLightMeasurement(TimerWheel* wheel, SoilSensorLightMeasurement* measurement) {
+	if (measurement->state != SoilSensorLightMeasurementState_Idle || measurement->sensorCount <= 0
+		|| measurement->sensorCount > SOILSENSOR_LIGHT_MAX_SENSORS) {
+		return -1;
+	}
+
+	measurement->wheel = wheel;
+	measurement->pollTimer.eventData.eventHandler = &SoilSensorLightMeasurementPollEventHandler;
+	measurement->busyPolls = 0;
+	measurement->pendingMask = measurement->sensorCount == 64 ? ~0ull : (1ull << measurement->sensorCount) - 1;
+
+	// Sleeping sensors ignore the transfer which wakes them, so trigger once they are all up.
+	bool woken = false;
+	for (int i = 0; i < measurement->sensorCount; i++) {
+		woken |= WakeManagedSoilSensor(measurement->addresses[i], &measurement->powerStates[i]);
+	}
+	if (woken) {
+		measurement->state = SoilSensorLightMeasurementState_Waking;
+		if (SetSoftTimerToSingleExpiry(wheel, &measurement->pollTimer, &lightWakePeriod) != 0) {
+			StopSoilSensorLightMeasurement(measurement);
+			return -1;
+		}
+		return 0;
+	}
+	if (!TriggerSoilSensorLightMeasurement(measurement)) {
+		StopSoilSensorLightMeasurement(measurement);
+		return -1;
+	}
+	return 0;
+}
+
+void CancelSoilSensorLightMeasurement(SoilSensorLightMeasurement* measurement) {
+	if (measurement->state != SoilSensorLightMeasurementState_Idle) {
+		StopSoilSensorLightMeasurement(measurement);
+	}
+}
+
+bool IsSoilSensorLightMeasurementRunning(const SoilSensorLightMeasurement* measurement) {
+	return measurement->state != SoilSensorLightMeasurementState_Idle;
+}
+
+bool IsSoilSensorLightPending(const SoilSensorLightMeasurement* measurement, int sensorIndex) {
+	return (measurement->pendingMask & (1ull << sensorIndex)) != 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+#include "SoilMoistureI2cSensor.h"
+#include "SoilSensorPower.h"
+#include "../epoll_timerfd_utilities.h"
+
+// Interval between busy polls while light conversions are in progress.
+#define SOILSENSOR_LIGHT_POLL_MS 250
+// Busy polls after which the sensors still converting are abandoned.
+#define SOILSENSOR_LIGHT_MAX_POLLS 40
+// Maximum number of sensors measured together.
+#define SOILSENSOR_LIGHT_MAX_SENSORS 64
+
+typedef enum SoilSensorLightMeasurementState {
+	SoilSensorLightMeasurementState_Idle,
+	SoilSensorLightMeasurementState_Waking,
+	SoilSensorLightMeasurementState_Converting
+} SoilSensorLightMeasurementState;
+
+struct SoilSensorLightMeasurement;
+
+// Called from the event loop for each sensor whose light reading was read, with hasLight set.
+typedef void (*SoilSensorLightCallback)(struct SoilSensorLightMeasurement* measurement,
+	int sensorIndex, const SoilSensorSample* sample);
+
+// A resumable light measurement of a set of sensors: wake those which sleep, trigger all
+// conversions at once, then poll busy from a soft timer and read each sensor as it finishes.
+// Populate the fields up to sleepAfterRead; the struct and the arrays it points to must remain
+// valid while a measurement is running.
+typedef struct SoilSensorLightMeasurement {
+	const I2C_DeviceAddress* addresses;
+	SoilSensorPowerState* powerStates; // One per sensor.
+	int sensorCount;
+	SoilSensorLightCallback callback;
+	void* context;
+	bool sleepAfterRead; // Put each sensor to sleep once it has been read.
+	SoilSensorLightMeasurementState state;
+	uint64_t pendingMask; // Sensors triggered or about to be, and not yet read.
+	unsigned int busyPolls;
+	SoftTimer pollTimer;
+	TimerWheel* wheel;
+} SoilSensorLightMeasurement;
+
+// Starts the measurement and returns immediately; the callback reports each reading.
+// Returns 0 on success, or -1 if a measurement is already running or no sensor was triggered.
+int StartSoilSensorLightMeasurement(TimerWheel* wheel, SoilSensorLightMeasurement* measurement);
+
+// Abandons a running measurement without calling the callback.
+void CancelSoilSensorLightMeasurement(SoilSensorLightMeasurement* measurement);
+
+bool IsSoilSensorLightMeasurementRunning(const SoilSensorLightMeasurement* measurement);
+
+// Returns whether a sensor is part of the running measurement and not read yet. Its busy flag
+// covers the light conversion, so it cannot be measured otherwise meanwhile.
+bool IsSoilSensorLightPending(const SoilSensorLightMeasurement* measurement, int sensorIndex);
@@ -0,0 +1,90 @@
+#include "SoilSensorMeasurement.h"
+#include <stddef.h>
+
+static const struct timespec measurementPollPeriod = { 0, SOILSENSOR_MEASUREMENT_POLL_MS * 1000 * 1000 };
+static const struct timespec measurementWakePeriod = { 0, SOILMOISTURESENSOR_WAKE_MS * 1000 * 1000 };
+
+static void CompleteSoilSensorMeasurement(SoilSensorMeasurement* measurement, SoilSensorMeasurementStatus status) {
+	CancelSoftTimer(measurement->wheel, &measurement->pollTimer);
+	measurement->state = SoilSensorMeasurementState_Idle;
+	if (measurement->sleepAfterRead) {
+		SleepManagedSoilSensor(measurement->address, measurement->power);
+	}
+	measurement->callback(measurement, status, &measurement->sample);
+}
+
+// Triggers the conversion and starts polling busy. Returns false if the trigger failed.
+static bool TriggerSoilSensorMeasurement(SoilSensorMeasurement* measurement) {
+	if (TriggerMeasurement(measurement->address) != I2CStatus_Ok) {
+		return false;
+	}
+	measurement->state = SoilSensorMeasurementState_Converting;
+	if (SetSoftTimerToPeriod(measurement->wheel, &measurement->pollTimer, &measurementPollPeriod) != 0) {
+		measurement->state = SoilSensorMeasurementState_Idle;
+		return false;
+	}
+	return true;
+}
+
+static void SoilSensorMeasurementPollEventHandler(EventData* eventData) {
+	SoilSensorMeasurement* measurement =
+		(SoilSensorMeasurement*)((char*)eventData - offsetof(SoilSensorMeasurement, pollTimer.eventData));
+
+	if (measurement->state == SoilSensorMeasurementState_Waking) {
+		if (!TriggerSoilSensorMeasurement(measurement)) {
+			CompleteSoilSensorMeasurement(measurement, SoilSensorMeasurementStatus_BusError);
+		}
+		return;
+	}
+
+	if (IsBusy(measurement->address)) {
+		if (++measurement->busyPolls >= SOILSENSOR_MEASUREMENT_MAX_POLLS) {
+			Log_Debug("ERROR: Soil sensor (Address: %X) measurement timed out\n", measurement->address);
+			CompleteSoilSensorMeasurement(measurement, SoilSensorMeasurementStatus_Timeout);
+		}
+		return;
+	}
+
+	SoilSensorSample* sample = &measurement->sample;
+	sample->address = measurement->address;
+	clock_gettime(CLOCK_MONOTONIC, &sample->timestamp);
+	sample->hasTemperature = GetTemperature(measurement->address, &sample->temperatureDeciC) == I2CStatus_Ok;
+	sample->hasCapacitance = GetCapacitance(measurement->address, &sample->capacitance) == I2CStatus_Ok;
+	CompleteSoilSensorMeasurement(measurement,
+		sample->hasTemperature || sample->hasCapacitance ? SoilSensorMeasurementStatus_Ok : SoilSensorMeasurementStatus_BusError);
+}
+
+int StartSoilSensorMeasurement(TimerWheel* wheel, SoilSensorMeasurement* measurement) {
+	if (measurement->state != SoilSensorMeasurementState_Idle) {
+		return -1;
+	}
+
+	measurement->wheel = wheel;
+	measurement->pollTimer.eventData.eventHandler = &SoilSensorMeasurementPollEventHandler;
+	measurement->busyPolls = 0;
+	measurement->sample.hasTemperature = false;
+	measurement->sample.hasCapacitance = false;
+	measurement->sample.hasLight = false;
+
+	// A sleeping sensor ignores the transfer which wakes it, so trigger once it is up.
+	if (WakeManagedSoilSensor(measurement->address, measurement->power)) {
+		measurement->state = SoilSensorMeasurementState_Waking;
+		if (SetSoftTimerToSingleExpiry(wheel, &measurement->pollTimer, &measurementWakePeriod) != 0) {
+			measurement->state = SoilSensorMeasurementState_Idle;
+			return -1;
+		}
+		return 0;
+	}
+	return TriggerSoilSensorMeasurement(measurement) ? 0 : -1;
+}
+
+void CancelSoilSensorMeasurement(SoilSensorMeasurement* measurement) {
+	if (measurement->state != SoilSensorMeasurementState_Idle) {
+		CancelSoftTimer(measurement->wheel, &measurement->pollTimer);
+		measurement->state = SoilSensorMeasurementState_Idle;
+	}
+}
+
+bool IsSoilSensorMeasurementRunning(const SoilSensorMeasurement* measurement) {
+	return measurement->state != SoilSensorMeasurementState_Idle;
+}
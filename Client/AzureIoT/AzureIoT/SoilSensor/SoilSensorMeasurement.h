@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include "SoilMoistureI2cSensor.h"
+#include "SoilSensorPower.h"
+#include "../epoll_timerfd_utilities.h"
+
+// Interval between busy polls while a conversion is in progress.
+#define SOILSENSOR_MEASUREMENT_POLL_MS 20
+// Busy polls after which a measurement is abandoned.
+#define SOILSENSOR_MEASUREMENT_MAX_POLLS 25
+
+typedef enum SoilSensorMeasurementStatus {
+	SoilSensorMeasurementStatus_Ok,
+	SoilSensorMeasurementStatus_Timeout,
+	SoilSensorMeasurementStatus_BusError // Neither value could be read.
+} SoilSensorMeasurementStatus;
+
+typedef enum SoilSensorMeasurementState {
+	SoilSensorMeasurementState_Idle,
+	SoilSensorMeasurementState_Waking,
+	SoilSensorMeasurementState_Converting
+} SoilSensorMeasurementState;
+
+struct SoilSensorMeasurement;
+
+// Called from the event loop when a measurement completes. sample is only valid for
+// SoilSensorMeasurementStatus_Ok, and then only the values with their has* flag set.
+typedef void (*SoilSensorMeasurementCallback)(struct SoilSensorMeasurement* measurement,
+	SoilSensorMeasurementStatus status, const SoilSensorSample* sample);
+
+// A resumable measurement of one sensor: wake it if it sleeps, trigger the conversion, poll
+// busy from a soft timer until the sensor is done, then read temperature and capacitance.
+// Measurements of different sensors run concurrently so that their conversions overlap.
+// Populate address, callback and power; the struct must remain valid while a measurement is
+// running.
+typedef struct SoilSensorMeasurement {
+	I2C_DeviceAddress address;
+	SoilSensorMeasurementCallback callback;
+	void* context;
+	SoilSensorPowerState* power;
+	bool sleepAfterRead; // Put the sensor to sleep once it has been read.
+	SoilSensorMeasurementState state;
+	unsigned int busyPolls;
+	SoftTimer pollTimer;
+	TimerWheel* wheel;
+	SoilSensorSample sample;
+} SoilSensorMeasurement;
+
+// Triggers a conversion, or wakes the sensor first, and returns immediately; the callback
+// reports the result. Returns 0 on success, or -1 if a measurement is already running or the
+// trigger failed.
+int StartSoilSensorMeasurement(TimerWheel* wheel, SoilSensorMeasurement* measurement);
+
+// Abandons a running measurement without calling the callback.
+void CancelSoilSensorMeasurement(SoilSensorMeasurement* measurement);
+
+bool IsSoilSensorMeasurementRunning(const SoilSensorMeasurement* measurement);
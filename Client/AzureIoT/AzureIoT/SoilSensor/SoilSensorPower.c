@@ -0,0 +1,58 @@
+#include "SoilSensorPower.h"
+
+// 64 bit, as a 32 bit count of milliseconds wraps after 49.7 days of uptime.
+static uint64_t ElapsedMs(const struct timespec* since, const struct timespec* now) {
+	return (uint64_t)((int64_t)(now->tv_sec - since->tv_sec) * 1000 + (now->tv_nsec - since->tv_nsec) / (1000 * 1000));
+}
+
+void InitSoilSensorPowerState(SoilSensorPowerState* state) {
+	state->asleep = false;
+	clock_gettime(CLOCK_MONOTONIC, &state->awakeSince);
+	state->trackedSince = state->awakeSince;
+	state->awakeMs = 0;
+	state->sleepCount = 0;
+	state->sleepFailures = 0;
+}
+
+I2CStatus SleepManagedSoilSensor(I2C_DeviceAddress sensorAddress, SoilSensorPowerState* state) {
+	if (state->asleep) {
+		return I2CStatus_Ok;
+	}
+	I2CStatus status = SleepSoilSensor(sensorAddress);
+	if (status != I2CStatus_Ok) {
+		state->sleepFailures++;
+		return status;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	state->awakeMs += ElapsedMs(&state->awakeSince, &now);
+	state->sleepCount++;
+	state->asleep = true;
+	return status;
+}
+
+bool WakeManagedSoilSensor(I2C_DeviceAddress sensorAddress, SoilSensorPowerState* state) {
+	if (!state->asleep) {
+		return false;
+	}
+	WakeSoilSensor(sensorAddress);
+	clock_gettime(CLOCK_MONOTONIC, &state->awakeSince);
+	state->asleep = false;
+	return true;
+}
+
+uint64_t GetSoilSensorAwakeMs(const SoilSensorPowerState* state) {
+	if (state->asleep) {
+		return state->awakeMs;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return state->awakeMs + ElapsedMs(&state->awakeSince, &now);
+}
+
+uint32_t GetSoilSensorAwakePerMille(const SoilSensorPowerState* state) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t trackedMs = ElapsedMs(&state->trackedSince, &now);
+	return trackedMs > 0 ? (uint32_t)(GetSoilSensorAwakeMs(state) * 1000 / trackedMs) : 1000;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "SoilMoistureI2cSensor.h"
+
+// Sleep state and awake-time accounting of one sensor. Whoever owns the I2C bus updates it;
+// the event loop may read the counters at any time for statistics.
+typedef struct SoilSensorPowerState {
+	bool asleep;
+	struct timespec awakeSince; // CLOCK_MONOTONIC time the sensor last woke, if awake.
+	struct timespec trackedSince; // CLOCK_MONOTONIC time accounting started.
+	uint64_t awakeMs; // Awake time of the completed awake periods.
+	uint32_t sleepCount;
+	uint32_t sleepFailures;
+} SoilSensorPowerState;
+
+// Starts accounting for a sensor which is awake, e.g. after a reset.
+void InitSoilSensorPowerState(SoilSensorPowerState* state);
+
+// Puts an awake sensor to sleep. The sensor is still counted awake if the command fails.
+I2CStatus SleepManagedSoilSensor(I2C_DeviceAddress sensorAddress, SoilSensorPowerState* state);
+
+// Wakes the sensor if it is asleep. Returns true if it was, in which case the caller must
+// wait SOILMOISTURESENSOR_WAKE_MS before addressing it.
+bool WakeManagedSoilSensor(I2C_DeviceAddress sensorAddress, SoilSensorPowerState* state);
+
+// Total awake time, including the current awake period.
+uint64_t GetSoilSensorAwakeMs(const SoilSensorPowerState* state);
+
+// Awake time per mille of the time since accounting started.
+uint32_t GetSoilSensorAwakePerMille(const SoilSensorPowerState* state);
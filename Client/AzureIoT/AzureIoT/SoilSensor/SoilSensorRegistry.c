@@ -0,0 +1,87 @@
+#include "SoilSensorRegistry.h"
+#include <string.h>
+#include "../number_format.h"
+
+static const uint8_t ctrlVersionData[] = { SOILMOISTURESENSOR_GET_VERSION };
+static const uint8_t ctrlGetAddressData[] = { SOILMOISTURESENSOR_GET_ADDRESS };
+
+// Other devices on the bus may acknowledge the version register, but will not echo their own
+// address from register 0x02.
+static bool ProbeSoilSensor(I2C_DeviceAddress address, uint8_t* version) {
+	uint8_t reportedAddress;
+	return TryReadI2CRegister8bit(address, ctrlVersionData, version)
+		&& *version != 0x00 && *version != 0xFF
+		&& TryReadI2CRegister8bit(address, ctrlGetAddressData, &reportedAddress)
+		&& reportedAddress == I2C_DEVICE_ADDRESS(address);
+}
+
+// Registers the sensors on one bus segment. muxAddress 0 scans the devices directly on the bus.
+static void ScanBusSegment(SoilSensorRegistry* registry, I2C_DeviceAddress muxAddress, unsigned int channel,
+	I2C_DeviceAddress waterTankAddress, int* soilCount) {
+	for (I2C_DeviceAddress deviceAddress = SOILSENSOR_SCAN_FIRST_ADDRESS;
+		deviceAddress <= SOILSENSOR_SCAN_LAST_ADDRESS && registry->count < SOILSENSOR_REGISTRY_MAX_SENSORS;
+		deviceAddress++) {
+		I2C_DeviceAddress address = muxAddress == 0 ? deviceAddress : I2C_MUXED_ADDRESS(muxAddress, channel, deviceAddress);
+		uint8_t version;
+		// A device directly on the bus answers on every mux channel as well.
+		if (FindSoilSensor(registry, deviceAddress) >= 0 || !ProbeSoilSensor(address, &version)) {
+			continue;
+		}
+
+		int i = registry->count++;
+		registry->addresses[i] = address;
+		registry->versions[i] = version;
+		// Only the sensor directly on the bus can be the water tank, see ScanSoilSensors.
+		if (muxAddress == 0 && deviceAddress == waterTankAddress) {
+			registry->roles[i] = SoilSensorRole_WaterTank;
+			registry->soilNumbers[i] = 0;
+		}
+		else {
+			registry->roles[i] = SoilSensorRole_Soil;
+			registry->soilNumbers[i] = (uint8_t)++*soilCount;
+		}
+		Log_Debug("Soil sensor found (Address: %X, version: %X)\n", address, version);
+	}
+}
+
+int ScanSoilSensors(SoilSensorRegistry* registry, I2C_DeviceAddress waterTankAddress) {
+	I2C_DeviceAddress muxAddresses[SOILSENSOR_REGISTRY_MAX_MUXES];
+	int muxCount = FindI2CMuxes(muxAddresses, SOILSENSOR_REGISTRY_MAX_MUXES);
+	int soilCount = 0;
+	registry->count = 0;
+
+	ScanBusSegment(registry, 0, 0, waterTankAddress, &soilCount);
+	for (int mux = 0; mux < muxCount; mux++) {
+		for (unsigned int channel = 0; channel < I2C_MUX_CHANNELS; channel++) {
+			ScanBusSegment(registry, muxAddresses[mux], channel, waterTankAddress, &soilCount);
+		}
+	}
+	return registry->count;
+}
+
+int FindSoilSensor(const SoilSensorRegistry* registry, I2C_DeviceAddress address) {
+	for (int i = 0; i < registry->count; i++) {
+		if (registry->addresses[i] == address) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void FormatSoilSensorName(const SoilSensorRegistry* registry, int sensorIndex, const char* quantity,
+	char* name, size_t nameSize) {
+	// Called for every telemetry value, so built without printf.
+	size_t length = strlen(quantity);
+	if (length >= nameSize) {
+		name[0] = '\0';
+		return;
+	}
+	memcpy(name, quantity, length);
+	if (registry->roles[sensorIndex] == SoilSensorRole_WaterTank) {
+		strncpy(name + length, "WaterTank", nameSize - length);
+		name[nameSize - 1] = '\0';
+	}
+	else if (FormatInteger(name + length, nameSize - length, registry->soilNumbers[sensorIndex]) < 0) {
+		name[length] = '\0';
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "SoilMoistureI2cSensor.h"
+
+// Maximum number of sensors on one bus, including sensors behind muxes.
+#define SOILSENSOR_REGISTRY_MAX_SENSORS 32
+// Maximum number of muxes scanned.
+#define SOILSENSOR_REGISTRY_MAX_MUXES 8
+// Scanned address range, excluding the reserved I2C addresses and the mux addresses.
+#define SOILSENSOR_SCAN_FIRST_ADDRESS 0x08
+#define SOILSENSOR_SCAN_LAST_ADDRESS (I2C_MUX_FIRST_ADDRESS - 1)
+
+typedef enum SoilSensorRole {
+	SoilSensorRole_Soil,
+	SoilSensorRole_WaterTank
+} SoilSensorRole;
+
+// Chirp sensors found on the bus: first those directly on the bus, then those behind each mux
+// channel in turn, so that reading them in order switches each mux channel once. Struct of
+// arrays so that loops over one attribute touch only that array.
+typedef struct SoilSensorRegistry {
+	int count;
+	I2C_DeviceAddress addresses[SOILSENSOR_REGISTRY_MAX_SENSORS];
+	uint8_t versions[SOILSENSOR_REGISTRY_MAX_SENSORS];
+	uint8_t roles[SOILSENSOR_REGISTRY_MAX_SENSORS]; // SoilSensorRole.
+	uint8_t soilNumbers[SOILSENSOR_REGISTRY_MAX_SENSORS]; // 1-based among soil sensors, 0 for the water tank.
+} SoilSensorRegistry;
+
+// Finds the muxes, then probes every address in the scan range directly and on each mux
+// channel. Devices which answer like a Chirp sensor are registered: the version register reads
+// back and the address register reports the probed address. The sensor directly on the bus at
+// waterTankAddress, a plain device address, gets the water tank role; sensors behind a mux always
+// measure soil, whatever their device address. Returns the number of sensors found.
+int ScanSoilSensors(SoilSensorRegistry* registry, I2C_DeviceAddress waterTankAddress);
+
+// Returns the index of the sensor on address, or -1.
+int FindSoilSensor(const SoilSensorRegistry* registry, I2C_DeviceAddress address);
+
+// Formats the telemetry name of a sensor value, e.g. "Capacitance2" or "CapacitanceWaterTank".
+void FormatSoilSensorName(const SoilSensorRegistry* registry, int sensorIndex, const char* quantity,
+	char* name, size_t nameSize);
@@ -0,0 +1,43 @@
+#include "SoilSensorSampleCache.h"
+#include <string.h>
+
+void InitSoilSensorSampleCache(SoilSensorSampleCache* cache, const I2C_DeviceAddress* sensorAddresses, int sensorCount) {
+	memset(cache, 0, sizeof(*cache));
+	if (sensorCount > SOILSENSOR_SAMPLE_CACHE_MAX_SENSORS) {
+		sensorCount = SOILSENSOR_SAMPLE_CACHE_MAX_SENSORS;
+	}
+	cache->sensorCount = sensorCount;
+	memcpy(cache->addresses, sensorAddresses, (size_t)sensorCount * sizeof(I2C_DeviceAddress));
+}
+
+int UpdateSoilSensorSampleCache(SoilSensorSampleCache* cache, const SoilSensorSample* sample) {
+	for (int i = 0; i < cache->sensorCount; i++) {
+		if (cache->addresses[i] == sample->address) {
+			cache->samples[i] = *sample;
+			cache->valid[i] = true;
+			cache->updateCount++;
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool GetCachedSoilSensorSample(SoilSensorSampleCache* cache, int sensorIndex, long maxAgeMs, SoilSensorSample* sample) {
+	if (sensorIndex < 0 || sensorIndex >= cache->sensorCount || !cache->valid[sensorIndex]) {
+		cache->staleCount++;
+		return false;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const struct timespec* taken = &cache->samples[sensorIndex].timestamp;
+	long ageMs = (now.tv_sec - taken->tv_sec) * 1000 + (now.tv_nsec - taken->tv_nsec) / (1000 * 1000);
+	if (ageMs > maxAgeMs) {
+		cache->staleCount++;
+		return false;
+	}
+
+	*sample = cache->samples[sensorIndex];
+	cache->hitCount++;
+	return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "SoilMoistureI2cSensor.h"
+
+// Maximum number of sensors held by a sample cache.
+#define SOILSENSOR_SAMPLE_CACHE_MAX_SENSORS 32
+
+// Latest sample of each sensor, fed by a single sampling schedule and shared by the watering
+// decision and telemetry. Readers state how old a sample may be; older samples are stale.
+typedef struct SoilSensorSampleCache {
+	int sensorCount;
+	I2C_DeviceAddress addresses[SOILSENSOR_SAMPLE_CACHE_MAX_SENSORS];
+	bool valid[SOILSENSOR_SAMPLE_CACHE_MAX_SENSORS];
+	SoilSensorSample samples[SOILSENSOR_SAMPLE_CACHE_MAX_SENSORS];
+	uint32_t updateCount; // Samples stored.
+	uint32_t hitCount; // Lookups answered with a fresh sample.
+	uint32_t staleCount; // Lookups refused because the sample was missing or too old.
+} SoilSensorSampleCache;
+
+// Empties the cache and assigns one slot per sensor address, in order.
+void InitSoilSensorSampleCache(SoilSensorSampleCache* cache, const I2C_DeviceAddress* sensorAddresses, int sensorCount);
+
+// Stores a sample in the slot of its address. Returns the slot index, or -1 for an unknown address.
+int UpdateSoilSensorSampleCache(SoilSensorSampleCache* cache, const SoilSensorSample* sample);
+
+// Gets the sample in a slot if it was taken at most maxAgeMs ago. Returns false if it is stale.
+bool GetCachedSoilSensorSample(SoilSensorSampleCache* cache, int sensorIndex, long maxAgeMs, SoilSensorSample* sample);
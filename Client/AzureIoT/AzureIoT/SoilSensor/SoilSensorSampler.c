@@ -0,0 +1,337 @@
+#include "SoilSensorSampler.h"
+#include "SoilSensorMeasurement.h"
+#include "SoilSensorLightMeasurement.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static pthread_t samplerThread;
+static bool samplerThreadStarted = false;
+static atomic_bool samplerStopRequested = false;
+static atomic_bool samplerPaused = false;
+static atomic_bool samplerSleepEnabled = false;
+static atomic_bool samplerLightRequested = false;
+static int samplerEventFd = -1;
+
+static I2C_DeviceAddress samplerAddresses[SOILSENSOR_SAMPLER_MAX_SENSORS];
+static int samplerSensorCount = 0;
+static struct timespec samplerPeriod;
+static SoilSensorSampleRing* samplerRing = NULL;
+static SoilSensorPowerState* samplerPowerStates = NULL;
+static SoilSensorHealth* samplerHealth = NULL;
+
+// Sensors with a light conversion in progress, owned by the sampler thread.
+static uint64_t lightPendingMask = 0;
+static struct timespec lightTriggerTime;
+
+// Stats copied out by the sampler thread after every pass, guarded by snapshotMutex.
+static pthread_mutex_t snapshotMutex = PTHREAD_MUTEX_INITIALIZER;
+static SoilSensorSamplerSnapshot snapshot;
+
+bool PushSoilSensorSample(SoilSensorSampleRing* ring, const SoilSensorSample* sample) {
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (tail - head == SOILSENSOR_SAMPLE_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->droppedCount, 1, memory_order_relaxed);
+		return false;
+	}
+	ring->samples[tail & (SOILSENSOR_SAMPLE_RING_SIZE - 1)] = *sample;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+bool PopSoilSensorSample(SoilSensorSampleRing* ring, SoilSensorSample* sample) {
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head == tail) {
+		return false;
+	}
+	*sample = ring->samples[head & (SOILSENSOR_SAMPLE_RING_SIZE - 1)];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return true;
+}
+
+static void AddMs(struct timespec* time, long ms) {
+	time->tv_nsec += ms * 1000 * 1000;
+	while (time->tv_nsec >= 1000 * 1000 * 1000) {
+		time->tv_nsec -= 1000 * 1000 * 1000;
+		time->tv_sec++;
+	}
+	while (time->tv_nsec < 0) {
+		time->tv_nsec += 1000 * 1000 * 1000;
+		time->tv_sec--;
+	}
+}
+
+// Advances deadline by one period. A deadline already missed restarts the schedule from now
+// instead of sampling back to back to catch up.
+static void AdvanceSamplerDeadline(struct timespec* deadline) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline->tv_sec += samplerPeriod.tv_sec;
+	AddMs(deadline, samplerPeriod.tv_nsec / (1000 * 1000));
+	if (deadline->tv_sec < now.tv_sec || (deadline->tv_sec == now.tv_sec && deadline->tv_nsec < now.tv_nsec)) {
+		*deadline = now;
+	}
+}
+
+static void SleepUntil(const struct timespec* time) {
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, time, NULL) == EINTR) {
+	}
+}
+
+static void WakeSoilSensors(void) {
+	for (int i = 0; i < samplerSensorCount; i++) {
+		WakeManagedSoilSensor(samplerAddresses[i], &samplerPowerStates[i]);
+	}
+}
+
+// Reads the latched values of every sensor not in skipMask. Returns the sensors read.
+static uint64_t ReadSoilSensors(SoilSensorSample* samples, uint64_t skipMask) {
+	uint64_t sampledMask = 0;
+	for (int i = 0; i < samplerSensorCount; i++) {
+		if (!(skipMask & (1ull << i))) {
+			ReadSoilSensorSample(samplerAddresses[i], &samples[i]);
+			sampledMask |= 1ull << i;
+		}
+	}
+	return sampledMask;
+}
+
+// Measures the sensors not in skipMask afresh, as the latched values of a sensor which slept
+// are stale: trigger every conversion, poll until none is busy, read each sensor and put it to
+// sleep. Returns the sensors attempted; those which failed have no value.
+static uint64_t MeasureSoilSensorsAndSleep(SoilSensorSample* samples, uint64_t skipMask) {
+	static const struct timespec pollPeriod = { 0, SOILSENSOR_MEASUREMENT_POLL_MS * 1000 * 1000 };
+	uint64_t pendingMask = 0;
+	uint64_t sampledMask = 0;
+
+	for (int i = 0; i < samplerSensorCount; i++) {
+		samples[i].address = samplerAddresses[i];
+		samples[i].hasTemperature = false;
+		samples[i].hasCapacitance = false;
+		samples[i].hasLight = false;
+		clock_gettime(CLOCK_MONOTONIC, &samples[i].timestamp);
+		if (skipMask & (1ull << i)) {
+			continue;
+		}
+		sampledMask |= 1ull << i;
+		if (TriggerMeasurement(samplerAddresses[i]) == I2CStatus_Ok) {
+			pendingMask |= 1ull << i;
+		}
+	}
+	for (int poll = 0; pendingMask != 0 && poll < SOILSENSOR_MEASUREMENT_MAX_POLLS; poll++) {
+		nanosleep(&pollPeriod, NULL);
+		for (int i = 0; i < samplerSensorCount; i++) {
+			if ((pendingMask & (1ull << i)) && !IsBusy(samplerAddresses[i])) {
+				pendingMask &= ~(1ull << i);
+				clock_gettime(CLOCK_MONOTONIC, &samples[i].timestamp);
+				samples[i].hasTemperature = GetTemperature(samplerAddresses[i], &samples[i].temperatureDeciC) == I2CStatus_Ok;
+				samples[i].hasCapacitance = GetCapacitance(samplerAddresses[i], &samples[i].capacitance) == I2CStatus_Ok;
+				SleepManagedSoilSensor(samplerAddresses[i], &samplerPowerStates[i]);
+			}
+		}
+	}
+	// Sensors which never finished are left awake and measured again next period.
+	return sampledMask;
+}
+
+// Triggers a light conversion on every sensor at once. The sensors were woken ahead of the period.
+static void TriggerSoilSensorLight(void) {
+	for (int i = 0; i < samplerSensorCount; i++) {
+		if (TriggerLightMeasurement(samplerAddresses[i]) == I2CStatus_Ok) {
+			lightPendingMask |= 1ull << i;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &lightTriggerTime);
+}
+
+// Publishes the light reading of each sensor whose conversion finished, without waiting for
+// the others. Returns true if a sample was published.
+static bool CollectSoilSensorLight(bool sleepEnabled) {
+	bool published = false;
+	for (int i = 0; i < samplerSensorCount; i++) {
+		if (!(lightPendingMask & (1ull << i)) || IsBusy(samplerAddresses[i])) {
+			continue;
+		}
+		lightPendingMask &= ~(1ull << i);
+
+		SoilSensorSample sample = { .address = samplerAddresses[i] };
+		clock_gettime(CLOCK_MONOTONIC, &sample.timestamp);
+		sample.hasLight = GetLight(samplerAddresses[i], &sample.light) == I2CStatus_Ok;
+		if (sleepEnabled) {
+			SleepManagedSoilSensor(samplerAddresses[i], &samplerPowerStates[i]);
+		}
+		if (sample.hasLight) {
+			published |= PushSoilSensorSample(samplerRing, &sample);
+		}
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long elapsedMs = (now.tv_sec - lightTriggerTime.tv_sec) * 1000 + (now.tv_nsec - lightTriggerTime.tv_nsec) / (1000 * 1000);
+	if (lightPendingMask != 0 && elapsedMs >= SOILSENSOR_LIGHT_MAX_POLLS * SOILSENSOR_LIGHT_POLL_MS) {
+		Log_Debug("ERROR: Soil sensor light measurement timed out\n");
+		lightPendingMask = 0;
+	}
+	return published;
+}
+
+// Sensors which settle after a reset or are quarantined are not read.
+static uint64_t UnavailableSoilSensors(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t unavailableMask = 0;
+	for (int i = 0; i < samplerSensorCount; i++) {
+		if (!IsSoilSensorAvailable(&samplerHealth[i], &now)) {
+			unavailableMask |= 1ull << i;
+		}
+	}
+	return unavailableMask;
+}
+
+// Advances the recovery ladder of every sensor read, resetting those which keep failing.
+static void UpdateSoilSensorsHealth(const SoilSensorSample* samples, uint64_t sampledMask) {
+	static const struct timespec wakePeriod = { 0, SOILMOISTURESENSOR_WAKE_MS * 1000 * 1000 };
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < samplerSensorCount; i++) {
+		if ((sampledMask & (1ull << i))
+			&& UpdateSoilSensorHealth(&samplerHealth[i], IsSoilSensorSamplePlausible(&samples[i]), &now) == SoilSensorHealthAction_Reset) {
+			Log_Debug("WARNING: Resetting soil sensor (Address: %X)\n", samplerAddresses[i]);
+			// A sleeping sensor ignores the transfer which wakes it, so wait until it is up.
+			if (WakeManagedSoilSensor(samplerAddresses[i], &samplerPowerStates[i])) {
+				nanosleep(&wakePeriod, NULL);
+			}
+			ResetSoilSensor(samplerAddresses[i]);
+		}
+	}
+}
+
+// Publishes the stats of the sensors and the bus, called by whoever owns the bus.
+static void PublishSoilSensorSamplerSnapshot(void) {
+	pthread_mutex_lock(&snapshotMutex);
+	snapshot.sensorCount = samplerSensorCount;
+	for (int i = 0; i < samplerSensorCount; i++) {
+		const I2CAddressStats* addressStats = GetI2CAddressStats(samplerAddresses[i]);
+		snapshot.powerStates[i] = samplerPowerStates[i];
+		snapshot.health[i] = samplerHealth[i];
+		snapshot.addressStats[i] = addressStats != NULL ? *addressStats : (I2CAddressStats){ 0 };
+	}
+	snapshot.busSpeedStats = *GetI2CBusSpeedStats();
+	snapshot.muxStats = *GetI2CMuxStats();
+	pthread_mutex_unlock(&snapshotMutex);
+}
+
+void GetSoilSensorSamplerSnapshot(SoilSensorSamplerSnapshot* copy) {
+	pthread_mutex_lock(&snapshotMutex);
+	*copy = snapshot;
+	pthread_mutex_unlock(&snapshotMutex);
+}
+
+static void* SoilSensorSamplerThread(void* arg) {
+	static SoilSensorSample samples[SOILSENSOR_SAMPLER_MAX_SENSORS];
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	while (!atomic_load(&samplerStopRequested)) {
+		bool sleepEnabled = atomic_load(&samplerSleepEnabled);
+		if (!atomic_load(&samplerPaused)) {
+			bool published = false;
+			if (lightPendingMask == 0 && atomic_exchange(&samplerLightRequested, false)) {
+				TriggerSoilSensorLight();
+			}
+
+			// A sensor converting light reports busy, so it is left alone until it was read.
+			uint64_t skipMask = lightPendingMask | UnavailableSoilSensors();
+			uint64_t sampledMask = sleepEnabled
+				? MeasureSoilSensorsAndSleep(samples, skipMask)
+				: ReadSoilSensors(samples, skipMask);
+			UpdateSoilSensorsHealth(samples, sampledMask);
+			for (int i = 0; i < samplerSensorCount; i++) {
+				if (sampledMask & (1ull << i)) {
+					published |= PushSoilSensorSample(samplerRing, &samples[i]);
+				}
+			}
+			published |= CollectSoilSensorLight(sleepEnabled);
+			if (published) {
+				uint64_t increment = 1;
+				if (write(samplerEventFd, &increment, sizeof(increment)) == -1) {
+					Log_Debug("ERROR: Could not signal soil sensor sampler eventfd: errno=%d (%s)\n", errno, strerror(errno));
+				}
+			}
+		}
+		PublishSoilSensorSamplerSnapshot();
+
+		// Wake the sensors ahead of the deadline so that they are up when it is reached.
+		AdvanceSamplerDeadline(&deadline);
+		struct timespec wakeTime = deadline;
+		AddMs(&wakeTime, -SOILMOISTURESENSOR_WAKE_MS);
+		SleepUntil(&wakeTime);
+		if (!atomic_load(&samplerStopRequested) && !atomic_load(&samplerPaused)) {
+			WakeSoilSensors();
+		}
+		SleepUntil(&deadline);
+	}
+	return NULL;
+}
+
+int StartSoilSensorSampler(const I2C_DeviceAddress* sensorAddresses, int sensorCount,
+	const struct timespec* period, SoilSensorSampleRing* ring, SoilSensorPowerState* powerStates,
+	SoilSensorHealth* health) {
+	if (sensorCount > SOILSENSOR_SAMPLER_MAX_SENSORS) {
+		Log_Debug("ERROR: Soil sensor sampler supports at most %d sensors\n", SOILSENSOR_SAMPLER_MAX_SENSORS);
+		return -1;
+	}
+
+	memcpy(samplerAddresses, sensorAddresses, sizeof(sensorAddresses[0]) * (size_t)sensorCount);
+	samplerSensorCount = sensorCount;
+	samplerPeriod = *period;
+	samplerRing = ring;
+	samplerPowerStates = powerStates;
+	samplerHealth = health;
+	lightPendingMask = 0;
+	atomic_store(&samplerStopRequested, false);
+	PublishSoilSensorSamplerSnapshot();
+
+	samplerEventFd = eventfd(0, EFD_NONBLOCK);
+	if (samplerEventFd < 0) {
+		Log_Debug("ERROR: Could not create soil sensor sampler eventfd: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	int result = pthread_create(&samplerThread, NULL, SoilSensorSamplerThread, NULL);
+	if (result != 0) {
+		Log_Debug("ERROR: Could not start soil sensor sampler thread: errno=%d (%s)\n", result, strerror(result));
+		close(samplerEventFd);
+		samplerEventFd = -1;
+		return -1;
+	}
+	samplerThreadStarted = true;
+
+	return samplerEventFd;
+}
+
+void PauseSoilSensorSampler(bool paused) {
+	atomic_store(&samplerPaused, paused);
+}
+
+void SetSoilSensorSamplerSleep(bool enabled) {
+	atomic_store(&samplerSleepEnabled, enabled);
+}
+
+void RequestSoilSensorSamplerLight(void) {
+	atomic_store(&samplerLightRequested, true);
+}
+
+void StopSoilSensorSampler(void) {
+	if (samplerThreadStarted) {
+		atomic_store(&samplerStopRequested, true);
+		pthread_join(samplerThread, NULL);
+		samplerThreadStarted = false;
+	}
+	if (samplerEventFd >= 0) {
+		close(samplerEventFd);
+		samplerEventFd = -1;
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "SoilMoistureI2cSensor.h"
+#include "SoilSensorPower.h"
+#include "SoilSensorHealth.h"
+
+/// <summary>Maximum number of sensors the sampler reads each period.</summary>
+#define SOILSENSOR_SAMPLER_MAX_SENSORS 32
+/// <summary>
+///     Capacity of the sample ring. Must be a power of two. A pass pushes one sample per sensor
+///     plus one per light reading before it signals the event loop, so the ring holds two full
+///     passes.
+/// </summary>
+#define SOILSENSOR_SAMPLE_RING_SIZE (2 * SOILSENSOR_SAMPLER_MAX_SENSORS)
+
+/// <summary>
+///     Lock-free single-producer/single-consumer ring of samples. The sampler thread is the only
+///     producer and the event loop the only consumer.
+/// </summary>
+typedef struct SoilSensorSampleRing {
+	/// <summary>Next slot to consume; written by the consumer only.</summary>
+	_Atomic unsigned int head;
+	/// <summary>Next slot to fill; written by the producer only.</summary>
+	_Atomic unsigned int tail;
+	/// <summary>Samples discarded because the ring was full.</summary>
+	_Atomic uint32_t droppedCount;
+	SoilSensorSample samples[SOILSENSOR_SAMPLE_RING_SIZE];
+} SoilSensorSampleRing;
+
+/// <summary>
+///     Adds a sample to the ring, from the producer only.
+/// </summary>
+/// <returns>true on success, false if the ring was full and the sample was dropped</returns>
+bool PushSoilSensorSample(SoilSensorSampleRing* ring, const SoilSensorSample* sample);
+
+/// <summary>
+///     Takes the oldest sample from the ring, from the consumer only.
+/// </summary>
+/// <returns>true if a sample was copied to sample, false if the ring was empty</returns>
+bool PopSoilSensorSample(SoilSensorSampleRing* ring, SoilSensorSample* sample);
+
+/// <summary>
+/// <para>Starts a worker thread which takes ownership of i2cFd and reads every sensor each
+/// period. Samples are published to the ring and signalled through the returned eventfd, which
+/// the caller registers with epoll. No other thread may access i2cFd until the sampler is
+/// stopped.</para>
+/// <para>powerStates and health hold one entry per sensor and are updated by the thread until
+/// it is stopped; the thread resets failing sensors and skips quarantined ones itself. Meanwhile
+/// read them through GetSoilSensorSamplerSnapshot.</para>
+/// </summary>
+/// <returns>The eventfd, or -1 on failure</returns>
+int StartSoilSensorSampler(const I2C_DeviceAddress* sensorAddresses, int sensorCount,
+	const struct timespec* period, SoilSensorSampleRing* ring, SoilSensorPowerState* powerStates,
+	SoilSensorHealth* health);
+
+/// <summary>
+///     While enabled, every sensor is put to sleep after it was read and woken
+///     SOILMOISTURESENSOR_WAKE_MS ahead of the next period, then measured afresh.
+/// </summary>
+void SetSoilSensorSamplerSleep(bool enabled);
+
+/// <summary>
+///     Suspends reads while paused is true, e.g. while the pump is running and the bus is noisy.
+/// </summary>
+void PauseSoilSensorSampler(bool paused);
+
+/// <summary>
+///     Asks for a light measurement of all sensors, triggered together at the start of the next
+///     period. Each reading is published in a sample of its own once its sensor finished, while
+///     the other sensors keep being sampled.
+/// </summary>
+void RequestSoilSensorSamplerLight(void);
+
+/// <summary>
+///     Stops and joins the worker thread and closes its eventfd.
+/// </summary>
+void StopSoilSensorSampler(void);
+
+/// <summary>
+///     Sensor power, health and I2C stats as of the latest pass, published by the worker thread
+///     so that they can be read while it owns the bus.
+/// </summary>
+typedef struct SoilSensorSamplerSnapshot {
+	int sensorCount;
+	SoilSensorPowerState powerStates[SOILSENSOR_SAMPLER_MAX_SENSORS];
+	SoilSensorHealth health[SOILSENSOR_SAMPLER_MAX_SENSORS];
+	/// <summary>Zero for an address with no transfer yet.</summary>
+	I2CAddressStats addressStats[SOILSENSOR_SAMPLER_MAX_SENSORS];
+	I2CBusSpeedStats busSpeedStats;
+	I2CMuxStats muxStats;
+} SoilSensorSamplerSnapshot;
+
+/// <summary>
+///     Copies the latest snapshot published by the worker thread.
+/// </summary>
+void GetSoilSensorSamplerSnapshot(SoilSensorSamplerSnapshot* snapshot);
@@ -1,40 +1,347 @@
 #include "i2cAccess.h"
+#include <time.h>
 
-void WriteI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddressAndValue) {
-	uint8_t buff[1];
-	buff[0] = registerAddressAndValue[0];
+// Transfer counters, looked up by the full (possibly muxed) device address.
+static I2CAddressStats addressStats[I2C_STATS_MAX_DEVICES];
+static I2C_DeviceAddress statsAddresses[I2C_STATS_MAX_DEVICES];
+static int statsDeviceCount = 0;
 
-	ssize_t transferredBytes =
-		I2CMaster_Write(i2cFd, sensorAddress, buff, sizeof(buff));
-	if (transferredBytes == -1)
-		Log_Debug("ERROR: I2CMaster_Writer: errno=%d (%s)\n", errno, strerror(errno));
+// Mux and channel mask currently selected, muxAddress 0 if none or unknown.
+static I2C_DeviceAddress selectedMuxAddress = 0;
+static uint8_t selectedChannelMask = 0;
+static I2CMuxStats muxStats;
+
+// Supported speeds, slowest first.
+static const I2C_BusSpeed busSpeeds[] = { I2C_BUS_SPEED_STANDARD, I2C_BUS_SPEED_FAST };
+static const int busSpeedCount = sizeof(busSpeeds) / sizeof(busSpeeds[0]);
+static int busSpeedLevel = 0;
+static I2CBusSpeedStats busSpeedStats;
+static time_t nextProbeTime;
+static bool probing = false;
+
+// Attempts and NACKs or timeouts of each device since the last evaluation, by stats slot.
+static uint16_t windowAttempts[I2C_STATS_MAX_DEVICES];
+static uint16_t windowErrors[I2C_STATS_MAX_DEVICES];
+
+static int FindStatsSlot(I2C_DeviceAddress sensorAddress) {
+	for (int i = 0; i < statsDeviceCount; i++) {
+		if (statsAddresses[i] == sensorAddress) {
+			return i;
+		}
+	}
+	if (statsDeviceCount < I2C_STATS_MAX_DEVICES) {
+		statsAddresses[statsDeviceCount] = sensorAddress;
+		return statsDeviceCount++;
+	}
+	return I2C_STATS_MAX_DEVICES - 1;
+}
+
+static int SetBusSpeedLevel(int level, time_t now) {
+	if (I2CMaster_SetBusSpeed(i2cFd, busSpeeds[level]) != 0) {
+		Log_Debug("ERROR: I2CMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	busSpeedLevel = level;
+	busSpeedStats.speed = busSpeeds[level];
+	nextProbeTime = now + busSpeedStats.probeIntervalS;
+	memset(windowAttempts, 0, sizeof(windowAttempts));
+	memset(windowErrors, 0, sizeof(windowErrors));
+	Log_Debug("INFO: I2C bus speed %u Hz\n", busSpeeds[level]);
+	return 0;
+}
+
+// Steps the bus speed down when an address has too many errors, and probes upward once the
+// probe interval passed without errors.
+static void AdaptBusSpeed(int index, bool failed, time_t now) {
+	windowAttempts[index]++;
+	if (failed) {
+		windowErrors[index]++;
+	}
+
+	if (windowAttempts[index] >= I2C_SPEED_WINDOW_ATTEMPTS) {
+		bool tooManyErrors = windowErrors[index] * 1000 > I2C_SPEED_MAX_ERRORS_PER_MILLE * windowAttempts[index];
+		windowAttempts[index] = 0;
+		windowErrors[index] = 0;
+		if (tooManyErrors && busSpeedLevel > 0) {
+			if (probing && busSpeedStats.probeIntervalS < I2C_SPEED_MAX_PROBE_INTERVAL_S) {
+				busSpeedStats.probeIntervalS *= 2;
+			}
+			probing = false;
+			busSpeedStats.stepDowns++;
+			SetBusSpeedLevel(busSpeedLevel - 1, now);
+			return;
+		}
+		if (!tooManyErrors) {
+			probing = false;
+		}
+	}
+
+	if (busSpeedLevel < busSpeedCount - 1 && now >= nextProbeTime) {
+		if (SetBusSpeedLevel(busSpeedLevel + 1, now) == 0) {
+			probing = true;
+			busSpeedStats.stepUps++;
+			return;
+		}
+		// The speed could not be set: back off as after a failed probe.
+		if (busSpeedStats.probeIntervalS < I2C_SPEED_MAX_PROBE_INTERVAL_S) {
+			busSpeedStats.probeIntervalS *= 2;
+		}
+		nextProbeTime = now + busSpeedStats.probeIntervalS;
+	}
+}
+
+int OpenI2CBus(I2C_InterfaceId interfaceId, uint32_t timeoutMs) {
+	i2cFd = I2CMaster_Open(interfaceId);
+	if (i2cFd < 0) {
+		Log_Debug("ERROR: I2CMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	if (I2CMaster_SetTimeout(i2cFd, timeoutMs) != 0) {
+		Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	busSpeedStats.probeIntervalS = I2C_SPEED_PROBE_INTERVAL_S;
+	if (SetBusSpeedLevel(busSpeedCount - 1, now.tv_sec) != 0 && SetBusSpeedLevel(0, now.tv_sec) != 0) {
+		return -1;
+	}
+	return i2cFd;
+}
+
+const I2CBusSpeedStats* GetI2CBusSpeedStats(void) {
+	return &busSpeedStats;
+}
+
+const char* I2CStatusToString(I2CStatus status) {
+	switch (status) {
+	case I2CStatus_Ok:
+		return "Ok";
+	case I2CStatus_Nack:
+		return "NACK";
+	case I2CStatus_Timeout:
+		return "Timeout";
+	case I2CStatus_ShortTransfer:
+		return "Short transfer";
+	default:
+		return "Error";
+	}
+}
+
+const I2CAddressStats* GetI2CAddressStats(I2C_DeviceAddress sensorAddress) {
+	// Only looks up the slot: transfers add slots, possibly on the sampling thread.
+	for (int i = 0; i < statsDeviceCount; i++) {
+		if (statsAddresses[i] == sensorAddress) {
+			return &addressStats[i];
+		}
+	}
+	return NULL;
+}
+
+const I2CMuxStats* GetI2CMuxStats(void) {
+	return &muxStats;
+}
+
+static I2CStatus StatusFromTransfer(ssize_t transferredBytes, size_t expectedBytes) {
+	if (transferredBytes == (ssize_t)expectedBytes) {
+		return I2CStatus_Ok;
+	}
+	if (transferredBytes >= 0) {
+		return I2CStatus_ShortTransfer;
+	}
+	switch (errno) {
+	case ENXIO:
+	case EIO:
+	case EREMOTEIO:
+		return I2CStatus_Nack;
+	case ETIMEDOUT:
+		return I2CStatus_Timeout;
+	default:
+		return I2CStatus_Error;
+	}
+}
+
+// Routes the bus to the mux channel of a device. Returns the status of the failed mux write, if any.
+static I2CStatus SelectMuxChannel(I2C_DeviceAddress sensorAddress) {
+	I2C_DeviceAddress muxAddress = I2C_MUX_ADDRESS(sensorAddress);
+	uint8_t channelMask = muxAddress == 0 ? 0 : (uint8_t)(1u << I2C_MUX_CHANNEL(sensorAddress));
 
-	buff[0] = registerAddressAndValue[1];
-	transferredBytes =
-		I2CMaster_Write(i2cFd, sensorAddress, buff, sizeof(buff));
-	if (transferredBytes == -1)
-		Log_Debug("ERROR: I2CMaster_Writer: errno=%d (%s)\n", errno, strerror(errno));
+	if (muxAddress == selectedMuxAddress && channelMask == selectedChannelMask) {
+		if (muxAddress != 0) {
+			muxStats.switchesSkipped++;
+		}
+		return I2CStatus_Ok;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	// Disconnect the previous mux so that devices behind different muxes cannot clash. If that
+	// fails, the mux stays selected so that the next transfer retries the disconnect.
+	if (selectedMuxAddress != 0 && selectedMuxAddress != muxAddress) {
+		const uint8_t noChannels = 0;
+		muxStats.channelSwitches++;
+		ssize_t written = I2CMaster_Write(i2cFd, selectedMuxAddress, &noChannels, 1);
+		if (written != 1) {
+			I2CStatus status = StatusFromTransfer(written, 1);
+			Log_Debug("ERROR: I2C mux %X disconnect failed: %s\n", selectedMuxAddress, I2CStatusToString(status));
+			return status;
+		}
+	}
+	selectedMuxAddress = 0;
+	if (muxAddress != 0) {
+		muxStats.channelSwitches++;
+		ssize_t written = I2CMaster_Write(i2cFd, muxAddress, &channelMask, 1);
+		if (written != 1) {
+			I2CStatus status = StatusFromTransfer(written, 1);
+			Log_Debug("ERROR: I2C mux %X channel %u select failed: %s\n",
+				muxAddress, I2C_MUX_CHANNEL(sensorAddress), I2CStatusToString(status));
+			return status;
+		}
+		selectedMuxAddress = muxAddress;
+		selectedChannelMask = channelMask;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	muxStats.switchTimeUs += (uint64_t)((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000);
+	return I2CStatus_Ok;
+}
+
+int FindI2CMuxes(I2C_DeviceAddress* muxAddresses, int maxMuxes) {
+	int muxCount = 0;
+	for (I2C_DeviceAddress address = I2C_MUX_FIRST_ADDRESS; address <= I2C_MUX_LAST_ADDRESS && muxCount < maxMuxes; address++) {
+		uint8_t controlRegister;
+		if (I2CMaster_Read(i2cFd, address, &controlRegister, 1) == 1) {
+			muxAddresses[muxCount++] = address;
+			Log_Debug("I2C mux found (Address: %X)\n", address);
+		}
+	}
+	// Channels may have been left enabled by a previous run.
+	for (int i = 0; i < muxCount; i++) {
+		const uint8_t noChannels = 0;
+		I2CMaster_Write(i2cFd, muxAddresses[i], &noChannels, 1);
+	}
+	selectedMuxAddress = 0;
+	return muxCount;
 }
 
-uint8_t ReadI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress) {
-	uint8_t returnValue;
-	//ssize_t transferredBytes = 
-		I2CMaster_WriteThenRead(i2cFd, sensorAddress, registerAddress, 1, &returnValue, 1);
-	return returnValue;
+static void CountFailedAttempt(I2CAddressStats* stats, I2CStatus status) {
+	switch (status) {
+	case I2CStatus_Nack:
+		stats->nackCount++;
+		break;
+	case I2CStatus_Timeout:
+		stats->timeoutCount++;
+		break;
+	case I2CStatus_ShortTransfer:
+		stats->shortTransferCount++;
+		break;
+	default:
+		stats->errorCount++;
+		break;
+	}
 }
 
-uint16_t ReadI2CRegister16bitUnsigned(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress)
+// Runs one write, or write-then-read if readData is set, with retries. Updates the counters of
+// the address.
+static I2CStatus Transfer(I2C_DeviceAddress sensorAddress, const uint8_t* writeData, size_t writeLength,
+	uint8_t* readData, size_t readLength, int attempts) {
+	I2C_DeviceAddress deviceAddress = I2C_DEVICE_ADDRESS(sensorAddress);
+	int slot = FindStatsSlot(sensorAddress);
+	I2CAddressStats* stats = &addressStats[slot];
+	struct timespec backoff = { 0, I2C_RETRY_BACKOFF_MS * 1000 * 1000 };
+	I2CStatus status = I2CStatus_Error;
+
+	stats->transfers++;
+	for (int attempt = 0; attempt < attempts; attempt++) {
+		if (attempt > 0) {
+			stats->retries++;
+			nanosleep(&backoff, NULL);
+			backoff.tv_nsec *= 2;
+		}
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		status = SelectMuxChannel(sensorAddress);
+		if (status == I2CStatus_Ok) {
+			ssize_t transferredBytes = readData == NULL
+				? I2CMaster_Write(i2cFd, deviceAddress, writeData, writeLength)
+				: I2CMaster_WriteThenRead(i2cFd, deviceAddress, writeData, writeLength, readData, readLength);
+			status = StatusFromTransfer(transferredBytes, writeLength + readLength);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		AdaptBusSpeed(slot, status == I2CStatus_Nack || status == I2CStatus_Timeout, end.tv_sec);
+		if (status == I2CStatus_Ok) {
+			uint32_t latencyUs = (uint32_t)((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000);
+			stats->totalLatencyUs += latencyUs;
+			if (latencyUs > stats->maxLatencyUs) {
+				stats->maxLatencyUs = latencyUs;
+			}
+			return I2CStatus_Ok;
+		}
+
+		CountFailedAttempt(stats, status);
+		if (status == I2CStatus_Timeout || status == I2CStatus_Error) {
+			break;
+		}
+	}
+
+	stats->failures++;
+	Log_Debug("ERROR: I2C transfer to %X failed: %s (errno=%d)\n", sensorAddress, I2CStatusToString(status), errno);
+	return status;
+}
+
+I2CStatus WriteI2CRegister(I2C_DeviceAddress sensorAddress, uint8_t registerAddress, const uint8_t* data, size_t length) {
+	uint8_t buff[1 + I2C_MAX_PAYLOAD];
+	if (length > I2C_MAX_PAYLOAD) {
+		return I2CStatus_Error;
+	}
+	buff[0] = registerAddress;
+	memcpy(buff + 1, data, length);
+	return Transfer(sensorAddress, buff, 1 + length, NULL, 0, I2C_TRANSFER_ATTEMPTS);
+}
+
+I2CStatus ReadI2CRegister(I2C_DeviceAddress sensorAddress, uint8_t registerAddress, uint8_t* data, size_t length) {
+	return Transfer(sensorAddress, &registerAddress, 1, data, length, I2C_TRANSFER_ATTEMPTS);
+}
+
+I2CStatus WriteI2CRegisterAddress(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress) {
+	return WriteI2CRegister(sensorAddress, registerAddress[0], NULL, 0);
+}
+
+I2CStatus WriteI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddressAndValue) {
+	return WriteI2CRegister(sensorAddress, registerAddressAndValue[0], &registerAddressAndValue[1], 1);
+}
+
+bool TryReadI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress, uint8_t* value) {
+	if (SelectMuxChannel(sensorAddress) != I2CStatus_Ok) {
+		return false;
+	}
+	ssize_t transferredBytes =
+		I2CMaster_WriteThenRead(i2cFd, I2C_DEVICE_ADDRESS(sensorAddress), registerAddress, 1, value, 1);
+	return transferredBytes == 2;
+}
+
+I2CStatus ReadI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress, uint8_t* value) {
+	return ReadI2CRegister(sensorAddress, registerAddress[0], value, 1);
+}
+
+I2CStatus ReadI2CRegister16bitUnsigned(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress, uint16_t* value)
 {
 	uint8_t valueFromRead[2];
-	uint16_t returnValue;
-
-	//ssize_t transferredBytes = 
-		I2CMaster_WriteThenRead(i2cFd, sensorAddress, registerAddress, 1, valueFromRead, 2);
-	returnValue = (uint16_t)(valueFromRead[0] << 8 | valueFromRead[1]);
-	return returnValue;
+	I2CStatus status = ReadI2CRegister(sensorAddress, registerAddress[0], valueFromRead, 2);
+	if (status == I2CStatus_Ok) {
+		*value = (uint16_t)(valueFromRead[0] << 8 | valueFromRead[1]);
+	}
+	return status;
 }
 
-uint16_t ReadI2CRegister16bitSigned(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress)
+I2CStatus ReadI2CRegister16bitSigned(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress, int16_t* value)
 {
-	return (uint16_t)ReadI2CRegister16bitUnsigned(sensorAddress, registerAddress);
-}
\ No newline at end of file
+	uint16_t unsignedValue;
+	I2CStatus status = ReadI2CRegister16bitUnsigned(sensorAddress, registerAddress, &unsignedValue);
+	if (status == I2CStatus_Ok) {
+		*value = (int16_t)unsignedValue;
+	}
+	return status;
+}
@@ -2,15 +2,111 @@
 #include <applibs/i2c.h>
 #include <applibs/log.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 extern int i2cFd;
 
-void WriteI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddressAndValue);
+// Devices behind a TCA9548A-style mux are addressed with I2C_MUXED_ADDRESS. The access layer
+// selects the mux channel before each transfer, skipping the switch if the channel is already
+// selected. Muxes must use addresses I2C_MUX_FIRST_ADDRESS to I2C_MUX_LAST_ADDRESS.
+#define I2C_MUX_FIRST_ADDRESS 0x70
+#define I2C_MUX_LAST_ADDRESS 0x77
+#define I2C_MUX_CHANNELS 8
+#define I2C_MUXED_ADDRESS(muxAddress, channel, deviceAddress) \
+	(((uint32_t)(muxAddress) << 8) | ((uint32_t)(channel) << 16) | (uint32_t)(deviceAddress))
+#define I2C_DEVICE_ADDRESS(address) ((address) & 0x7F)
+#define I2C_MUX_ADDRESS(address) (((address) >> 8) & 0x7F)
+#define I2C_MUX_CHANNEL(address) (((address) >> 16) & 0x7)
+// Devices whose transfer counters are kept; further devices share the last entry.
+#define I2C_STATS_MAX_DEVICES 40
 
-uint8_t ReadI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress);
+// Attempts per transfer. NACKs and short transfers are retried after a backoff starting at
+// I2C_RETRY_BACKOFF_MS and doubling; timeouts are not retried since they already took the
+// full bus timeout.
+#define I2C_TRANSFER_ATTEMPTS 3
+#define I2C_RETRY_BACKOFF_MS 1
+// Longest register payload in bytes.
+#define I2C_MAX_PAYLOAD 4
 
-uint16_t ReadI2CRegister16bitUnsigned(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress);
+// The bus starts in fast mode. Once an address has seen I2C_SPEED_WINDOW_ATTEMPTS attempts,
+// more than I2C_SPEED_MAX_ERRORS_PER_MILLE of them NACKed or timed out steps the bus down to
+// standard mode. After I2C_SPEED_PROBE_INTERVAL_S the faster speed is probed again; each probe
+// that fails doubles the interval, up to I2C_SPEED_MAX_PROBE_INTERVAL_S.
+#define I2C_SPEED_WINDOW_ATTEMPTS 32
+#define I2C_SPEED_MAX_ERRORS_PER_MILLE 50
+#define I2C_SPEED_PROBE_INTERVAL_S (10 * 60)
+#define I2C_SPEED_MAX_PROBE_INTERVAL_S (24 * 60 * 60)
 
-uint16_t ReadI2CRegister16bitSigned(I2C_DeviceAddress addr, const uint8_t* registerAddress);
+typedef enum I2CStatus {
+	I2CStatus_Ok = 0,
+	I2CStatus_Nack, // Device did not acknowledge.
+	I2CStatus_Timeout, // Bus timed out.
+	I2CStatus_ShortTransfer, // Fewer bytes transferred than requested.
+	I2CStatus_Error // Any other failure, see errno.
+} I2CStatus;
+
+// Transfer counters of one device address. Only the thread owning the bus updates them;
+// other threads may read them for reporting.
+typedef struct I2CAddressStats {
+	uint32_t transfers; // Transfers requested, retries excluded.
+	uint32_t failures; // Transfers which failed after all attempts.
+	uint32_t retries;
+	uint32_t nackCount;
+	uint32_t timeoutCount;
+	uint32_t shortTransferCount;
+	uint32_t errorCount;
+	uint32_t maxLatencyUs; // Longest successful attempt.
+	uint64_t totalLatencyUs; // Sum over successful attempts.
+} I2CAddressStats;
+
+typedef struct I2CBusSpeedStats {
+	I2C_BusSpeed speed;
+	uint32_t stepDowns;
+	uint32_t stepUps;
+	uint32_t probeIntervalS; // Wait before the next probe of a faster speed.
+} I2CBusSpeedStats;
+
+// Opens the bus into i2cFd in fast mode with the given timeout. Returns i2cFd, or -1 on failure.
+int OpenI2CBus(I2C_InterfaceId interfaceId, uint32_t timeoutMs);
+
+const I2CBusSpeedStats* GetI2CBusSpeedStats(void);
+
+typedef struct I2CMuxStats {
+	uint32_t channelSwitches; // Writes to a mux control register.
+	uint32_t switchesSkipped; // Transfers which found their channel already selected.
+	uint64_t switchTimeUs; // Time spent switching channels.
+} I2CMuxStats;
+
+const I2CMuxStats* GetI2CMuxStats(void);
+
+// Probes I2C_MUX_FIRST_ADDRESS to I2C_MUX_LAST_ADDRESS with a one byte read, which a mux
+// answers with its control register. Returns the number of muxes written to muxAddresses.
+int FindI2CMuxes(I2C_DeviceAddress* muxAddresses, int maxMuxes);
+
+const char* I2CStatusToString(I2CStatus status);
+
+// Returns the counters of an address, or NULL if no transfer to it was made yet.
+const I2CAddressStats* GetI2CAddressStats(I2C_DeviceAddress sensorAddress);
+
+// Writes the register address followed by length payload bytes as one transfer.
+I2CStatus WriteI2CRegister(I2C_DeviceAddress sensorAddress, uint8_t registerAddress, const uint8_t* data, size_t length);
+
+// Writes the register address, then reads length bytes in the same transaction.
+I2CStatus ReadI2CRegister(I2C_DeviceAddress sensorAddress, uint8_t registerAddress, uint8_t* data, size_t length);
+
+I2CStatus WriteI2CRegisterAddress(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress);
+
+I2CStatus WriteI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddressAndValue);
+
+// Single attempt without retries or logging, for probing devices which may not be there yet.
+// Not counted in the address stats. Selects the mux channel like other transfers.
+bool TryReadI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress, uint8_t* value);
+
+I2CStatus ReadI2CRegister8bit(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress, uint8_t* value);
+
+I2CStatus ReadI2CRegister16bitUnsigned(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress, uint16_t* value);
+
+I2CStatus ReadI2CRegister16bitSigned(I2C_DeviceAddress sensorAddress, const uint8_t* registerAddress, int16_t* value);
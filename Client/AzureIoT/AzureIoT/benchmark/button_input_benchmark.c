@@ -0,0 +1,207 @@
+// Counts the event loop wakeups spent on two buttons: the former 1 ms timerfd poll, the idle scan
+// used on the device, and edge driven input from non-blocking pipes, both idle and while one button
+// is pressed five times. Not part of the device build; run it with make -C host benchmark. Exits
+// with 1 if a press was missed or reported twice.
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "button_input.h"
+
+#define BUTTON_COUNT 2
+#define PRESSES 5
+
+volatile sig_atomic_t terminationRequired = false;
+
+// Each run lasts this long; the presses are spread over the first second.
+static const long RunMs = 1200;
+// How long a press is held, and the time between presses.
+static const long PressMs = 100;
+static const long ReleaseMs = 100;
+
+// Simulated button levels, indexed by gpioFd.
+static _Atomic GPIO_Value_Type levels[BUTTON_COUNT];
+// Write ends of the edge pipes, or -1 in scan mode.
+static int edgeWriteFds[BUTTON_COUNT];
+
+static unsigned int pollSamples;
+static unsigned int pollPresses;
+static GPIO_Value_Type pollStates[BUTTON_COUNT];
+static bool runFinished;
+
+int GPIO_GetValue(int gpioFd, GPIO_Value_Type *outValue)
+{
+    *outValue = atomic_load(&levels[gpioFd]);
+    return 0;
+}
+
+static void ButtonPressed(void) {}
+
+static void SleepMs(long ms)
+{
+    struct timespec delay = {ms / 1000, (ms % 1000) * 1000 * 1000};
+    nanosleep(&delay, NULL);
+}
+
+static void SetLevel(int button, GPIO_Value_Type level)
+{
+    atomic_store(&levels[button], level);
+    if (edgeWriteFds[button] >= 0) {
+        const char edge = 1;
+        if (write(edgeWriteFds[button], &edge, sizeof(edge)) != sizeof(edge)) {
+            perror("write");
+        }
+    }
+}
+
+// Presses the first button PRESSES times, from a thread standing in for the user.
+static void *PressButton(void *arg)
+{
+    for (int i = 0; i < PRESSES; i++) {
+        SetLevel(0, GPIO_Value_Low);
+        SleepMs(PressMs);
+        SetLevel(0, GPIO_Value_High);
+        SleepMs(ReleaseMs);
+    }
+    return NULL;
+}
+
+static void RunFinishedEventHandler(EventData *eventData)
+{
+    runFinished = true;
+}
+
+// The former button handling: both buttons read on every expiry of a 1 ms timerfd.
+static void PollTimerEventHandler(EventData *eventData)
+{
+    ConsumeTimerFdEventWithStats(eventData);
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        GPIO_Value_Type level;
+        GPIO_GetValue(i, &level);
+        pollSamples++;
+        if (level != pollStates[i] && level == GPIO_Value_Low) {
+            pollPresses++;
+        }
+        pollStates[i] = level;
+    }
+}
+
+// Runs the event loop for RunMs, optionally pressing a button meanwhile, and prints the number
+// of wakeups per second. Returns the presses detected, or -1 on failure.
+static int Run(const char *name, bool poll, bool edge, bool press)
+{
+    static EventData pollEventData = {.eventHandler = &PollTimerEventHandler};
+    static EventData runFinishedEventData = {.eventHandler = &RunFinishedEventHandler};
+    static TimerWheel wheel;
+    ButtonInput buttons[BUTTON_COUNT] = {0};
+    int edgeReadFds[BUTTON_COUNT];
+    int pollTimerFd = -1;
+    int result = -1;
+
+    int epollFd = CreateEpollFd();
+    int wheelFd = CreateTimerWheelAndAddToEpoll(epollFd, &wheel, EPOLLIN);
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        levels[i] = pollStates[i] = GPIO_Value_High;
+        edgeReadFds[i] = edgeWriteFds[i] = -1;
+        if (edge) {
+            int fds[2];
+            if (pipe2(fds, O_NONBLOCK) != 0) {
+                return -1;
+            }
+            edgeReadFds[i] = fds[0];
+            edgeWriteFds[i] = fds[1];
+        }
+    }
+
+    if (poll) {
+        struct timespec period = {0, 1000 * 1000};
+        pollTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &period, &pollEventData, EPOLLIN);
+    } else {
+        for (int i = 0; i < BUTTON_COUNT; i++) {
+            buttons[i].pressedHandler = &ButtonPressed;
+            buttons[i].gpioFd = i;
+            buttons[i].edgeFd = edgeReadFds[i];
+            if (StartButtonInput(epollFd, &wheel, &buttons[i]) != 0) {
+                goto cleanup;
+            }
+        }
+    }
+
+    struct timespec runTime = {RunMs / 1000, (RunMs % 1000) * 1000 * 1000};
+    int runTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &runTime, &runFinishedEventData, EPOLLIN);
+    SetTimerFdToSingleExpiry(runTimerFd, &runTime);
+
+    pthread_t pressThread;
+    if (press && pthread_create(&pressThread, NULL, &PressButton, NULL) != 0) {
+        goto cleanup;
+    }
+
+    pollSamples = 0;
+    pollPresses = 0;
+    runFinished = false;
+    unsigned int wakeups = 0;
+    while (!runFinished && !terminationRequired) {
+        if (WaitForEventsAndCallHandlers(epollFd, NULL) != 0) {
+            break;
+        }
+        wakeups++;
+    }
+    if (press) {
+        pthread_join(pressThread, NULL);
+    }
+
+    // The wakeup ending the run is not spent on the buttons.
+    wakeups--;
+    unsigned int samples = pollSamples;
+    unsigned int presses = pollPresses;
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        samples += buttons[i].sampleCount;
+        presses += buttons[i].pressCount;
+    }
+    printf("%-20s %6.0f wakeups/s, %6.0f samples/s per button, %u presses\n", name,
+           wakeups * 1000.0 / RunMs, samples * 1000.0 / RunMs / BUTTON_COUNT, presses);
+    result = (int)presses;
+
+    close(runTimerFd);
+cleanup:
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        StopButtonInput(epollFd, &buttons[i]);
+        if (edge) {
+            close(edgeReadFds[i]);
+            close(edgeWriteFds[i]);
+        }
+    }
+    if (pollTimerFd >= 0) {
+        close(pollTimerFd);
+    }
+    close(wheelFd);
+    close(epollFd);
+    return result;
+}
+
+int main(void)
+{
+    int failures = 0;
+    failures += Run("1 ms poll, idle", true, false, false) != 0;
+    failures += Run("1 ms poll, pressed", true, false, true) != PRESSES;
+    failures += Run("Scan, idle", false, false, false) != 0;
+    failures += Run("Scan, pressed", false, false, true) != PRESSES;
+    failures += Run("Edge, idle", false, true, false) != 0;
+    failures += Run("Edge, pressed", false, true, true) != PRESSES;
+
+    // A blocking edge source is rejected rather than stalling the event loop.
+    int fds[2];
+    ButtonInput blocking = {.pressedHandler = &ButtonPressed, .gpioFd = 0};
+    static TimerWheel wheel;
+    int epollFd = CreateEpollFd();
+    CreateTimerWheelAndAddToEpoll(epollFd, &wheel, EPOLLIN);
+    if (pipe(fds) == 0) {
+        blocking.edgeFd = fds[0];
+        failures += StartButtonInput(epollFd, &wheel, &blocking) == 0;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+// Compares the telemetry encoders on Linux: bytes on the wire and encode time per batch, for a
+// tick of the batches main.c sends. Not part of the device build; run it with
+// make -C host benchmark.
+#include <stdio.h>
+#include <time.h>
+#include "telemetry_batch.h"
+
+static const int Iterations = 200000;
+
+static size_t lastLength;
+static uint8_t lastMessage[TELEMETRY_BATCH_BUFFER_SIZE];
+
+static void KeepMessage(const uint8_t *data, size_t length, const TelemetryEncoder *encoder, void *context)
+{
+    lastLength = length;
+    for (size_t i = 0; i < length; i++) {
+        lastMessage[i] = data[i];
+    }
+}
+
+// One tick as sent by the Azure timer: temperature and capacitance of each sensor, then the
+// relay states. Sensor names follow FormatSoilSensorName.
+static void EncodeTick(TelemetryBatch *batch, int sensorCount, int tick)
+{
+    static const char *const temperatureNames[] = {"Temperature", "Temperature1", "Temperature2", "Temperature3",
+                                                   "Temperature4", "Temperature5", "Temperature6", "Temperature7"};
+    static const char *const capacitanceNames[] = {"Capacitance", "Capacitance1", "Capacitance2", "Capacitance3",
+                                                   "Capacitance4", "Capacitance5", "Capacitance6", "Capacitance7"};
+    for (int i = 0; i < sensorCount; i++) {
+        AddTelemetryBatchFixedPoint(batch, temperatureNames[i], 215 + (tick + i) % 7, 1);
+        AddTelemetryBatchFixedPoint(batch, capacitanceNames[i], 320 + (tick * 3 + i) % 200, 0);
+    }
+    AddTelemetryBatchItem(batch, "Relay1State", tick % 2 ? "On" : "Off");
+    AddTelemetryBatchItem(batch, "Relay2State", "Off");
+    FlushTelemetryBatch(batch, TelemetryBatchFlushReason_Tick);
+}
+
+static double ElapsedNs(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1e9 + (double)(end->tv_nsec - start->tv_nsec);
+}
+
+int main(void)
+{
+    static TelemetryBatch batch;
+    static const int sensorCounts[] = {1, 3, 8};
+
+    printf("%-6s %8s %12s %12s\n", "Format", "Sensors", "Bytes/batch", "ns/batch");
+    for (size_t s = 0; s < sizeof(sensorCounts) / sizeof(sensorCounts[0]); s++) {
+        for (int e = 0; e < TelemetryEncoding_Count; e++) {
+            const TelemetryEncoder *encoder = GetTelemetryEncoder((TelemetryEncoding)e);
+            InitTelemetryBatch(&batch, TELEMETRY_BATCH_BUFFER_SIZE, encoder, KeepMessage, NULL);
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int tick = 0; tick < Iterations; tick++) {
+                EncodeTick(&batch, sensorCounts[s], tick);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            printf("%-6s %8d %12.1f %12.1f\n", encoder->name, sensorCounts[s],
+                   (double)batch.bytesSent / Iterations, ElapsedNs(&start, &end) / Iterations);
+        }
+    }
+
+    // The last message of each format, to check with a decoder.
+    for (int e = 0; e < TelemetryEncoding_Count; e++) {
+        const TelemetryEncoder *encoder = GetTelemetryEncoder((TelemetryEncoding)e);
+        InitTelemetryBatch(&batch, TELEMETRY_BATCH_BUFFER_SIZE, encoder, KeepMessage, NULL);
+        EncodeTick(&batch, 1, 0);
+        printf("\n%s (%s):\n", encoder->name, encoder->contentType);
+        for (size_t i = 0; i < lastLength; i++) {
+            if (encoder->encoding == TelemetryEncoding_Json) {
+                putchar(lastMessage[i]);
+            } else {
+                printf("%02x", lastMessage[i]);
+            }
+        }
+        putchar('\n');
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Measures arming and cancelling soft timers on a TimerWheel, then lets a wheel of timers expire
+// through epoll and checks that none fires before its requested delay elapsed. Not part of the
+// device build; run it with make -C host benchmark. Exits with 1 if a timer fired early.
+#include <stdio.h>
+#include <stdlib.h>
+#include "epoll_timerfd_utilities.h"
+
+#define TIMER_COUNT 10000
+// Periodic timers checked for early expiries, and the expirations awaited from each.
+#define PERIODIC_TIMER_COUNT 100
+#define PERIODIC_EXPIRATIONS 5
+
+static const int Rounds = 100;
+// Single expiry delays are spread up to this, so that timers cascade from the coarser levels.
+static const long MaxDelayMs = 3000;
+
+typedef struct BenchmarkTimer {
+    SoftTimer timer; // Must be the first member.
+    uint64_t armedNs;
+    uint64_t delayNs;
+    uint64_t periodNs;
+    unsigned int expirations;
+} BenchmarkTimer;
+
+static BenchmarkTimer timers[TIMER_COUNT];
+static struct timespec delays[TIMER_COUNT];
+static TimerWheel wheel;
+static unsigned int pendingTimers;
+static unsigned int earlyExpirations;
+static uint64_t maxLateNs;
+
+static uint64_t NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t TimespecToNs(const struct timespec *duration)
+{
+    return (uint64_t)duration->tv_sec * 1000000000 + (uint64_t)duration->tv_nsec;
+}
+
+static void TimerExpired(EventData *eventData)
+{
+    BenchmarkTimer *timer = (BenchmarkTimer *)eventData;
+    uint64_t nowNs = NowNs();
+    timer->expirations++;
+
+    // A periodic timer's n-th expiry is due n periods after it was armed.
+    uint64_t dueNs = timer->armedNs + timer->delayNs + (timer->expirations - 1) * timer->periodNs;
+    if (nowNs < dueNs) {
+        earlyExpirations++;
+        fprintf(stderr, "Timer %td fired %llu us early\n", timer - timers,
+                (unsigned long long)(dueNs - nowNs) / 1000);
+    } else if (nowNs - dueNs > maxLateNs) {
+        maxLateNs = nowNs - dueNs;
+    }
+
+    if (timer->periodNs == 0 || timer->expirations == PERIODIC_EXPIRATIONS) {
+        CancelSoftTimer(&wheel, &timer->timer);
+        pendingTimers--;
+    }
+}
+
+// Arms and cancels every timer, in random order of delay, Rounds times.
+static void BenchmarkArmAndCancel(void)
+{
+    uint64_t armNs = 0, cancelNs = 0;
+    for (int round = 0; round < Rounds; round++) {
+        uint64_t start = NowNs();
+        for (int i = 0; i < TIMER_COUNT; i++) {
+            SetSoftTimerToSingleExpiry(&wheel, &timers[i].timer, &delays[i]);
+        }
+        uint64_t armed = NowNs();
+        for (int i = 0; i < TIMER_COUNT; i++) {
+            CancelSoftTimer(&wheel, &timers[i].timer);
+        }
+        uint64_t end = NowNs();
+        armNs += armed - start;
+        cancelNs += end - armed;
+    }
+
+    printf("Arm:    %6.1f ns per timer, %d timers\n", (double)armNs / Rounds / TIMER_COUNT,
+           TIMER_COUNT);
+    printf("Cancel: %6.1f ns per timer, %d timers\n", (double)cancelNs / Rounds / TIMER_COUNT,
+           TIMER_COUNT);
+}
+
+// Arms every timer and dispatches the wheel until all of them expired.
+static int CheckExpiries(int epollFd)
+{
+    pendingTimers = TIMER_COUNT;
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        BenchmarkTimer *timer = &timers[i];
+        timer->expirations = 0;
+        timer->armedNs = NowNs();
+        if (i < PERIODIC_TIMER_COUNT) {
+            struct timespec period = {0, (long)(1 + i % 50) * TIMER_WHEEL_TICK_MS * 1000 * 1000};
+            timer->delayNs = timer->periodNs = TimespecToNs(&period);
+            SetSoftTimerToPeriod(&wheel, &timer->timer, &period);
+        } else {
+            timer->delayNs = TimespecToNs(&delays[i]);
+            timer->periodNs = 0;
+            SetSoftTimerToSingleExpiry(&wheel, &timer->timer, &delays[i]);
+        }
+    }
+
+    while (pendingTimers > 0) {
+        if (WaitForEventsAndCallHandlers(epollFd, NULL) != 0) {
+            return -1;
+        }
+    }
+
+    printf("Expiry: %d timers, %u early, latest %.1f ms after its deadline\n", TIMER_COUNT,
+           earlyExpirations, (double)maxLateNs / 1000000);
+    return 0;
+}
+
+int main(void)
+{
+    int epollFd = CreateEpollFd();
+    if (epollFd < 0 || CreateTimerWheelAndAddToEpoll(epollFd, &wheel, EPOLLIN) < 0) {
+        return 1;
+    }
+
+    srand(1);
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        timers[i].timer.eventData.eventHandler = &TimerExpired;
+        // Microsecond delays, so that timers are armed at every offset within a tick.
+        long delayUs = 1 + rand() % (MaxDelayMs * 1000);
+        delays[i].tv_sec = delayUs / 1000000;
+        delays[i].tv_nsec = (delayUs % 1000000) * 1000;
+    }
+
+    BenchmarkArmAndCancel();
+    if (CheckExpiries(epollFd) != 0) {
+        return 1;
+    }
+    return earlyExpirations == 0 ? 0 : 1;
+}
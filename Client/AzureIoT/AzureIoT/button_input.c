@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <applibs/log.h>
+#include "button_input.h"
+
+extern volatile sig_atomic_t terminationRequired;
+
+static const struct timespec idleScanPeriod = {0, BUTTON_INPUT_IDLE_SCAN_MS * 1000 * 1000};
+static const struct timespec debounceSamplePeriod = {0,
+                                                     BUTTON_INPUT_DEBOUNCE_SAMPLE_MS * 1000 * 1000};
+
+static int ReadButtonLevel(ButtonInput *button, GPIO_Value_Type *value)
+{
+    button->sampleCount++;
+    if (button->readLevel != NULL) {
+        return button->readLevel(button, value);
+    }
+    return GPIO_GetValue(button->gpioFd, value);
+}
+
+/// <summary>
+///     Returns the button to its idle state: waiting on edgeFd, or scanning slowly.
+/// </summary>
+static void IdleButtonInput(ButtonInput *button)
+{
+    button->debouncing = false;
+    if (button->edgeFd >= 0) {
+        CancelSoftTimer(button->wheel, &button->sampleTimer);
+    } else {
+        SetSoftTimerToPeriod(button->wheel, &button->sampleTimer, &idleScanPeriod);
+    }
+}
+
+/// <summary>
+///     Starts sampling the button at the debounce rate, beginning with the given level.
+/// </summary>
+static void StartDebounce(ButtonInput *button, GPIO_Value_Type level)
+{
+    button->debouncing = true;
+    button->candidateState = level;
+    button->candidateSamples = 1;
+    SetSoftTimerToPeriod(button->wheel, &button->sampleTimer, &debounceSamplePeriod);
+}
+
+/// <summary>
+///     Sample timer event: detect a level change while idle, or advance the debounce.
+/// </summary>
+static void ButtonSampleTimerEventHandler(EventData *eventData)
+{
+    ButtonInput *button =
+        (ButtonInput *)((char *)eventData - offsetof(ButtonInput, sampleTimer.eventData));
+    GPIO_Value_Type level;
+
+    if (ReadButtonLevel(button, &level) != 0) {
+        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
+        terminationRequired = true;
+        return;
+    }
+
+    if (!button->debouncing) {
+        if (level != button->stableState) {
+            StartDebounce(button, level);
+        }
+        return;
+    }
+
+    if (level != button->candidateState) {
+        if (level == button->stableState) {
+            // Bounced back; nothing changed.
+            IdleButtonInput(button);
+        } else {
+            button->candidateState = level;
+            button->candidateSamples = 1;
+        }
+        return;
+    }
+
+    if (++button->candidateSamples < BUTTON_INPUT_DEBOUNCE_SAMPLES) {
+        return;
+    }
+
+    button->stableState = level;
+    IdleButtonInput(button);
+    if (level == GPIO_Value_Low) {
+        button->pressCount++;
+        button->pressedHandler();
+    }
+}
+
+/// <summary>
+///     Edge event: drain the edge source and start debouncing.
+/// </summary>
+static void ButtonEdgeEventHandler(EventData *eventData)
+{
+    ButtonInput *button =
+        (ButtonInput *)((char *)eventData - offsetof(ButtonInput, edgeEventData));
+    uint64_t edgeData;
+
+    // Works for both eventfd (8 byte counter) and pipe (arbitrary bytes) edge sources.
+    while (read(button->edgeFd, &edgeData, sizeof(edgeData)) > 0) {
+    }
+
+    if (!button->debouncing) {
+        GPIO_Value_Type level;
+        if (ReadButtonLevel(button, &level) != 0) {
+            Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
+            terminationRequired = true;
+            return;
+        }
+        if (level != button->stableState) {
+            StartDebounce(button, level);
+        }
+    }
+}
+
+int StartButtonInput(int epollFd, TimerWheel *wheel, ButtonInput *button)
+{
+    button->wheel = wheel;
+    button->sampleTimer.eventData.eventHandler = &ButtonSampleTimerEventHandler;
+    button->edgeEventData.eventHandler = &ButtonEdgeEventHandler;
+    button->stableState = GPIO_Value_High;
+    button->debouncing = false;
+
+    if (ReadButtonLevel(button, &button->stableState) != 0) {
+        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (button->edgeFd >= 0) {
+        // A blocking edgeFd would stall the event loop once drained.
+        int flags = fcntl(button->edgeFd, F_GETFL);
+        if (flags == -1 || !(flags & O_NONBLOCK)) {
+            Log_Debug("ERROR: Button edgeFd must be non-blocking.\n");
+            errno = EINVAL;
+            return -1;
+        }
+        if (RegisterEventHandlerToEpoll(epollFd, button->edgeFd, &button->edgeEventData,
+                                        EPOLLIN) != 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    return SetSoftTimerToPeriod(wheel, &button->sampleTimer, &idleScanPeriod);
+}
+
+void StopButtonInput(int epollFd, ButtonInput *button)
+{
+    if (button->wheel != NULL) {
+        CancelSoftTimer(button->wheel, &button->sampleTimer);
+    }
+    if (button->edgeFd >= 0) {
+        UnregisterEventHandlerFromEpoll(epollFd, button->edgeFd);
+    }
+}
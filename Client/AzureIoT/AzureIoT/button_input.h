@@ -0,0 +1,104 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <applibs/gpio.h>
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>
+///     Period at which a button without an edge source is sampled while idle.
+/// </summary>
+#define BUTTON_INPUT_IDLE_SCAN_MS 50
+
+/// <summary>
+///     Period at which a button is sampled while a debounce is in progress.
+/// </summary>
+#define BUTTON_INPUT_DEBOUNCE_SAMPLE_MS TIMER_WHEEL_TICK_MS
+
+/// <summary>
+///     Number of consecutive identical samples needed to accept a new button state.
+/// </summary>
+#define BUTTON_INPUT_DEBOUNCE_SAMPLES 3
+
+struct ButtonInput;
+
+/// <summary>
+///     Function signature for reading the current level of a button.
+/// </summary>
+/// <param name="button">The button</param>
+/// <param name="value">Receives the button level</param>
+/// <returns>0 on success, or -1 on failure</returns>
+typedef int (*ButtonReadLevel)(struct ButtonInput *button, GPIO_Value_Type *value);
+
+/// <summary>
+///     Function signature for button press handlers.
+/// </summary>
+typedef void (*ButtonPressedHandler)(void);
+
+/// <summary>
+/// <para>An edge detecting, debounced button input.</para>
+/// <para>If edgeFd is a valid file descriptor, the button is idle until edgeFd becomes
+/// readable, e.g. a pipe or eventfd written by a host test harness. edgeFd must be opened with
+/// O_NONBLOCK, since it is drained until empty from the event loop. Otherwise the button is
+/// scanned every BUTTON_INPUT_IDLE_SCAN_MS. Once a level change is seen, the button is
+/// sampled every BUTTON_INPUT_DEBOUNCE_SAMPLE_MS until it has been stable for
+/// BUTTON_INPUT_DEBOUNCE_SAMPLES samples.</para>
+/// <para>Populate pressedHandler, gpioFd and edgeFd before calling
+/// <see cref="StartButtonInput" />. readLevel defaults to GPIO_GetValue on gpioFd. The struct
+/// must remain valid until <see cref="StopButtonInput" /> is called.</para>
+/// </summary>
+typedef struct ButtonInput {
+    /// <summary>
+    /// Function called when the button is pressed, i.e. goes low.
+    /// </summary>
+    ButtonPressedHandler pressedHandler;
+    /// <summary>
+    /// Function reading the button level. NULL to read gpioFd.
+    /// </summary>
+    ButtonReadLevel readLevel;
+    /// <summary>
+    /// GPIO file descriptor of the button.
+    /// </summary>
+    int gpioFd;
+    /// <summary>
+    /// Optional non-blocking file descriptor which becomes readable on a level change, or -1.
+    /// </summary>
+    int edgeFd;
+    /// <summary>
+    /// Event data registered with epoll for edgeFd.
+    /// </summary>
+    EventData edgeEventData;
+    /// <summary>
+    /// Soft timer used for idle scanning and debounce sampling.
+    /// </summary>
+    SoftTimer sampleTimer;
+    TimerWheel *wheel;
+    /// <summary>
+    /// Last debounced state, and the state currently being debounced.
+    /// </summary>
+    GPIO_Value_Type stableState;
+    GPIO_Value_Type candidateState;
+    uint8_t candidateSamples;
+    bool debouncing;
+    /// <summary>
+    /// Number of times the button was sampled, and number of accepted presses.
+    /// </summary>
+    uint32_t sampleCount;
+    uint32_t pressCount;
+} ButtonInput;
+
+/// <summary>
+///     Starts monitoring a button. Registers edgeFd with the epoll instance if it is valid, or
+///     arms the idle scan timer otherwise. Fails with EINVAL if edgeFd is not non-blocking.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="wheel">Timer wheel serving the sample timer</param>
+/// <param name="button">Persistent button input</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int StartButtonInput(int epollFd, TimerWheel *wheel, ButtonInput *button);
+
+/// <summary>
+///     Stops monitoring a button. Does not close gpioFd or edgeFd.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="button">The button input</param>
+void StopButtonInput(int epollFd, ButtonInput *button);
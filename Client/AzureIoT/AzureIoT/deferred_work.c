@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <applibs/log.h>
+#include "deferred_work.h"
+
+/// <summary>
+///     Handler for the queue's eventfd: runs the items that were queued when it was signalled.
+/// </summary>
+static void DeferredWorkEventHandler(EventData *eventData)
+{
+    DeferredWorkQueue *queue = (DeferredWorkQueue *)eventData;
+    uint64_t eventData64 = 0;
+
+    if (read(queue->eventData.fd, &eventData64, sizeof(eventData64)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read deferred work eventfd %s (%d).\n", strerror(errno),
+                  errno);
+    }
+
+    // Bound the run to what is queued now so that work re-queuing itself cannot starve the
+    // rest of the event loop.
+    unsigned int toRun = queue->count;
+    while (toRun-- > 0) {
+        DeferredWork work = queue->items[queue->head];
+        queue->head = (queue->head + 1) % DEFERRED_WORK_QUEUE_SIZE;
+        queue->count--;
+        work.handler(work.context);
+    }
+
+    if (queue->count > 0) {
+        uint64_t increment = 1;
+        if (write(queue->eventData.fd, &increment, sizeof(increment)) == -1) {
+            Log_Debug("ERROR: Could not signal deferred work eventfd %s (%d).\n", strerror(errno),
+                      errno);
+        }
+    }
+}
+
+int CreateDeferredWorkQueueAndAddToEpoll(int epollFd, DeferredWorkQueue *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->eventData.eventHandler = &DeferredWorkEventHandler;
+
+    int eventFd = eventfd(0, EFD_NONBLOCK);
+    if (eventFd < 0) {
+        Log_Debug("ERROR: Could not create eventfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, eventFd, &queue->eventData, EPOLLIN) != 0) {
+        close(eventFd);
+        return -1;
+    }
+
+    return eventFd;
+}
+
+int QueueDeferredWork(DeferredWorkQueue *queue, DeferredWorkHandler handler, void *context)
+{
+    if (queue->count == DEFERRED_WORK_QUEUE_SIZE) {
+        queue->overflowCount++;
+        Log_Debug("ERROR: Deferred work queue is full.\n");
+        return -1;
+    }
+
+    unsigned int tail = (queue->head + queue->count) % DEFERRED_WORK_QUEUE_SIZE;
+    queue->items[tail].handler = handler;
+    queue->items[tail].context = context;
+    queue->count++;
+    if (queue->count > queue->highWaterMark) {
+        queue->highWaterMark = queue->count;
+    }
+
+    // Only the first item needs to wake the event loop.
+    if (queue->count == 1) {
+        uint64_t increment = 1;
+        if (write(queue->eventData.fd, &increment, sizeof(increment)) == -1) {
+            Log_Debug("ERROR: Could not signal deferred work eventfd %s (%d).\n", strerror(errno),
+                      errno);
+        }
+    }
+
+    return 0;
+}
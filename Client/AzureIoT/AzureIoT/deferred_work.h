@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>
+///     Number of work items a <see cref="DeferredWorkQueue" /> can hold.
+/// </summary>
+#define DEFERRED_WORK_QUEUE_SIZE 16
+
+/// <summary>
+///     Function signature for deferred work handlers.
+/// </summary>
+/// <param name="context">The context passed to <see cref="QueueDeferredWork" /></param>
+typedef void (*DeferredWorkHandler)(void *context);
+
+/// <summary>
+///     A queued work item.
+/// </summary>
+typedef struct DeferredWork {
+    DeferredWorkHandler handler;
+    void *context;
+} DeferredWork;
+
+/// <summary>
+/// <para>A fixed capacity FIFO of work items run from the event loop.</para>
+/// <para>Callbacks which must return quickly, such as those invoked from
+/// IoTHubDeviceClient_LL_DoWork, queue work here instead of doing I2C or GPIO access inline.
+/// The queue is signalled through an eventfd registered with epoll; it is not thread safe and
+/// must only be used from the event loop thread.</para>
+/// </summary>
+/// <seealso cref="CreateDeferredWorkQueueAndAddToEpoll" />
+typedef struct DeferredWorkQueue {
+    /// <summary>
+    /// Event data registered with epoll for the queue's eventfd. Must be the first member.
+    /// </summary>
+    EventData eventData;
+    DeferredWork items[DEFERRED_WORK_QUEUE_SIZE];
+    unsigned int head;
+    unsigned int count;
+    /// <summary>
+    /// Largest number of items queued at once, and items rejected because the queue was full.
+    /// </summary>
+    unsigned int highWaterMark;
+    uint32_t overflowCount;
+} DeferredWorkQueue;
+
+/// <summary>
+///     Initializes a deferred work queue, creates its eventfd and adds it to an epoll instance.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="queue">Persistent work queue. This must stay in memory until the eventfd is
+/// removed from the epoll.</param>
+/// <returns>A valid eventfd file descriptor on success, or -1 on failure</returns>
+int CreateDeferredWorkQueueAndAddToEpoll(int epollFd, DeferredWorkQueue *queue);
+
+/// <summary>
+///     Queues a handler to be called from the event loop. Work queued while the queue is being
+///     run is deferred to the next event loop wakeup.
+/// </summary>
+/// <param name="queue">The work queue</param>
+/// <param name="handler">The handler to call</param>
+/// <param name="context">Context passed to the handler</param>
+/// <returns>0 on success, or -1 if the queue is full</returns>
+int QueueDeferredWork(DeferredWorkQueue *queue, DeferredWorkHandler handler, void *context);
@@ -94,6 +94,100 @@ int ConsumeTimerFdEvent(int timerFd)
     return 0;
 }
 
+/// <summary>
+///     Returns the current CLOCK_MONOTONIC time in microseconds.
+/// </summary>
+static uint64_t GetMonotonicMicroseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 * 1000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+/// <summary>
+///     Adds a sample to a log-scale histogram and tracks its maximum.
+/// </summary>
+static void RecordHistogramSample(uint32_t *histogram, uint32_t *max, uint64_t us)
+{
+    uint32_t sample = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    unsigned int bucket = 0;
+
+    if (sample > 0) {
+        bucket = 32 - (unsigned int)__builtin_clz(sample);
+        if (bucket >= EVENT_STATS_HISTOGRAM_BUCKETS) {
+            bucket = EVENT_STATS_HISTOGRAM_BUCKETS - 1;
+        }
+    }
+    histogram[bucket]++;
+    if (sample > *max) {
+        *max = sample;
+    }
+}
+
+static void RecordEventLag(EventStats *stats, uint64_t lagUs)
+{
+    RecordHistogramSample(stats->lagHistogram, &stats->maxLagUs, lagUs);
+}
+
+int ConsumeTimerFdEventWithStats(EventData *eventData)
+{
+    uint64_t timerData = 0;
+
+    if (read(eventData->fd, &timerData, sizeof(timerData)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (timerData > 1) {
+        eventData->stats.coalescedExpirations += (uint32_t)(timerData - 1);
+    }
+
+    // For a periodic timer the time since the latest expiry is the period minus the time
+    // remaining until the next one.
+    struct itimerspec currentValue;
+    if (timerfd_gettime(eventData->fd, &currentValue) == 0 &&
+        (currentValue.it_interval.tv_sec != 0 || currentValue.it_interval.tv_nsec != 0)) {
+        int64_t intervalUs = (int64_t)currentValue.it_interval.tv_sec * 1000 * 1000 +
+                             currentValue.it_interval.tv_nsec / 1000;
+        int64_t remainingUs = (int64_t)currentValue.it_value.tv_sec * 1000 * 1000 +
+                              currentValue.it_value.tv_nsec / 1000;
+        if (remainingUs <= intervalUs) {
+            RecordEventLag(&eventData->stats, (uint64_t)(intervalUs - remainingUs));
+        }
+    }
+
+    return 0;
+}
+
+void CallEventHandler(EventData *eventData)
+{
+    uint64_t startUs = GetMonotonicMicroseconds();
+    eventData->eventHandler(eventData);
+    uint64_t runTimeUs = GetMonotonicMicroseconds() - startUs;
+
+    eventData->stats.dispatchCount++;
+    RecordHistogramSample(eventData->stats.runTimeHistogram, &eventData->stats.maxRunTimeUs,
+                          runTimeUs);
+}
+
+void LogEventStats(const char *name, const EventData *eventData)
+{
+    const EventStats *stats = &eventData->stats;
+
+    Log_Debug("%s: %u dispatches, %u coalesced, max lag %u us, max run time %u us.\n", name,
+              stats->dispatchCount, stats->coalescedExpirations, stats->maxLagUs,
+              stats->maxRunTimeUs);
+    Log_Debug("%s: lag histogram:     ", name);
+    for (int i = 0; i < EVENT_STATS_HISTOGRAM_BUCKETS; i++) {
+        Log_Debug(" %u", stats->lagHistogram[i]);
+    }
+    Log_Debug("\n%s: run time histogram:", name);
+    for (int i = 0; i < EVENT_STATS_HISTOGRAM_BUCKETS; i++) {
+        Log_Debug(" %u", stats->runTimeHistogram[i]);
+    }
+    Log_Debug("\n");
+}
+
 int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
                                EventData *persistentEventData, const uint32_t epollEventMask)
 {
@@ -121,8 +215,19 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
 
 int WaitForEventAndCallHandler(int epollFd)
 {
-    struct epoll_event event;
-    int numEventsOccurred = epoll_wait(epollFd, &event, 1, -1);
+    return WaitForEventsAndCallHandlers(epollFd, NULL);
+}
+
+int WaitForEventsAndCallHandlers(int epollFd, int *eventsDispatched)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS_PER_WAIT];
+    int dispatched = 0;
+
+    if (eventsDispatched != NULL) {
+        *eventsDispatched = 0;
+    }
+
+    int numEventsOccurred = epoll_wait(epollFd, events, EPOLL_MAX_EVENTS_PER_WAIT, -1);
 
     if (numEventsOccurred == -1) {
         if (errno == EINTR) {
@@ -133,14 +238,350 @@ int WaitForEventAndCallHandler(int epollFd)
         return -1;
     }
 
-    if (numEventsOccurred == 1 && event.data.ptr != NULL) {
-        EventData *eventData = event.data.ptr;
-        eventData->eventHandler(eventData);
+    for (int i = 0; i < numEventsOccurred; i++) {
+        EventData *eventData = events[i].data.ptr;
+        if (eventData != NULL) {
+            CallEventHandler(eventData);
+            dispatched++;
+        }
+    }
+
+    if (eventsDispatched != NULL) {
+        *eventsDispatched = dispatched;
+    }
+
+    return 0;
+}
+
+#define TIMER_WHEEL_LEVEL0_SIZE (1 << TIMER_WHEEL_LEVEL0_BITS)
+#define TIMER_WHEEL_LEVEL0_MASK (TIMER_WHEEL_LEVEL0_SIZE - 1)
+#define TIMER_WHEEL_LEVELN_SIZE (1 << TIMER_WHEEL_LEVELN_BITS)
+#define TIMER_WHEEL_LEVELN_MASK (TIMER_WHEEL_LEVELN_SIZE - 1)
+#define TIMER_WHEEL_LEVEL_SHIFT(level) \
+    (TIMER_WHEEL_LEVEL0_BITS + ((level)-1) * TIMER_WHEEL_LEVELN_BITS)
+#define TIMER_WHEEL_MAX_DELTA \
+    ((1ULL << TIMER_WHEEL_LEVEL_SHIFT(TIMER_WHEEL_LEVELN_COUNT + 1)) - 1)
+#define TIMER_WHEEL_NO_TICK UINT64_MAX
+
+/// <summary>
+///     Returns the current CLOCK_MONOTONIC time in timer wheel ticks.
+/// </summary>
+static uint64_t GetTimerWheelTick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / (1000 * 1000)) /
+           TIMER_WHEEL_TICK_MS;
+}
+
+/// <summary>
+///     Returns the first tick starting at or after the current CLOCK_MONOTONIC time. Delays are
+///     counted from it, since counting from the tick in progress would expire a timer up to one
+///     tick early.
+/// </summary>
+static uint64_t GetNextTimerWheelTick(void)
+{
+    const uint64_t tickNs = (uint64_t)TIMER_WHEEL_TICK_MS * 1000 * 1000;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000 * 1000 * 1000 + (uint64_t)now.tv_nsec + tickNs - 1) / tickNs;
+}
+
+/// <summary>
+///     Converts a duration to ticks, rounding up. Returns 0 only for a zero duration.
+/// </summary>
+static uint64_t TimespecToTicks(const struct timespec *duration)
+{
+    uint64_t ms = (uint64_t)duration->tv_sec * 1000 +
+                  ((uint64_t)duration->tv_nsec + (1000 * 1000) - 1) / (1000 * 1000);
+    return (ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+}
+
+/// <summary>
+///     Links a timer into the slot matching its expiry, relative to the wheel's current tick.
+/// </summary>
+static void LinkSoftTimer(TimerWheel *wheel, SoftTimer *timer)
+{
+    uint64_t expiry = timer->expiryTick;
+    SoftTimer **slot;
+
+    if (expiry < wheel->currentTick) {
+        // Already due; run on the next processed tick.
+        expiry = wheel->currentTick;
+    } else if (expiry - wheel->currentTick > TIMER_WHEEL_MAX_DELTA) {
+        expiry = wheel->currentTick + TIMER_WHEEL_MAX_DELTA;
+    }
+
+    uint64_t delta = expiry - wheel->currentTick;
+    if (delta < TIMER_WHEEL_LEVEL0_SIZE) {
+        timer->level = 0;
+        slot = &wheel->level0[expiry & TIMER_WHEEL_LEVEL0_MASK];
+    } else {
+        uint8_t level = 1;
+        while (level < TIMER_WHEEL_LEVELN_COUNT &&
+               delta >= (1ULL << TIMER_WHEEL_LEVEL_SHIFT(level + 1))) {
+            level++;
+        }
+        timer->level = level;
+        slot = &wheel->levelN[level - 1]
+                             [(expiry >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_LEVELN_MASK];
+        wheel->cascadeCount++;
+    }
+
+    timer->next = *slot;
+    if (timer->next != NULL) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/// <summary>
+///     Removes a timer from whichever slot list it is linked into.
+/// </summary>
+static void UnlinkSoftTimer(TimerWheel *wheel, SoftTimer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    if (timer->level > 0) {
+        wheel->cascadeCount--;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/// <summary>
+///     Moves every timer in one slot of a coarser level down to the finer levels.
+/// </summary>
+/// <returns>The index of the cascaded slot</returns>
+static unsigned int CascadeTimerWheel(TimerWheel *wheel, uint8_t level)
+{
+    unsigned int index =
+        (unsigned int)(wheel->currentTick >> TIMER_WHEEL_LEVEL_SHIFT(level)) &
+        TIMER_WHEEL_LEVELN_MASK;
+    SoftTimer *timer = wheel->levelN[level - 1][index];
+
+    wheel->levelN[level - 1][index] = NULL;
+    while (timer != NULL) {
+        SoftTimer *next = timer->next;
+        wheel->cascadeCount--;
+        LinkSoftTimer(wheel, timer);
+        timer = next;
+    }
+
+    return index;
+}
+
+/// <summary>
+///     Returns the tick the timerfd needs to fire at next, or TIMER_WHEEL_NO_TICK.
+/// </summary>
+static uint64_t GetNextTimerWheelWakeTick(const TimerWheel *wheel)
+{
+    if (wheel->armedCount == 0) {
+        return TIMER_WHEEL_NO_TICK;
+    }
+
+    for (uint64_t tick = wheel->currentTick; tick < wheel->currentTick + TIMER_WHEEL_LEVEL0_SIZE;
+         tick++) {
+        if ((tick & TIMER_WHEEL_LEVEL0_MASK) == 0 && wheel->cascadeCount > 0) {
+            // Coarser timers may cascade into the first level here.
+            return tick;
+        }
+        if (wheel->level0[tick & TIMER_WHEEL_LEVEL0_MASK] != NULL) {
+            return tick;
+        }
+    }
+
+    return wheel->currentTick + TIMER_WHEEL_LEVEL0_SIZE;
+}
+
+/// <summary>
+///     Programs the wheel's timerfd for the next tick that needs processing.
+/// </summary>
+static int ProgramTimerWheel(TimerWheel *wheel)
+{
+    uint64_t wakeTick = GetNextTimerWheelWakeTick(wheel);
+    if (wakeTick == wheel->programmedTick) {
+        return 0;
+    }
+
+    struct itimerspec newValue = {.it_value = {0, 0}, .it_interval = {0, 0}};
+    if (wakeTick != TIMER_WHEEL_NO_TICK) {
+        uint64_t wakeMs = wakeTick * TIMER_WHEEL_TICK_MS;
+        newValue.it_value.tv_sec = (time_t)(wakeMs / 1000);
+        newValue.it_value.tv_nsec = (long)(wakeMs % 1000) * 1000 * 1000;
+        if (newValue.it_value.tv_sec == 0 && newValue.it_value.tv_nsec == 0) {
+            // A zero value would disarm the timerfd.
+            newValue.it_value.tv_nsec = 1;
+        }
+    }
+
+    if (timerfd_settime(wheel->eventData.fd, TFD_TIMER_ABSTIME, &newValue, NULL) < 0) {
+        Log_Debug("ERROR: Could not set timer wheel timerfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
     }
 
+    wheel->programmedTick = wakeTick;
     return 0;
 }
 
+/// <summary>
+///     Processes every tick up to and including nowTick, calling the handlers of expired timers.
+/// </summary>
+static void RunTimerWheel(TimerWheel *wheel, uint64_t nowTick)
+{
+    wheel->running = true;
+
+    while (wheel->currentTick <= nowTick) {
+        if (wheel->armedCount == 0) {
+            // Nothing to expire; skip the idle ticks.
+            wheel->currentTick = nowTick + 1;
+            break;
+        }
+
+        unsigned int index = (unsigned int)(wheel->currentTick & TIMER_WHEEL_LEVEL0_MASK);
+        if (index == 0) {
+            for (uint8_t level = 1;
+                 level <= TIMER_WHEEL_LEVELN_COUNT && CascadeTimerWheel(wheel, level) == 0;
+                 level++) {
+            }
+        }
+
+        // Detach the slot so that handlers re-arming timers link into the wheel proper.
+        SoftTimer *expired = wheel->level0[index];
+        wheel->level0[index] = NULL;
+        if (expired != NULL) {
+            expired->pprev = &expired;
+        }
+        wheel->currentTick++;
+
+        while (expired != NULL) {
+            SoftTimer *timer = expired;
+            uint64_t scheduledUs = timer->expiryTick * TIMER_WHEEL_TICK_MS * 1000;
+            UnlinkSoftTimer(wheel, timer);
+            if (timer->periodTicks > 0) {
+                timer->expiryTick += timer->periodTicks;
+                if (timer->expiryTick <= nowTick) {
+                    // Fell behind by whole periods; drop the missed expirations.
+                    uint64_t missed = (nowTick - timer->expiryTick) / timer->periodTicks + 1;
+                    timer->expiryTick += missed * timer->periodTicks;
+                    timer->eventData.stats.coalescedExpirations += (uint32_t)missed;
+                }
+                LinkSoftTimer(wheel, timer);
+            } else {
+                wheel->armedCount--;
+            }
+            uint64_t nowUs = GetMonotonicMicroseconds();
+            RecordEventLag(&timer->eventData.stats, nowUs > scheduledUs ? nowUs - scheduledUs : 0);
+            CallEventHandler(&timer->eventData);
+        }
+    }
+
+    wheel->running = false;
+}
+
+/// <summary>
+///     Handler for the timer wheel's timerfd: expires due soft timers and reprograms the timerfd.
+/// </summary>
+static void TimerWheelEventHandler(EventData *eventData)
+{
+    TimerWheel *wheel = (TimerWheel *)eventData;
+    uint64_t timerData = 0;
+
+    // The timerfd may have been reprogrammed since it became readable; EAGAIN is expected then.
+    if (read(wheel->eventData.fd, &timerData, sizeof(timerData)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read timer wheel timerfd %s (%d).\n", strerror(errno), errno);
+    }
+
+    RunTimerWheel(wheel, GetTimerWheelTick());
+
+    wheel->programmedTick = TIMER_WHEEL_NO_TICK;
+    ProgramTimerWheel(wheel);
+}
+
+int CreateTimerWheelAndAddToEpoll(int epollFd, TimerWheel *wheel, const uint32_t epollEventMask)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->eventData.eventHandler = &TimerWheelEventHandler;
+    wheel->currentTick = GetTimerWheelTick();
+    wheel->programmedTick = TIMER_WHEEL_NO_TICK;
+
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd < 0) {
+        Log_Debug("ERROR: Could not create timerfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    wheel->eventData.fd = timerFd;
+    if (RegisterEventHandlerToEpoll(epollFd, timerFd, &wheel->eventData, epollEventMask) != 0) {
+        return -1;
+    }
+
+    return timerFd;
+}
+
+/// <summary>
+///     Schedules a timer to expire after delayTicks, repeating every periodTicks if non-zero.
+/// </summary>
+static int ArmSoftTimer(TimerWheel *wheel, SoftTimer *timer, uint64_t delayTicks,
+                        uint64_t periodTicks)
+{
+    CancelSoftTimer(wheel, timer);
+    if (delayTicks == 0) {
+        return 0;
+    }
+
+    uint64_t nowTick = GetNextTimerWheelTick();
+    if (wheel->armedCount == 0 && !wheel->running) {
+        // Nothing is pending, so the wheel can jump straight to the present.
+        wheel->currentTick = nowTick;
+    }
+
+    timer->eventData.fd = -1;
+    timer->expiryTick = nowTick + delayTicks;
+    timer->periodTicks = (uint32_t)periodTicks;
+    LinkSoftTimer(wheel, timer);
+    wheel->armedCount++;
+
+    if (wheel->running) {
+        // The timerfd is reprogrammed once all expired timers have been dispatched.
+        return 0;
+    }
+    return ProgramTimerWheel(wheel);
+}
+
+int SetSoftTimerToPeriod(TimerWheel *wheel, SoftTimer *timer, const struct timespec *period)
+{
+    uint64_t periodTicks = TimespecToTicks(period);
+    if (periodTicks > UINT32_MAX) {
+        Log_Debug("ERROR: Soft timer period is too long.\n");
+        return -1;
+    }
+    return ArmSoftTimer(wheel, timer, periodTicks, periodTicks);
+}
+
+int SetSoftTimerToSingleExpiry(TimerWheel *wheel, SoftTimer *timer, const struct timespec *expiry)
+{
+    return ArmSoftTimer(wheel, timer, TimespecToTicks(expiry), 0);
+}
+
+void CancelSoftTimer(TimerWheel *wheel, SoftTimer *timer)
+{
+    if (timer->pprev == NULL) {
+        return;
+    }
+    UnlinkSoftTimer(wheel, timer);
+    wheel->armedCount--;
+    // The timerfd is left programmed; a spurious wakeup finds nothing to expire.
+}
+
+bool IsSoftTimerArmed(const SoftTimer *timer)
+{
+    return timer->pprev != NULL;
+}
+
 void CloseFdAndPrintError(int fd, const char *fdName)
 {
     if (fd >= 0) {
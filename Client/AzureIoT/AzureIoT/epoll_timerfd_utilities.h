@@ -2,6 +2,8 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/epoll.h>
 #include <unistd.h>
@@ -15,6 +17,44 @@ struct EventData;
 /// <param name="eventData">The provided event data</param>
 typedef void (*EventHandler)(struct EventData *eventData);
 
+/// <summary>
+///     Number of buckets in the <see cref="EventStats" /> latency histograms. Bucket 0 counts
+///     samples below 1 us and bucket n counts samples in [2^(n-1), 2^n) us; the last bucket
+///     also holds everything longer.
+/// </summary>
+#define EVENT_STATS_HISTOGRAM_BUCKETS 20
+
+/// <summary>
+///     Dispatch counters and latency histograms kept for every event handler.
+/// </summary>
+typedef struct EventStats {
+    /// <summary>
+    /// Number of times the handler was called.
+    /// </summary>
+    uint32_t dispatchCount;
+    /// <summary>
+    /// Timer expirations which were merged into a later dispatch instead of getting their own.
+    /// </summary>
+    uint32_t coalescedExpirations;
+    /// <summary>
+    /// Largest delay between the scheduled expiry and the handler being called, in us.
+    /// </summary>
+    uint32_t maxLagUs;
+    /// <summary>
+    /// Longest handler run time, in us.
+    /// </summary>
+    uint32_t maxRunTimeUs;
+    /// <summary>
+    /// Histogram of scheduled-to-dispatch delay. Only timer events have a schedule to compare
+    /// against.
+    /// </summary>
+    uint32_t lagHistogram[EVENT_STATS_HISTOGRAM_BUCKETS];
+    /// <summary>
+    /// Histogram of handler run time.
+    /// </summary>
+    uint32_t runTimeHistogram[EVENT_STATS_HISTOGRAM_BUCKETS];
+} EventStats;
+
 /// <summary>
 /// <para>Contains context data for epoll events.</para>
 /// <para>When an event is registered with RegisterEventHandlerToEpoll, supply
@@ -31,6 +71,10 @@ typedef struct EventData {
     /// The file descriptor that generated the event.
     /// </summary>
     int fd;
+    /// <summary>
+    /// Counters and histograms updated each time the handler is called.
+    /// </summary>
+    EventStats stats;
 } EventData;
 
 /// <summary>
@@ -84,6 +128,28 @@ int SetTimerFdToSingleExpiry(int timerFd, const struct timespec *expiry);
 /// <returns>0 on success, or -1 on failure</returns>
 int ConsumeTimerFdEvent(int timerFd);
 
+/// <summary>
+///     Consumes an event by reading from the timer file descriptor of the event data, and
+///     records the expirations coalesced into this dispatch and, for periodic timers, the
+///     delay since the latest expiry into the event's stats.
+/// </summary>
+/// <param name="eventData">Event data of a timerfd event</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int ConsumeTimerFdEventWithStats(EventData *eventData);
+
+/// <summary>
+///     Calls the handler of an event, recording its run time into the event's stats.
+/// </summary>
+/// <param name="eventData">The event data</param>
+void CallEventHandler(EventData *eventData);
+
+/// <summary>
+///     Logs the stats of an event handler.
+/// </summary>
+/// <param name="name">Event name to use in the log message</param>
+/// <param name="eventData">The event data</param>
+void LogEventStats(const char *name, const EventData *eventData);
+
 /// <summary>
 ///     Creates a timerfd and adds it to an epoll instance.
 /// </summary>
@@ -96,6 +162,12 @@ int ConsumeTimerFdEvent(int timerFd);
 int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
                                EventData *persistentEventData, const uint32_t epollEventMask);
 
+/// <summary>
+///     Maximum number of ready events drained by a single epoll_wait call in
+///     <see cref="WaitForEventsAndCallHandlers" />.
+/// </summary>
+#define EPOLL_MAX_EVENTS_PER_WAIT 8
+
 /// <summary>
 ///     Waits for an event on an epoll instance and triggers the handler.
 /// </summary>
@@ -105,6 +177,148 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
 /// <returns>0 on success, or -1 on failure</returns>
 int WaitForEventAndCallHandler(int epollFd);
 
+/// <summary>
+///     <para>Waits for events on an epoll instance and triggers the handler of every event
+///     that is ready, up to <see cref="EPOLL_MAX_EVENTS_PER_WAIT" /> per call.</para>
+///     <para>Handlers are called in the order epoll reports them. Epoll requeues a
+///     level-triggered fd at the tail of its ready list once reported, so when more events are
+///     ready than fit in one batch the remainder is served first on the next call.</para>
+///     <para>The EventData of every event in a batch must remain valid until the call returns,
+///     even if an earlier handler in the same batch unregisters it.</para>
+/// </summary>
+/// <param name="epollFd">
+///     Epoll file descriptor which was created with <see cref="CreateEpollFd" />.
+/// </param>
+/// <param name="eventsDispatched">Optional; receives the number of handlers called. May be
+/// NULL.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int WaitForEventsAndCallHandlers(int epollFd, int *eventsDispatched);
+
+/// <summary>
+///     Resolution of the timer wheel in milliseconds. Soft timer periods and expiries are
+///     rounded up to a whole number of ticks, so a timer may expire up to a tick late but never
+///     early.
+/// </summary>
+#define TIMER_WHEEL_TICK_MS 10
+
+/// <summary>
+///     Number of slot bits in the first wheel level and in each of the coarser levels. With a
+///     10 ms tick the four levels cover 2.56 s, 164 s, 2.9 h and 7.7 days respectively; longer
+///     expiries are clamped to the outermost level.
+/// </summary>
+#define TIMER_WHEEL_LEVEL0_BITS 8
+#define TIMER_WHEEL_LEVELN_BITS 6
+#define TIMER_WHEEL_LEVELN_COUNT 3
+
+/// <summary>
+/// <para>A software timer served by a <see cref="TimerWheel" />.</para>
+/// <para>Only the eventData.eventHandler field needs to be populated. The handler is called
+/// from the event loop with a pointer to eventData; eventData.fd is always -1. The struct must
+/// remain valid for as long as the timer is armed.</para>
+/// </summary>
+typedef struct SoftTimer {
+    /// <summary>
+    /// Handler called when the timer expires.
+    /// </summary>
+    EventData eventData;
+    /// <summary>
+    /// Intrusive slot list links. pprev is NULL while the timer is not armed.
+    /// </summary>
+    struct SoftTimer *next;
+    struct SoftTimer **pprev;
+    /// <summary>
+    /// Absolute tick at which the timer expires.
+    /// </summary>
+    uint64_t expiryTick;
+    /// <summary>
+    /// Period in ticks, or 0 for a single expiry timer.
+    /// </summary>
+    uint32_t periodTicks;
+    /// <summary>
+    /// Wheel level the timer is currently linked into.
+    /// </summary>
+    uint8_t level;
+} SoftTimer;
+
+/// <summary>
+/// <para>Hierarchical timer wheel that multiplexes any number of periodic and single expiry
+/// <see cref="SoftTimer" />s onto a single timerfd.</para>
+/// <para>Arming and cancelling a timer are O(1). The timerfd is only programmed for the next
+/// occupied slot of the first level, or for the next cascade of a coarser level, so an idle
+/// wheel does not wake the event loop every tick.</para>
+/// </summary>
+/// <seealso cref="CreateTimerWheelAndAddToEpoll" />
+typedef struct TimerWheel {
+    /// <summary>
+    /// Event data registered with epoll for the wheel's timerfd. Must be the first member.
+    /// </summary>
+    EventData eventData;
+    /// <summary>
+    /// The next tick to be processed.
+    /// </summary>
+    uint64_t currentTick;
+    /// <summary>
+    /// The tick the timerfd is currently programmed for, or UINT64_MAX when disarmed.
+    /// </summary>
+    uint64_t programmedTick;
+    /// <summary>
+    /// Number of armed timers, and how many of them are in the coarser levels.
+    /// </summary>
+    unsigned int armedCount;
+    unsigned int cascadeCount;
+    /// <summary>
+    /// True while expired timers are being dispatched.
+    /// </summary>
+    bool running;
+    SoftTimer *level0[1 << TIMER_WHEEL_LEVEL0_BITS];
+    SoftTimer *levelN[TIMER_WHEEL_LEVELN_COUNT][1 << TIMER_WHEEL_LEVELN_BITS];
+} TimerWheel;
+
+/// <summary>
+///     Initializes a timer wheel, creates its timerfd and adds it to an epoll instance.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="wheel">Persistent timer wheel. This must stay in memory until the timerfd is
+/// removed from the epoll.</param>
+/// <param name="epollEventMask">Bit mask for the epoll event type</param>
+/// <returns>A valid timerfd file descriptor on success, or -1 on failure</returns>
+int CreateTimerWheelAndAddToEpoll(int epollFd, TimerWheel *wheel, const uint32_t epollEventMask);
+
+/// <summary>
+///     Arms a soft timer to expire repeatedly with the given period. If the timer is already
+///     armed it is rescheduled. A zero period disarms the timer.
+/// </summary>
+/// <param name="wheel">Timer wheel serving the timer</param>
+/// <param name="timer">Soft timer</param>
+/// <param name="period">The new period</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int SetSoftTimerToPeriod(TimerWheel *wheel, SoftTimer *timer, const struct timespec *period);
+
+/// <summary>
+///     Arms a soft timer to expire once only. If the timer is already armed it is rescheduled.
+///     A zero expiry disarms the timer.
+/// </summary>
+/// <param name="wheel">Timer wheel serving the timer</param>
+/// <param name="timer">Soft timer</param>
+/// <param name="expiry">The time elapsed before it expires once</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int SetSoftTimerToSingleExpiry(TimerWheel *wheel, SoftTimer *timer,
+                               const struct timespec *expiry);
+
+/// <summary>
+///     Disarms a soft timer. Cancelling a timer which is not armed has no effect.
+/// </summary>
+/// <param name="wheel">Timer wheel serving the timer</param>
+/// <param name="timer">Soft timer</param>
+void CancelSoftTimer(TimerWheel *wheel, SoftTimer *timer);
+
+/// <summary>
+///     Returns whether a soft timer is armed.
+/// </summary>
+/// <param name="timer">Soft timer</param>
+/// <returns>true if the timer is armed, false otherwise</returns>
+bool IsSoftTimerArmed(const SoftTimer *timer);
+
 /// <summary>
 ///     Closes a file descriptor and prints an error on failure.
 /// </summary>
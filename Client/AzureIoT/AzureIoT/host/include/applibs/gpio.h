@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+// Host stand-in for the Azure Sphere applibs GPIO API, declaring the subset used by
+// button_input.c. Host programs that read buttons implement GPIO_GetValue themselves.
+
+typedef uint8_t GPIO_Value_Type;
+
+#define GPIO_Value_Low 0
+#define GPIO_Value_High 1
+
+int GPIO_GetValue(int gpioFd, GPIO_Value_Type* outValue);
@@ -0,0 +1,28 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Host stand-in for the Azure Sphere applibs I2C master API, declaring the subset used by
+// SoilSensor/i2cAccess.c. The calls are implemented by SoilSensor/I2CSimulation.c.
+
+typedef int I2C_InterfaceId;
+typedef uint32_t I2C_DeviceAddress;
+typedef uint32_t I2C_BusSpeed;
+
+#define I2C_BUS_SPEED_STANDARD 100000
+#define I2C_BUS_SPEED_FAST 400000
+#define I2C_BUS_SPEED_FAST_PLUS 1000000
+
+int I2CMaster_Open(I2C_InterfaceId id);
+
+int I2CMaster_SetBusSpeed(int fd, I2C_BusSpeed speedInHz);
+
+int I2CMaster_SetTimeout(int fd, uint32_t timeoutInMs);
+
+ssize_t I2CMaster_Write(int fd, I2C_DeviceAddress address, const uint8_t* data, size_t length);
+
+ssize_t I2CMaster_WriteThenRead(int fd, I2C_DeviceAddress address, const uint8_t* writeData,
+	size_t lenWriteData, uint8_t* readData, size_t lenReadData);
+
+ssize_t I2CMaster_Read(int fd, I2C_DeviceAddress address, uint8_t* buffer, size_t maxLength);
@@ -0,0 +1,6 @@
+#pragma once
+
+// Host stand-in for the Azure Sphere applibs log API. Log_Debug writes to stderr when the
+// HOST_LOG_DEBUG environment variable is set and is silent otherwise, so that test output is
+// not buried under the driver's expected error messages.
+int Log_Debug(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -0,0 +1,20 @@
+#include <applibs/log.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int Log_Debug(const char* fmt, ...) {
+	static int enabled = -1;
+	if (enabled < 0) {
+		enabled = getenv("HOST_LOG_DEBUG") != NULL;
+	}
+	if (!enabled) {
+		return 0;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	int result = vfprintf(stderr, fmt, args);
+	va_end(args);
+	return result;
+}
@@ -37,6 +37,8 @@
 #include <hw/sample_hardware.h>
 
 #include "epoll_timerfd_utilities.h"
+#include "button_input.h"
+#include "deferred_work.h"
 
 // Azure IoT SDK
 #include <iothub_client_core_common.h>
@@ -54,36 +56,97 @@ extern volatile sig_atomic_t terminationRequired = false;
 #include "mt3620_avnet_dev.h"
 #include "SoilSensor\i2cAccess.h"
 #include "SoilSensor\SoilMoistureI2cSensor.h"
+#include "SoilSensor\SoilSensorSampler.h"
+#include "SoilSensor\SoilSensorMeasurement.h"
+#include "SoilSensor\SoilSensorPower.h"
+#include "SoilSensor\SoilSensorLightMeasurement.h"
+#include "SoilSensor\SoilSensorSampleCache.h"
+#include "SoilSensor\SoilSensorFilter.h"
+#include "SoilSensor\SoilSensorHealth.h"
+#include "SoilSensor\SoilSensorRegistry.h"
 #include "RelayClick\relay.h"
 #include "time_utilities.h"
+#include "number_format.h"
+#include "telemetry_encoder.h"
+#include "telemetry_batch.h"
+#include "telemetry_deadband.h"
+#include "telemetry_journal.h"
+#include "message_pool.h"
 
 // File descriptor - initialized to invalid value
 int i2cFd = -1;
-// Default i2c addresses, update if customized.
-static const I2C_DeviceAddress SoilMoistureI2cDefaultAddress1 = 0x20;
-static const I2C_DeviceAddress SoilMoistureI2cDefaultAddress2 = 0x21;
+// Address of the water tank sensor, update if customized. All other sensors measure soil.
 static const I2C_DeviceAddress WaterTankI2cDefaultAddress = 0x22;
 
-static const I2C_DeviceAddress moistureSensorsAddresses[3] = 
-{ 
-	SoilMoistureI2cDefaultAddress1, 
-	SoilMoistureI2cDefaultAddress2, 
-	WaterTankI2cDefaultAddress 
-};
-
-static char temperatureSensorNames[3][21] = 
-{
-	"Temperature1", 
-	"Temperature2", 
-	"TemperatureWaterTank"
-};
-
-static char capacitanceSensorNames[3][21] =
-{
-	"Capacitance1",
-	"Capacitance2",
-	"CapacitanceWaterTank"
-};
+// Sensors found on the bus at startup or by RescanSoilSensorsCommand. The sensor directly on the
+// bus at WaterTankI2cDefaultAddress measures the water tank, all others measure soil.
+static SoilSensorRegistry soilSensorRegistry;
+static int DiscoverSoilMoistureSensors(bool resetSensors);
+static int StartSoilSensorSampling(void);
+static void StopSoilSensorSampling(void);
+static void ContinueWithoutSoilSensors(const char* propertyName, const char* reason);
+static void RescanSoilSensorsWork(void* context);
+
+// Address change requested by ChangeSoilSensorAddressCommand, freed by the deferred work.
+typedef struct SoilSensorAddressChange {
+	I2C_DeviceAddress originAddress;
+	I2C_DeviceAddress desiredAddress;
+} SoilSensorAddressChange;
+static void ChangeSoilSensorAddressWork(void* context);
+static void ReportSoilSensorProperties(void);
+
+// Latest reading of each sensor, shared by the watering decision and telemetry. The watering
+// decision tolerates one missed sampling period, telemetry two telemetry periods.
+static SoilSensorSampleCache soilSensorSampleCache;
+static const struct timespec soilSensorSamplePeriod = { 1, 0 };
+static const long SoilSensorControlMaxAgeMs = 2500;
+static const long SoilSensorTelemetryMaxAgeMs = 10000;
+
+// Capacitance filter of each sensor in soilSensorRegistry. Samples are filtered before they
+// are cached, so that a single noise spike, e.g. from the pump, cannot trigger watering.
+static SoilSensorFilter soilSensorCapacitanceFilters[SOILSENSOR_REGISTRY_MAX_SENSORS];
+
+// Recovery ladder of each sensor in soilSensorRegistry, advanced by whoever samples the sensors.
+// A failing sensor is retried, reset and then quarantined while the others keep running.
+static SoilSensorHealth soilSensorHealth[SOILSENSOR_REGISTRY_MAX_SENSORS];
+
+// Define SOIL_SENSOR_SAMPLING_THREAD to read the sensors on a worker thread which owns the
+// I2C bus. Otherwise the sensors are measured concurrently from the event loop, with the
+// conversion wait driven by soft timers.
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+static SoilSensorSampleRing soilSensorSampleRing;
+static int soilSensorSamplerFd = -1;
+static void SoilSensorSamplerEventHandler(EventData* eventData);
+static EventData soilSensorSamplerEventData = { .eventHandler = &SoilSensorSamplerEventHandler };
+#else
+static void SoilSensorMeasurementCompleted(SoilSensorMeasurement* measurement,
+	SoilSensorMeasurementStatus status, const SoilSensorSample* sample);
+static SoilSensorMeasurement soilSensorMeasurements[SOILSENSOR_REGISTRY_MAX_SENSORS];
+static void UpdateSoilSensorHealthFromEventLoop(int sensorIndex, bool ok);
+#endif
+static void StoreSoilSensorSample(const SoilSensorSample* sample);
+static bool GetSoilSensorSample(int sensorIndex, long maxAgeMs, SoilSensorSample* sample);
+static bool GetSoilSensorCapacitance(int sensorIndex, uint16_t* capacitance);
+
+// Sleep state and awake time of each sensor in soilSensorRegistry. With soilSensorSleepEnabled,
+// set by the SoilSensorSleepSetting twin property, sensors sleep between their samples.
+static SoilSensorPowerState soilSensorPowerStates[SOILSENSOR_REGISTRY_MAX_SENSORS];
+static bool soilSensorSleepEnabled = false;
+static void WakeAllSoilSensors(void);
+
+// Latest light reading of each sensor, taken every soilSensorLightPeriod while the lamp is off.
+// Sensor light readings are higher the darker it is.
+static SoilSensorSampleCache soilSensorLightCache;
+static const struct timespec soilSensorLightPeriod = { 60, 0 };
+static const long SoilSensorLightMaxAgeMs = 3 * 60 * 1000;
+static bool GetAmbientLight(uint16_t* light);
+static bool IsAmbientLightSufficient(void);
+#ifndef SOIL_SENSOR_SAMPLING_THREAD
+static void SoilSensorLightMeasured(SoilSensorLightMeasurement* measurement, int sensorIndex,
+	const SoilSensorSample* sample);
+static SoilSensorLightMeasurement soilSensorLightMeasurement;
+static bool soilSensorLightDue = true;
+#endif
 
 // Relay Click definitions and variables.
 static int relay1PinFd = -1;  //relay #1
@@ -102,6 +165,7 @@ static int Relay1PulseGraceSecondsSettingValue = -1;
 static bool relay1InGracePeriod = false;
 static int SoilMoistureCapacitanceThresholdSettingValue = -1;
 static int WaterTankCapacitanceThresholdSettingValue = -1;
+static int AmbientLightThresholdSettingValue = -1;
 
 // Azure IoT Hub/Central defines.
 #define SCOPEID_LENGTH 20
@@ -114,6 +178,8 @@ static bool iothubAuthenticated = false;
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
 static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
                          size_t payloadSize, void *userContextCallback);
+static void TwinUpdateWork(void *context);
+static void ReleaseTwinPayload(char* json);
 static void ParseHourMinuteFromJson(JSON_Object* Relay2OnTimeSetting, int *hours, int *minutes);
 static void EnableRelay2WorkingHours(void);
 static void SendTelemetryRelay1(void);
@@ -125,7 +191,50 @@ static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason
 static const char *getAzureSphereProvisioningResultString(
     AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
 static void SendTelemetry(const unsigned char *key, const unsigned char *value);
+static void SendTelemetryFixedPoint(const char *key, int32_t value, int decimals);
+static void SendTelemetryMessage(const uint8_t *data, size_t length, const TelemetryEncoder *encoder, void *context);
+static int SendIoTHubMessage(const uint8_t *data, size_t length, const TelemetryEncoder *encoder,
+                             int64_t creationTime, void *context);
+static void FlushTelemetry(TelemetryBatchFlushReason reason);
+static size_t SetTelemetryMaxMessageSize(size_t maxSize);
 static void SetupAzureClient(void);
+
+// Telemetry is collected into one message per Azure tick, together with the relay states.
+// Items queued between ticks, such as events, are sent at the latest after telemetryBatchMaxDelay.
+// The maximum message size is set by the TelemetryBatchMaxSizeSetting twin property and capped
+// to a journal record while the journal is open. The encoding, Json or the more compact Cbor, is
+// set by TelemetryEncodingSetting.
+static TelemetryBatch telemetryBatch;
+static const size_t TelemetryBatchDefaultMaxSize = 512;
+static const struct timespec telemetryBatchMaxDelay = { 1, 0 };
+
+// Readings and relay states are only sent when they moved past their deadband, or after the
+// heartbeat interval. The deadbands are set by the CapacitanceDeadbandSetting and
+// TemperatureDeadbandSetting (tenths of a degree) twin properties, the heartbeat of all signals
+// by TelemetryHeartbeatSecondsSetting. Every signal is sent again after IoT Hub authentication.
+static TelemetryDeadbandPolicy capacitanceTelemetryPolicy = { .deadband = 5, .heartbeatMs = 10 * 60 * 1000 };
+static TelemetryDeadbandPolicy temperatureTelemetryPolicy = { .deadband = 5, .heartbeatMs = 10 * 60 * 1000 };
+static TelemetryDeadbandPolicy relayStateTelemetryPolicy = { .deadband = 0, .heartbeatMs = 10 * 60 * 1000 };
+static TelemetrySignal soilSensorCapacitanceSignals[SOILSENSOR_REGISTRY_MAX_SENSORS];
+static TelemetrySignal soilSensorTemperatureSignals[SOILSENSOR_REGISTRY_MAX_SENSORS];
+static TelemetrySignal relay1StateSignal;
+static TelemetrySignal relay2StateSignal;
+static void ResetTelemetrySignals(void);
+
+// Telemetry produced while IoT Hub is unreachable, or while older telemetry still waits, is
+// appended to a journal in mutable storage. Once authenticated, up to TelemetryJournalReplayPerTick
+// records are replayed every telemetryJournalReplayPeriod, with their creation time.
+static TelemetryJournal telemetryJournal;
+static int telemetryJournalFd = -1;
+
+// Buffers for Device Twin updates, reported properties and command contexts, so that the steady
+// state of the message path does not allocate on the heap.
+static MessagePool messagePool;
+// Device Twin documents too large for the pool, e.g. the full twin on connect, copied to the heap.
+static uint32_t twinPayloadHeapCount = 0;
+static const struct timespec telemetryJournalReplayPeriod = { 1, 0 };
+static const int TelemetryJournalReplayPerTick = 4;
+static void JournalTelemetryMessage(const uint8_t* data, size_t length, const TelemetryEncoder* encoder);
 static void SendTelemetryMoisture(void);
 
 // Initialization/Cleanup
@@ -133,6 +242,8 @@ static int InitPeripheralsAndHandlers(void);
 static void InitializeSoilMoistureSensors(void);
 static void HubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void* userContextCallback);
 static void SendDeviceAuthenticatedEvent(void);
+static void HubAuthenticatedWork(void* context);
+static void Relay1PulseCommandWork(void* context);
 static void GetMoistureSensorsInfo(void);
 static int DirectMethodCall(const char* methodName, const char* payload, size_t payloadSize, char** responsePayload, size_t* responsePayloadSize);
 static void InitializeRelays(void);
@@ -148,12 +259,26 @@ static int deviceTwinStatusLedGpioFd = -1;
 static bool statusLedOn = false;
 
 // Timer / polling
-static int relayPollTimerFd = -1;
-static int pulse1OneShotTimerFd = -1;
-static int relay1GracePeriodTimerFd = -1;
-static int buttonPollTimerFd = -1;
-static int azureTimerFd = -1;
+static int timerWheelFd = -1;
+static int deferredWorkFd = -1;
 static int epollFd = -1;
+static TimerWheel timerWheel;
+
+// Work queued by IoT Hub SDK callbacks, run from the event loop outside of
+// IoTHubDeviceClient_LL_DoWork.
+static DeferredWorkQueue deferredWork;
+
+// Startup critical path milestones in ms since main() was entered, -1 until reached.
+static struct timespec appStartTime;
+static long sensorsReadyMs = -1;
+static long eventLoopStartMs = -1;
+static long firstSampleMs = -1;
+static long firstTelemetryMs = -1;
+static void RecordStartupMilestone(long* milestoneMs, const char* name);
+
+// Event loop statistics, updated once per epoll wakeup.
+static unsigned long eventLoopWakeups = 0;
+static unsigned long eventLoopEventsDispatched = 0;
 
 // Azure IoT poll periods
 static const int AzureIoTDefaultPollPeriodSeconds = 5;
@@ -164,14 +289,14 @@ static int azureIoTPollPeriodSeconds = -1;
 
 static void SetRelayStates(RELAY* relaysPointer);
 
-// Button state variables
-static GPIO_Value_Type sendMessageButtonState = GPIO_Value_High;
-static GPIO_Value_Type sendOrientationButtonState = GPIO_Value_High;
-
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState);
 static void SendMessageButtonHandler(void);
 static void SendOrientationButtonHandler(void);
-static void ChangeSoilMoistureI2cAddress(I2C_DeviceAddress originAddress, I2C_DeviceAddress desiredAddress);
+
+// Debounced button inputs. The MT3620 GPIOs provide no edge source, so edgeFd is -1 and the
+// buttons are scanned at the idle rate.
+static ButtonInput sendMessageButton = { .pressedHandler = &SendMessageButtonHandler, .edgeFd = -1 };
+static ButtonInput sendOrientationButton = { .pressedHandler = &SendOrientationButtonHandler, .edgeFd = -1 };
+static I2CStatus ChangeSoilMoistureI2cAddress(I2C_DeviceAddress originAddress, I2C_DeviceAddress desiredAddress);
 static void PulseRelay1(void);
 static bool HasRelay1PulseGraceSecondsSettingValueBeenUpdated(void);
 static bool HasSoilMoistureCapacitanceThresholdSettingValueBeenUpdated(void);
@@ -183,22 +308,60 @@ static void RelayPollTimerEventHandler(EventData* eventData);
 int MinutesFromHoursAndMinutes(int* hours, int* minutes);
 static void Pulse1TimerEventHandler(EventData* eventData);
 static void Relay1GracePeriodTimerEventHandler(EventData* eventData);
-static void ButtonPollTimerEventHandler(EventData* eventData);
 static void AzureTimerEventHandler(EventData *eventData);
+static void TelemetryBatchTimerEventHandler(EventData* eventData);
+static void TelemetryJournalReplayTimerEventHandler(EventData* eventData);
+static void SoilSensorLightTimerEventHandler(EventData* eventData);
+#ifndef SOIL_SENSOR_SAMPLING_THREAD
+static void SoilSensorMeasurementTimerEventHandler(EventData* eventData);
+#endif
+
+// Soft timers served by timerWheel. Only the event handler field needs to be populated.
+static SoftTimer relayPollTimer = { .eventData = { .eventHandler = &RelayPollTimerEventHandler } };
+static SoftTimer pulse1OneShotTimer = { .eventData = { .eventHandler = &Pulse1TimerEventHandler } };
+static SoftTimer relay1GracePeriodTimer = { .eventData = { .eventHandler = &Relay1GracePeriodTimerEventHandler } };
+static SoftTimer azureTimer = { .eventData = { .eventHandler = &AzureTimerEventHandler } };
+static SoftTimer telemetryBatchTimer = { .eventData = { .eventHandler = &TelemetryBatchTimerEventHandler } };
+static SoftTimer telemetryJournalReplayTimer = { .eventData = { .eventHandler = &TelemetryJournalReplayTimerEventHandler } };
+static SoftTimer soilSensorLightTimer = { .eventData = { .eventHandler = &SoilSensorLightTimerEventHandler } };
+#ifndef SOIL_SENSOR_SAMPLING_THREAD
+static SoftTimer soilSensorMeasurementTimer = { .eventData = { .eventHandler = &SoilSensorMeasurementTimerEventHandler } };
+#endif
+
+// Event handlers whose dispatch stats are reported by GetEventStatsCommand and logged on exit.
+static const struct {
+	const char* name;
+	const EventData* eventData;
+} eventStatsSources[] = {
+	{ "RelayPoll", &relayPollTimer.eventData },
+	{ "Pulse1", &pulse1OneShotTimer.eventData },
+	{ "Relay1GracePeriod", &relay1GracePeriodTimer.eventData },
+	{ "Azure", &azureTimer.eventData },
+	{ "TelemetryBatch", &telemetryBatchTimer.eventData },
+	{ "TelemetryJournalReplay", &telemetryJournalReplayTimer.eventData },
+	{ "SoilSensorLight", &soilSensorLightTimer.eventData },
+#ifndef SOIL_SENSOR_SAMPLING_THREAD
+	{ "SoilSensorMeasurement", &soilSensorMeasurementTimer.eventData },
+#endif
+	{ "SendMessageButton", &sendMessageButton.sampleTimer.eventData },
+	{ "SendOrientationButton", &sendOrientationButton.sampleTimer.eventData },
+	{ "TimerWheel", &timerWheel.eventData },
+	{ "DeferredWork", &deferredWork.eventData },
+};
+// Sensor power, health and I2C stats read by SerializeEventStats and LogAllEventStats. While the
+// sampler thread owns the bus, they are copied from the snapshot it publishes after every pass.
+static SoilSensorSamplerSnapshot soilSensorStats;
+static const SoilSensorSamplerSnapshot* GetSoilSensorStats(void);
 
-// Event handler data structures. Only the event handler field needs to be populated.
-static EventData relayPollEventData = { .eventHandler = &RelayPollTimerEventHandler };
-static EventData pulse1EventData = { .eventHandler = &Pulse1TimerEventHandler };
-static EventData relay1GracePeriodEventData = { .eventHandler = &Relay1GracePeriodTimerEventHandler };
-static EventData buttonPollEventData = { .eventHandler = &ButtonPollTimerEventHandler };
-static EventData azureEventData = { .eventHandler = &AzureTimerEventHandler };
-
-// A null period to not start the timer when it is created with CreateTimerFdAndAddToEpoll.
-static const struct timespec nullPeriod = { 0, 0 };
+static char* SerializeEventStats(void);
+static void LogAllEventStats(void);
 
 // Method identifiers
 static const char Relay1PulseCommandName[] = "Relay1PulseCommand";
 static const char Relay2PulseCommandName[] = "Relay2PulseCommand";
+static const char GetEventStatsCommandName[] = "GetEventStatsCommand";
+static const char RescanSoilSensorsCommandName[] = "RescanSoilSensorsCommand";
+static const char ChangeSoilSensorAddressCommandName[] = "ChangeSoilSensorAddressCommand";
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -214,6 +377,7 @@ static void TerminationHandler(int signalNumber)
 /// </summary>
 int main(int argc, char *argv[])
 {
+    clock_gettime(CLOCK_MONOTONIC, &appStartTime);
     Log_Debug("IoT Hub/Central Application starting.\n");
 
     if (argc == 2) {
@@ -232,13 +396,22 @@ int main(int argc, char *argv[])
         terminationRequired = true;
     }
 
+    RecordStartupMilestone(&eventLoopStartMs, "Event loop start");
+
     // Main loop
     while (!terminationRequired) {
-        if (WaitForEventAndCallHandler(epollFd) != 0) {
+        int eventsDispatched = 0;
+        if (WaitForEventsAndCallHandlers(epollFd, &eventsDispatched) != 0) {
             terminationRequired = true;
         }
+        eventLoopWakeups++;
+        eventLoopEventsDispatched += (unsigned long)eventsDispatched;
     }
 
+    Log_Debug("Event loop: %lu wakeups, %lu events dispatched.\n", eventLoopWakeups,
+              eventLoopEventsDispatched);
+    LogAllEventStats();
+
     ClosePeripheralsAndHandlers();
 
     Log_Debug("Application exiting.\n");
@@ -253,35 +426,22 @@ void SetRelayStates(RELAY* relaysPointer)
 	else
 		GPIO_SetValue(relay1PinFd, GPIO_Value_Low);
 
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+	// The motor generates a lot of noise, see project description.
+	PauseSoilSensorSampler(relaysPointer->relay1_status == 1);
+#endif
+
 	if (relaysPointer->relay2_status == 1)
 		GPIO_SetValue(relay2PinFd, GPIO_Value_High);
 	else
 		GPIO_SetValue(relay2PinFd, GPIO_Value_Low);
 }
 
-/// <summary>
-/// Button timer event:  Check the status of buttons A and B
-/// </summary>
-static void ButtonPollTimerEventHandler(EventData *eventData)
-{
-    if (ConsumeTimerFdEvent(buttonPollTimerFd) != 0) {
-        terminationRequired = true;
-        return;
-    }
-    SendMessageButtonHandler();
-    SendOrientationButtonHandler();
-}
-
 /// <summary>
 /// Relay timer event: Timer elapsed, evaluate and toggle relays.
 /// </summary>
 static void RelayPollTimerEventHandler(EventData* eventData)
 {
-	if (ConsumeTimerFdEvent(relayPollTimerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
 	//Log_Debug("RelayPollTimerEventHandler\n");
 	if (iothubAuthenticated) 
 	{
@@ -299,17 +459,11 @@ int MinutesFromHoursAndMinutes(int* hours, int* minutes) {
 /// </summary>
 static void Pulse1TimerEventHandler(EventData* eventData)
 {
-	if (ConsumeTimerFdEvent(pulse1OneShotTimerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
 	Log_Debug("Pulse1TimerEventHandler\n");
 	relaystate(relaysState, relay1_clr);
 	SendTelemetryRelay1();
 	struct timespec relay1GracePeriodSeconds = { Relay1PulseGraceSecondsSettingValue, 0 };
-	SetTimerFdToSingleExpiry(relay1GracePeriodTimerFd, &relay1GracePeriodSeconds);
-	if (relay1GracePeriodTimerFd > 0)
+	if (SetSoftTimerToSingleExpiry(&timerWheel, &relay1GracePeriodTimer, &relay1GracePeriodSeconds) == 0)
 	{
 		relay1InGracePeriod = true;
 	}
@@ -320,11 +474,6 @@ static void Pulse1TimerEventHandler(EventData* eventData)
 /// </summary>
 static void Relay1GracePeriodTimerEventHandler(EventData* eventData)
 {
-	if (ConsumeTimerFdEvent(relay1GracePeriodTimerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
 	Log_Debug("Relay1GracePeriodTimerEventHandler\n");
 	relay1InGracePeriod = false;
 }
@@ -346,21 +495,36 @@ static void PulseRelay1(void)
 		&& HasSoilMoistureCapacitanceThresholdSettingValueBeenUpdated()
 		&& HasWaterTankCapacitanceThresholdSettingValueBeenUpdated())
 	{
-		// Water tank empty?
-		if (GetCapacitance(moistureSensorsAddresses[2]) > WaterTankCapacitanceThresholdSettingValue) {
-			// Plant 1 or 2 dry?
-			if ((GetCapacitance(moistureSensorsAddresses[0]) < SoilMoistureCapacitanceThresholdSettingValue)
-				|| (GetCapacitance(moistureSensorsAddresses[1]) < SoilMoistureCapacitanceThresholdSettingValue))
+		bool waterTankHasWater = false;
+		bool plantIsDry = false;
+
+		for (int i = 0; i < soilSensorRegistry.count; i++)
+		{
+			uint16_t capacitance;
+			if (!GetSoilSensorCapacitance(i, &capacitance))
 			{
-				struct timespec pulse1DurationSeconds = { Relay1PulseSecondsSettingValue, 0 };
-				SetTimerFdToSingleExpiry(pulse1OneShotTimerFd, &pulse1DurationSeconds);
-				if (pulse1OneShotTimerFd > 0)
-				{
-					relaystate(relaysState, relay1_set);
-					SendTelemetry("WaterEvent", "True");
-					SendTelemetryRelay1();
-					return;
-				}
+				continue;
+			}
+			if (soilSensorRegistry.roles[i] == SoilSensorRole_WaterTank)
+			{
+				waterTankHasWater = capacitance > WaterTankCapacitanceThresholdSettingValue;
+			}
+			else if (capacitance < SoilMoistureCapacitanceThresholdSettingValue)
+			{
+				plantIsDry = true;
+			}
+		}
+
+		// Water tank not empty and any plant dry?
+		if (waterTankHasWater && plantIsDry)
+		{
+			struct timespec pulse1DurationSeconds = { Relay1PulseSecondsSettingValue, 0 };
+			if (SetSoftTimerToSingleExpiry(&timerWheel, &pulse1OneShotTimer, &pulse1DurationSeconds) == 0)
+			{
+				relaystate(relaysState, relay1_set);
+				SendTelemetry("WaterEvent", "True");
+				SendTelemetryRelay1();
+				return;
 			}
 		}
 	}
@@ -388,7 +552,52 @@ static bool HasWaterTankCapacitanceThresholdSettingValueBeenUpdated(void) {
 }
 
 /// <summary>
-/// Turn on lamp using relay #2 if daytime.
+/// Get the median light reading of the soil sensors, leaving out the water tank sensor.
+/// </summary>
+/// <returns>false if no sensor has a recent light reading</returns>
+static bool GetAmbientLight(uint16_t* light)
+{
+	uint16_t lights[SOILSENSOR_REGISTRY_MAX_SENSORS];
+	int count = 0;
+
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		SoilSensorSample sample;
+		if (soilSensorRegistry.roles[i] == SoilSensorRole_Soil
+			&& GetCachedSoilSensorSample(&soilSensorLightCache, i, SoilSensorLightMaxAgeMs, &sample))
+		{
+			// Insertion sort, there are only a few sensors.
+			int j = count++;
+			for (; j > 0 && lights[j - 1] > sample.light; j--)
+			{
+				lights[j] = lights[j - 1];
+			}
+			lights[j] = sample.light;
+		}
+	}
+	if (count == 0)
+	{
+		return false;
+	}
+	*light = lights[count / 2];
+	return true;
+}
+
+/// <summary>
+/// Is there enough daylight for the lamp to stay off? Only known once the threshold was set
+/// from IoT Central and the sensors were read recently.
+/// </summary>
+static bool IsAmbientLightSufficient(void)
+{
+	uint16_t light;
+	return AmbientLightThresholdSettingValue > -1
+		&& GetAmbientLight(&light)
+		&& light <= AmbientLightThresholdSettingValue;
+}
+
+/// <summary>
+/// Turn on lamp using relay #2 if daytime and too dark. The lamp lights the sensors too, so
+/// once on it stays on until the working hours end.
 /// </summary>
 static void SwitchOnLampAtDayTime(void)
 {
@@ -414,8 +623,8 @@ static void SwitchOnLampAtDayTime(void)
 			}
 			
 		}
-		// Between working hours, switch on if not already on.
-		else if(!relaystate(relaysState, relay2_rd))
+		// Between working hours, switch on if not already on and too dark.
+		else if(!relaystate(relaysState, relay2_rd) && !IsAmbientLightSufficient())
 		{
 			relaystate(relaysState, relay2_set);
 			SendTelemetry("LightOnEvent", "True");
@@ -425,15 +634,11 @@ static void SwitchOnLampAtDayTime(void)
 }
 
 /// <summary>
-/// Azure timer event:  Check connection status and send telemetry
+/// Azure timer event:  Check connection status and send the readings and relay states as one
+/// telemetry message, or journal them while not connected
 /// </summary>
 static void AzureTimerEventHandler(EventData* eventData)
 {
-	if (ConsumeTimerFdEvent(azureTimerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
 	bool isNetworkReady = false;
 	if (Networking_IsNetworkingReady(&isNetworkReady) != -1) {
 		if (isNetworkReady && !iothubAuthenticated) {
@@ -444,10 +649,62 @@ static void AzureTimerEventHandler(EventData* eventData)
 		Log_Debug("Failed to get Network state\n");
 	}
 
-	if (iothubAuthenticated) {
+	if (iothubAuthenticated || telemetryJournalFd >= 0) {
 		SendTelemetryMoisture();
+		SendTelemetryRelay1();
+		SendTelemetryRelay2();
+		FlushTelemetry(TelemetryBatchFlushReason_Tick);
+	}
+	if (iothubAuthenticated) {
+		IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+	}
+}
+
+/// <summary>
+/// Telemetry batch timer event: Items queued between Azure ticks waited long enough, send them.
+/// </summary>
+static void TelemetryBatchTimerEventHandler(EventData* eventData)
+{
+	FlushTelemetry(TelemetryBatchFlushReason_Deadline);
+	if (iothubAuthenticated) {
+		IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+	}
+}
+
+/// <summary>
+/// Telemetry journal replay timer event: Forward a few journaled messages while connected, as
+/// long as too many are not awaiting confirmation, and store which were confirmed.
+/// </summary>
+static void TelemetryJournalReplayTimerEventHandler(EventData* eventData)
+{
+	if (!iothubAuthenticated || telemetryJournalFd < 0)
+	{
+		return;
+	}
+
+	static TelemetryJournalRecord record;
+	int sent = 0;
+	while (sent < TelemetryJournalReplayPerTick && ReadNextTelemetryJournalRecord(&telemetryJournal, &record))
+	{
+		const TelemetryEncoder* encoder = GetTelemetryEncoder((TelemetryEncoding)record.format);
+		if (encoder == NULL)
+		{
+			Log_Debug("WARNING: Journaled telemetry %u has unknown encoding %u, skipping it\n", record.sequence, record.format);
+			AcknowledgeTelemetryJournalRecord(&telemetryJournal, record.sequence, true);
+			continue;
+		}
+		if (SendIoTHubMessage(record.message, record.length, encoder, record.timestamp, (void*)(uintptr_t)record.sequence) != 0)
+		{
+			AcknowledgeTelemetryJournalRecord(&telemetryJournal, record.sequence, false);
+			break;
+		}
+		sent++;
+	}
+	if (sent > 0)
+	{
 		IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
 	}
+	CommitTelemetryJournal(&telemetryJournal);
 }
 
 /// <summary>
@@ -493,50 +750,86 @@ static int InitPeripheralsAndHandlers(void)
 
 	// Initialize Soil Sensors
 	Log_Debug("Opening ISU2 I2C\n");
-	i2cFd = I2CMaster_Open(MT3620_ISU2_I2C);
-	I2CMaster_SetBusSpeed(i2cFd, I2C_BUS_SPEED_STANDARD);
-	I2CMaster_SetTimeout(i2cFd, 100);
-
-	InitializeSoilMoistureSensors();
-	
-	GetMoistureSensorsInfo();
+	if (OpenI2CBus(MT3620_ISU2_I2C, 100) < 0) {
+		return -1;
+	}
 
-	// Uncomment to change address of sensor.
-	//ChangeSoilMoistureI2cAddress(SoilMoistureI2cDefaultAddress1, WaterTankI2cDefaultAddress);
+	// Without sensors the device keeps running, so that RescanSoilSensorsCommand can find them later.
+	if (DiscoverSoilMoistureSensors(true) != 0) {
+		ContinueWithoutSoilSensors("SoilSensorRescan", "No sensors found");
+	}
+	else if (StartSoilSensorSampling() != 0) {
+		ContinueWithoutSoilSensors("SoilSensorRescan", "Sampling failed");
+	}
 
 	relaysState = open_relay(SetRelayStates, InitializeRelays);
-	// Set up relay check interval.
-	struct timespec relay1CheckPeriod = { Relay1DefaultPollPeriodSeconds, 0 };
-	relayPollTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &relay1CheckPeriod, &relayPollEventData, EPOLLIN);
-	if (relayPollTimerFd < 0) {
+
+	// Set up the timer wheel serving all soft timers. The one-shot timers for pulse 1 and
+	// relay 1 grace period are armed on demand.
+	timerWheelFd = CreateTimerWheelAndAddToEpoll(epollFd, &timerWheel, EPOLLIN);
+	if (timerWheelFd < 0) {
+		return -1;
+	}
+
+	InitMessagePool(&messagePool);
+	InitTelemetryBatch(&telemetryBatch, TelemetryBatchDefaultMaxSize, GetTelemetryEncoder(TelemetryEncoding_Json),
+		&SendTelemetryMessage, NULL);
+
+	// Open the offline telemetry journal. Without mutable storage telemetry is sent live only.
+	telemetryJournalFd = Storage_OpenMutableFile();
+	if (telemetryJournalFd < 0) {
+		Log_Debug("WARNING: Could not open mutable storage, telemetry is not journaled: %s (%d)\n", strerror(errno), errno);
+	}
+	else if (OpenTelemetryJournal(&telemetryJournal, telemetryJournalFd) != 0) {
+		Log_Debug("WARNING: Could not read the telemetry journal, telemetry is not journaled: %s (%d)\n", strerror(errno), errno);
+		CloseFdAndPrintError(telemetryJournalFd, "TelemetryJournal");
+		telemetryJournalFd = -1;
+	}
+	else {
+		Log_Debug("INFO: Telemetry journal holds %u messages to forward\n", GetTelemetryJournalPendingCount(&telemetryJournal));
+		SetTelemetryMaxMessageSize(TelemetryBatchDefaultMaxSize);
+		if (SetSoftTimerToPeriod(&timerWheel, &telemetryJournalReplayTimer, &telemetryJournalReplayPeriod) != 0) {
+			return -1;
+		}
+	}
+
+	// Set up the queue for work deferred from IoT Hub SDK callbacks.
+	deferredWorkFd = CreateDeferredWorkQueueAndAddToEpoll(epollFd, &deferredWork);
+	if (deferredWorkFd < 0) {
+		return -1;
+	}
+
+#ifndef SOIL_SENSOR_SAMPLING_THREAD
+	// Set up the sensor measurement interval.
+	if (SetSoftTimerToPeriod(&timerWheel, &soilSensorMeasurementTimer, &soilSensorSamplePeriod) != 0) {
 		return -1;
 	}
+#endif
 
-	// Set up a one-shot timer for pulse 1.
-	pulse1OneShotTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &nullPeriod, &pulse1EventData, EPOLLIN);
-	if (pulse1OneShotTimerFd < 0) {
+	// Set up the light measurement interval. The first measurement starts with sampling.
+	if (SetSoftTimerToPeriod(&timerWheel, &soilSensorLightTimer, &soilSensorLightPeriod) != 0) {
 		return -1;
 	}
 
-	// Set up a one-shot timer for realy 1 grace period.
-	relay1GracePeriodTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &nullPeriod, &relay1GracePeriodEventData, EPOLLIN);
-	if (relay1GracePeriodTimerFd < 0) {
+	// Set up relay check interval.
+	struct timespec relay1CheckPeriod = { Relay1DefaultPollPeriodSeconds, 0 };
+	if (SetSoftTimerToPeriod(&timerWheel, &relayPollTimer, &relay1CheckPeriod) != 0) {
 		return -1;
 	}
 
-    // Set up a timer to poll for button events.
-    struct timespec buttonPressCheckPeriod = {0, 1000 * 1000};
-    buttonPollTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod, &buttonPollEventData, EPOLLIN);
-    if (buttonPollTimerFd < 0) {
+    // Start edge detection and debouncing for buttons A and B.
+    sendMessageButton.gpioFd = sendMessageButtonGpioFd;
+    if (StartButtonInput(epollFd, &timerWheel, &sendMessageButton) != 0) {
+        return -1;
+    }
+    sendOrientationButton.gpioFd = sendOrientationButtonGpioFd;
+    if (StartButtonInput(epollFd, &timerWheel, &sendOrientationButton) != 0) {
         return -1;
     }
 
     azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
     struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-    azureTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &azureTelemetryPeriod, &azureEventData, EPOLLIN);
-    if (azureTimerFd < 0) {
+    if (SetSoftTimerToPeriod(&timerWheel, &azureTimer, &azureTelemetryPeriod) != 0) {
         return -1;
     }
 
@@ -546,15 +839,214 @@ static int InitPeripheralsAndHandlers(void)
     return 0;
 }
 
+/// <summary>
+///     Reset all soil sensors together and wait until they report not busy, at most 1 s.
+/// </summary>
 void InitializeSoilMoistureSensors(void)
 {
-	InitializeSoilSensor(SoilMoistureI2cDefaultAddress1, true);
-	InitializeSoilSensor(SoilMoistureI2cDefaultAddress2, true);
-	InitializeSoilSensor(WaterTankI2cDefaultAddress, true);
+	int readyCount = InitializeSoilSensors(soilSensorRegistry.addresses, soilSensorRegistry.count, 1000);
+	Log_Debug("%d of %d soil sensors ready\n", readyCount, soilSensorRegistry.count);
+	RecordStartupMilestone(&sensorsReadyMs, "Soil sensors ready");
+}
+
+/// <summary>
+///     Scan the bus for soil sensors, optionally reset them, and seed the sample cache. The
+///     I2C bus must not be owned by the sampler thread.
+/// </summary>
+/// <returns>0 on success, -1 if no sensor was found</returns>
+static int DiscoverSoilMoistureSensors(bool resetSensors)
+{
+	if (ScanSoilSensors(&soilSensorRegistry, WaterTankI2cDefaultAddress) == 0)
+	{
+		Log_Debug("ERROR: No soil sensors found\n");
+		return -1;
+	}
+
+	if (resetSensors)
+	{
+		InitializeSoilMoistureSensors();
+	}
+	InitSoilSensorSampleCache(&soilSensorSampleCache, soilSensorRegistry.addresses, soilSensorRegistry.count);
+	InitSoilSensorSampleCache(&soilSensorLightCache, soilSensorRegistry.addresses, soilSensorRegistry.count);
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		InitSoilSensorPowerState(&soilSensorPowerStates[i]);
+		InitSoilSensorFilter(&soilSensorCapacitanceFilters[i]);
+		InitSoilSensorHealth(&soilSensorHealth[i]);
+	}
+	ResetTelemetrySignals();
+	GetMoistureSensorsInfo();
+	return 0;
+}
+
+/// <summary>
+///     Start sampling the sensors in soilSensorRegistry, on the sampler thread or from the
+///     event loop.
+/// </summary>
+static int StartSoilSensorSampling(void)
+{
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+	// From here on the sampler thread owns the I2C bus.
+	SetSoilSensorSamplerSleep(soilSensorSleepEnabled);
+	soilSensorSamplerFd = StartSoilSensorSampler(soilSensorRegistry.addresses, soilSensorRegistry.count,
+		&soilSensorSamplePeriod, &soilSensorSampleRing, soilSensorPowerStates, soilSensorHealth);
+	if (soilSensorSamplerFd < 0) {
+		return -1;
+	}
+	if (RegisterEventHandlerToEpoll(epollFd, soilSensorSamplerFd, &soilSensorSamplerEventData, EPOLLIN) != 0) {
+		StopSoilSensorSampler();
+		soilSensorSamplerFd = -1;
+		return -1;
+	}
+	RequestSoilSensorSamplerLight();
+#else
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		soilSensorMeasurements[i].address = soilSensorRegistry.addresses[i];
+		soilSensorMeasurements[i].callback = &SoilSensorMeasurementCompleted;
+		soilSensorMeasurements[i].power = &soilSensorPowerStates[i];
+	}
+	soilSensorLightMeasurement.addresses = soilSensorRegistry.addresses;
+	soilSensorLightMeasurement.powerStates = soilSensorPowerStates;
+	soilSensorLightMeasurement.sensorCount = soilSensorRegistry.count;
+	soilSensorLightMeasurement.callback = &SoilSensorLightMeasured;
+	soilSensorLightDue = true;
+#endif
+	return 0;
+}
+
+/// <summary>
+///     Stop sampling and take the I2C bus back from the sampler thread. Sleeping sensors are
+///     woken, as they would not answer the first transfer of whoever uses the bus next.
+/// </summary>
+static void StopSoilSensorSampling(void)
+{
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+	if (soilSensorSamplerFd >= 0)
+	{
+		UnregisterEventHandlerFromEpoll(epollFd, soilSensorSamplerFd);
+		StopSoilSensorSampler();
+		soilSensorSamplerFd = -1;
+	}
+#else
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		CancelSoilSensorMeasurement(&soilSensorMeasurements[i]);
+	}
+	CancelSoilSensorLightMeasurement(&soilSensorLightMeasurement);
+#endif
+	WakeAllSoilSensors();
+}
+
+/// <summary>
+///     Wake every sleeping sensor and wait until they are up. The I2C bus must not be owned
+///     by the sampler thread.
+/// </summary>
+static void WakeAllSoilSensors(void)
+{
+	static const struct timespec wakePeriod = { 0, SOILMOISTURESENSOR_WAKE_MS * 1000 * 1000 };
+	bool woken = false;
+
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		woken |= WakeManagedSoilSensor(soilSensorRegistry.addresses[i], &soilSensorPowerStates[i]);
+	}
+	if (woken)
+	{
+		nanosleep(&wakePeriod, NULL);
+	}
+}
+
+/// <summary>
+///     Report a failed discovery, rescan or address change and keep running with an empty
+///     registry, so that the device stays reachable for another RescanSoilSensorsCommand. At
+///     startup the IoT Hub client does not exist yet and the failure is only logged.
+/// </summary>
+static void ContinueWithoutSoilSensors(const char* propertyName, const char* reason)
+{
+	Log_Debug("ERROR: %s: %s, continuing without soil sensors\n", propertyName, reason);
+	soilSensorRegistry.count = 0;
+#ifndef SOIL_SENSOR_SAMPLING_THREAD
+	soilSensorLightMeasurement.sensorCount = 0;
+#endif
+	if (iothubClientHandle != NULL)
+	{
+		TwinReportStringState(propertyName, reason);
+	}
+}
+
+/// <summary>
+///     Deferred work for RescanSoilSensorsCommand: discover the sensors again, e.g. after
+///     sensors were added to or removed from the rack.
+/// </summary>
+static void RescanSoilSensorsWork(void* context)
+{
+	StopSoilSensorSampling();
+	if (DiscoverSoilMoistureSensors(true) != 0)
+	{
+		ContinueWithoutSoilSensors("SoilSensorRescan", "No sensors found");
+		return;
+	}
+	if (StartSoilSensorSampling() != 0)
+	{
+		ContinueWithoutSoilSensors("SoilSensorRescan", "Sampling failed");
+		return;
+	}
+	TwinReportStringState("SoilSensorRescan", "Ok");
+	ReportSoilSensorProperties();
+}
+
+/// <summary>
+///     Deferred work for ChangeSoilSensorAddressCommand: take the bus from the sampling
+///     schedule, move the sensor to its new address and refresh the registry in place.
+/// </summary>
+static void ChangeSoilSensorAddressWork(void* context)
+{
+	SoilSensorAddressChange* change = (SoilSensorAddressChange*)context;
+	char result[40];
+
+	StopSoilSensorSampling();
+	I2CStatus status = ChangeSoilMoistureI2cAddress(change->originAddress, change->desiredAddress);
+	snprintf(result, sizeof(result), "0x%02X->0x%02X %s", change->originAddress, change->desiredAddress,
+		I2CStatusToString(status));
+	Log_Debug("Soil sensor address change %s\n", result);
+	ReleaseMessageBuffer(&messagePool, change);
+
+	// The other sensors were not reset, so a scan is enough to pick up the new address.
+	if (DiscoverSoilMoistureSensors(false) != 0)
+	{
+		ContinueWithoutSoilSensors("SoilSensorReaddress", "No sensors found");
+		return;
+	}
+	if (StartSoilSensorSampling() != 0)
+	{
+		ContinueWithoutSoilSensors("SoilSensorReaddress", "Sampling failed");
+		return;
+	}
+	TwinReportStringState("SoilSensorReaddress", result);
+	ReportSoilSensorProperties();
+}
+
+/// <summary>
+///     Record the time since startup at which a milestone was first reached.
+/// </summary>
+static void RecordStartupMilestone(long* milestoneMs, const char* name)
+{
+	if (*milestoneMs >= 0)
+	{
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*milestoneMs = (now.tv_sec - appStartTime.tv_sec) * 1000 + (now.tv_nsec - appStartTime.tv_nsec) / (1000 * 1000);
+	Log_Debug("Startup: %s after %ld ms\n", name, *milestoneMs);
 }
 
 /// <summary>
-///     Allocates and formats a string message on the heap.
+///     Allocates and formats a string message on the heap. Direct method responses are freed by
+///     the Azure IoT Hub SDK, so they cannot come from the message pool; a message longer than
+///     maxLength is truncated and counted in the pool stats.
 /// </summary>
 /// <param name="messageFormat">The format of the message</param>
 /// <param name="maxLength">The maximum length of the formatted message string</param>
@@ -565,8 +1057,8 @@ static void* SetupHeapMessage(const char* messageFormat, size_t maxLength, ...)
 	va_start(args, maxLength);
 	char* message =
 		malloc(maxLength + 1); // Ensure there is space for the null terminator put by vsnprintf.
-	if (message != NULL) {
-		vsnprintf(message, maxLength, messageFormat, args);
+	if (message != NULL && FormatMessageV(&messagePool, message, maxLength + 1, messageFormat, args) < 0) {
+		Log_Debug("WARNING: Direct method response truncated to %zu bytes\n", maxLength);
 	}
 	va_end(args);
 	return message;
@@ -621,9 +1113,9 @@ static int DirectMethodCall(const char* methodName, const char* payload, size_t
 			}
 			*responsePayloadSize = strlen(*responsePayload);
 
-			relaystate(relaysState, relay1_set);
-			TwinReportBoolState("Relay1Setting", relaystate(relaysState, relay1_rd));
-			SendTelemetryRelay1();
+			if (QueueDeferredWork(&deferredWork, &Relay1PulseCommandWork, NULL) != 0) {
+				Log_Debug("ERROR: Could not queue Relay1PulseCommand.\n");
+			}
 			return result;
 		}
 
@@ -684,13 +1176,53 @@ static int DirectMethodCall(const char* methodName, const char* payload, size_t
 				return result;
 			}
 		}
-		else {
-			result = 404;
-			Log_Debug("INFO: Direct Method called \"%s\" not found.\n", methodName);
+		// Move a soil sensor to a new address: {"From": 32, "To": 35}. To is the device address
+		// on the same mux channel as From.
+		else if (strcmp(methodName, ChangeSoilSensorAddressCommandName) == 0) {
 
-			static const char noMethodFound[] = "\"method not found '%s'\"";
-			size_t responseMaxLength = sizeof(noMethodFound) + strlen(methodName);
-			*responsePayload = SetupHeapMessage(noMethodFound, responseMaxLength, methodName);
+			Log_Debug("ChangeSoilSensorAddressCommand() Direct Method called\n");
+
+			memcpy(directMethodCallContent, payload, payloadSize);
+			directMethodCallContent[payloadSize] = 0; // Null terminated string.
+
+			JSON_Value* payloadJson = json_parse_string(directMethodCallContent);
+			JSON_Object* addressJson = json_value_get_object(payloadJson);
+			if (addressJson == NULL
+				|| json_object_get_value(addressJson, "From") == NULL
+				|| json_object_get_value(addressJson, "To") == NULL) {
+				json_value_free(payloadJson);
+				goto payloadError;
+			}
+			I2C_DeviceAddress originAddress = (I2C_DeviceAddress)json_object_get_number(addressJson, "From");
+			I2C_DeviceAddress desiredDeviceAddress = (I2C_DeviceAddress)json_object_get_number(addressJson, "To");
+			json_value_free(payloadJson);
+
+			I2C_DeviceAddress desiredAddress = (originAddress & ~(I2C_DeviceAddress)0x7F) | desiredDeviceAddress;
+			if (FindSoilSensor(&soilSensorRegistry, originAddress) < 0
+				|| desiredDeviceAddress < SOILSENSOR_SCAN_FIRST_ADDRESS
+				|| desiredDeviceAddress > SOILSENSOR_SCAN_LAST_ADDRESS
+				|| FindSoilSensor(&soilSensorRegistry, desiredAddress) >= 0
+				|| FindSoilSensor(&soilSensorRegistry, desiredDeviceAddress) >= 0) {
+				goto payloadError;
+			}
+
+			SoilSensorAddressChange* change = AcquireMessageBuffer(&messagePool, sizeof(SoilSensorAddressChange));
+			if (change == NULL) {
+				Log_Debug("ERROR: No message buffer for ChangeSoilSensorAddressCommand.\n");
+				goto payloadError;
+			}
+			change->originAddress = originAddress;
+			change->desiredAddress = desiredAddress;
+			if (QueueDeferredWork(&deferredWork, &ChangeSoilSensorAddressWork, change) != 0) {
+				Log_Debug("ERROR: Could not queue ChangeSoilSensorAddressCommand.\n");
+				ReleaseMessageBuffer(&messagePool, change);
+				goto payloadError;
+			}
+
+			result = 200;
+			static const char changeAddressResponse[] =
+				"{ \"success\" : true, \"message\" : \"Changing soil sensor address\" }";
+			*responsePayload = SetupHeapMessage(changeAddressResponse, sizeof(changeAddressResponse));
 			if (*responsePayload == NULL) {
 				Log_Debug("ERROR: Could not allocate buffer for direct method response payload.\n");
 				abort();
@@ -698,20 +1230,68 @@ static int DirectMethodCall(const char* methodName, const char* payload, size_t
 			*responsePayloadSize = strlen(*responsePayload);
 			return result;
 		}
+		// Discover the soil sensors on the bus again.
+		else if (strcmp(methodName, RescanSoilSensorsCommandName) == 0) {
 
-	}
-	else {
-		Log_Debug("Payload size > 32 bytes, aborting Direct Method execution\n");
-		goto payloadError;
-	}
+			Log_Debug("RescanSoilSensorsCommand() Direct Method called\n");
+			result = 200;
 
-	// If there was a payload error, construct the 
-	// response message and send it back to the IoT Hub for the user to see
-payloadError:
+			static const char rescanResponse[] =
+				"{ \"success\" : true, \"message\" : \"Rescanning soil sensors\" }";
+			*responsePayload = SetupHeapMessage(rescanResponse, sizeof(rescanResponse));
+			if (*responsePayload == NULL) {
+				Log_Debug("ERROR: Could not allocate buffer for direct method response payload.\n");
+				abort();
+			}
+			*responsePayloadSize = strlen(*responsePayload);
 
+			if (QueueDeferredWork(&deferredWork, &RescanSoilSensorsWork, NULL) != 0) {
+				Log_Debug("ERROR: Could not queue RescanSoilSensorsCommand.\n");
+			}
+			return result;
+		}
+		// Report the dispatch counters and latency histograms of the event handlers.
+		else if (strcmp(methodName, GetEventStatsCommandName) == 0) {
 
-	result = 400; // Bad request.
-	Log_Debug("INFO: Unrecognised direct method payload format.\n");
+			Log_Debug("GetEventStatsCommand() Direct Method called\n");
+			result = 200;
+
+			*responsePayload = SerializeEventStats();
+			if (*responsePayload == NULL) {
+				Log_Debug("ERROR: Could not allocate buffer for direct method response payload.\n");
+				abort();
+			}
+			*responsePayloadSize = strlen(*responsePayload);
+			return result;
+		}
+		else {
+			result = 404;
+			Log_Debug("INFO: Direct Method called \"%s\" not found.\n", methodName);
+
+			static const char noMethodFound[] = "\"method not found '%s'\"";
+			size_t responseMaxLength = sizeof(noMethodFound) + strlen(methodName);
+			*responsePayload = SetupHeapMessage(noMethodFound, responseMaxLength, methodName);
+			if (*responsePayload == NULL) {
+				Log_Debug("ERROR: Could not allocate buffer for direct method response payload.\n");
+				abort();
+			}
+			*responsePayloadSize = strlen(*responsePayload);
+			return result;
+		}
+
+	}
+	else {
+		Log_Debug("Payload size > 32 bytes, aborting Direct Method execution\n");
+		goto payloadError;
+	}
+
+	// If there was a payload error, construct the 
+	// response message and send it back to the IoT Hub for the user to see
+payloadError:
+
+
+	result = 400; // Bad request.
+	Log_Debug("INFO: Unrecognised direct method payload format.\n");
 
 	static const char noPayloadResponse[] =
 		"{ \"success\" : false, \"message\" : \"request does not contain an identifiable "
@@ -730,6 +1310,232 @@ payloadError:
 
 }
 
+/// <summary>
+///     Deferred work for Relay1PulseCommand: switch on relay 1 and report it.
+/// </summary>
+static void Relay1PulseCommandWork(void* context)
+{
+	relaystate(relaysState, relay1_set);
+	TwinReportBoolState("Relay1Setting", relaystate(relaysState, relay1_rd));
+	SendTelemetryRelay1();
+}
+
+/// <summary>
+///     Serializes the stats of every event handler in eventStatsSources to JSON.
+/// </summary>
+/// <returns>A heap allocated null terminated string, or NULL on failure.</returns>
+/// <summary>
+///     Copy the sensor power, health and I2C stats into soilSensorStats, from the snapshot of
+///     the sampler thread while it runs and from the event loop state otherwise.
+/// </summary>
+static const SoilSensorSamplerSnapshot* GetSoilSensorStats(void)
+{
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+	if (soilSensorSamplerFd >= 0)
+	{
+		GetSoilSensorSamplerSnapshot(&soilSensorStats);
+		return &soilSensorStats;
+	}
+#endif
+	soilSensorStats.sensorCount = soilSensorRegistry.count;
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		const I2CAddressStats* addressStats = GetI2CAddressStats(soilSensorRegistry.addresses[i]);
+		soilSensorStats.powerStates[i] = soilSensorPowerStates[i];
+		soilSensorStats.health[i] = soilSensorHealth[i];
+		soilSensorStats.addressStats[i] = addressStats != NULL ? *addressStats : (I2CAddressStats){ 0 };
+	}
+	soilSensorStats.busSpeedStats = *GetI2CBusSpeedStats();
+	soilSensorStats.muxStats = *GetI2CMuxStats();
+	return &soilSensorStats;
+}
+
+static char* SerializeEventStats(void)
+{
+	JSON_Value* rootValue = json_value_init_object();
+	JSON_Object* rootObject = json_value_get_object(rootValue);
+	const SoilSensorSamplerSnapshot* sensorStats = GetSoilSensorStats();
+
+	json_object_set_number(rootObject, "EventLoopWakeups", eventLoopWakeups);
+	json_object_set_number(rootObject, "EventLoopEventsDispatched", eventLoopEventsDispatched);
+	json_object_dotset_number(rootObject, "StartupMs.SensorsReady", sensorsReadyMs);
+	json_object_dotset_number(rootObject, "StartupMs.EventLoopStart", eventLoopStartMs);
+	json_object_dotset_number(rootObject, "StartupMs.FirstSample", firstSampleMs);
+	json_object_dotset_number(rootObject, "StartupMs.FirstTelemetry", firstTelemetryMs);
+	json_object_dotset_number(rootObject, "SampleCache.Updates", soilSensorSampleCache.updateCount);
+	json_object_dotset_number(rootObject, "SampleCache.Hits", soilSensorSampleCache.hitCount);
+	json_object_dotset_number(rootObject, "SampleCache.Stale", soilSensorSampleCache.staleCount);
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+	json_object_dotset_number(rootObject, "SampleRing.Dropped", atomic_load(&soilSensorSampleRing.droppedCount));
+#endif
+	json_object_dotset_number(rootObject, "Buttons.SendMessage.Samples", sendMessageButton.sampleCount);
+	json_object_dotset_number(rootObject, "Buttons.SendMessage.Presses", sendMessageButton.pressCount);
+	json_object_dotset_number(rootObject, "Buttons.SendOrientation.Samples", sendOrientationButton.sampleCount);
+	json_object_dotset_number(rootObject, "Buttons.SendOrientation.Presses", sendOrientationButton.pressCount);
+	// Not under "DeferredWork", which holds the queue's event stats below.
+	json_object_dotset_number(rootObject, "DeferredWorkQueue.HighWater", deferredWork.highWaterMark);
+	json_object_dotset_number(rootObject, "DeferredWorkQueue.Overflows", deferredWork.overflowCount);
+	json_object_dotset_number(rootObject, "TelemetryBatch.MaxSize", (double)telemetryBatch.maxSize);
+	json_object_dotset_string(rootObject, "TelemetryBatch.Encoding", telemetryBatch.encoder->name);
+	json_object_dotset_number(rootObject, "TelemetryBatch.Bytes", telemetryBatch.bytesSent);
+	json_object_dotset_number(rootObject, "TelemetryBatch.TickMessages", telemetryBatch.flushCounts[TelemetryBatchFlushReason_Tick]);
+	json_object_dotset_number(rootObject, "TelemetryBatch.DeadlineMessages", telemetryBatch.flushCounts[TelemetryBatchFlushReason_Deadline]);
+	json_object_dotset_number(rootObject, "TelemetryBatch.SizeMessages", telemetryBatch.flushCounts[TelemetryBatchFlushReason_Size]);
+	json_object_dotset_number(rootObject, "TelemetryBatch.KeyMessages", telemetryBatch.flushCounts[TelemetryBatchFlushReason_Key]);
+	json_object_dotset_number(rootObject, "TelemetryBatch.Items", telemetryBatch.itemsSent);
+	json_object_dotset_number(rootObject, "TelemetryBatch.Dropped", telemetryBatch.droppedCount);
+	json_object_dotset_number(rootObject, "RelayTelemetry.Relay1Suppressed", relay1StateSignal.suppressedCount);
+	json_object_dotset_number(rootObject, "RelayTelemetry.Relay2Suppressed", relay2StateSignal.suppressedCount);
+	json_object_dotset_boolean(rootObject, "TelemetryJournal.Open", telemetryJournalFd >= 0);
+	json_object_dotset_number(rootObject, "TelemetryJournal.Pending", GetTelemetryJournalPendingCount(&telemetryJournal));
+	json_object_dotset_number(rootObject, "TelemetryJournal.Appended", telemetryJournal.appendedCount);
+	json_object_dotset_number(rootObject, "TelemetryJournal.Replayed", telemetryJournal.replayedCount);
+	json_object_dotset_number(rootObject, "TelemetryJournal.Overwritten", telemetryJournal.overwrittenCount);
+	json_object_dotset_number(rootObject, "TelemetryJournal.Corrupt", telemetryJournal.corruptCount);
+	json_object_dotset_number(rootObject, "TelemetryJournal.TooLong", telemetryJournal.tooLongCount);
+	json_object_dotset_number(rootObject, "TelemetryJournal.WriteFailures", telemetryJournal.writeFailures);
+	static const char* const messagePoolClassNames[MessagePoolClass_Count] = { "Small", "Medium", "Large" };
+	for (int i = 0; i < MessagePoolClass_Count; i++) {
+		char name[40];
+		snprintf(name, sizeof(name), "MessagePool.%s.HighWater", messagePoolClassNames[i]);
+		json_object_dotset_number(rootObject, name, messagePool.stats[i].highWaterMark);
+		snprintf(name, sizeof(name), "MessagePool.%s.Exhausted", messagePoolClassNames[i]);
+		json_object_dotset_number(rootObject, name, messagePool.stats[i].exhaustedCount);
+	}
+	json_object_dotset_number(rootObject, "MessagePool.Failed", messagePool.failedCount);
+	json_object_dotset_number(rootObject, "MessagePool.Truncated", messagePool.truncatedCount);
+	json_object_dotset_number(rootObject, "MessagePool.TwinHeapCopies", twinPayloadHeapCount);
+
+	for (size_t i = 0; i < sizeof(eventStatsSources) / sizeof(eventStatsSources[0]); i++)
+	{
+		const EventStats* stats = &eventStatsSources[i].eventData->stats;
+		JSON_Value* eventValue = json_value_init_object();
+		JSON_Object* eventObject = json_value_get_object(eventValue);
+		JSON_Value* lagValue = json_value_init_array();
+		JSON_Value* runTimeValue = json_value_init_array();
+
+		json_object_set_number(eventObject, "Dispatches", stats->dispatchCount);
+		json_object_set_number(eventObject, "Coalesced", stats->coalescedExpirations);
+		json_object_set_number(eventObject, "MaxLagUs", stats->maxLagUs);
+		json_object_set_number(eventObject, "MaxRunTimeUs", stats->maxRunTimeUs);
+		for (int bucket = 0; bucket < EVENT_STATS_HISTOGRAM_BUCKETS; bucket++)
+		{
+			json_array_append_number(json_value_get_array(lagValue), stats->lagHistogram[bucket]);
+			json_array_append_number(json_value_get_array(runTimeValue), stats->runTimeHistogram[bucket]);
+		}
+		json_object_set_value(eventObject, "LagHistogram", lagValue);
+		json_object_set_value(eventObject, "RunTimeHistogram", runTimeValue);
+		json_object_set_value(rootObject, eventStatsSources[i].name, eventValue);
+	}
+
+	for (int i = 0; i < sensorStats->sensorCount; i++)
+	{
+		const I2CAddressStats* stats = &sensorStats->addressStats[i];
+		const SoilSensorPowerState* powerState = &sensorStats->powerStates[i];
+		const SoilSensorHealth* health = &sensorStats->health[i];
+		JSON_Value* i2cValue = json_value_init_object();
+		JSON_Object* i2cObject = json_value_get_object(i2cValue);
+		char name[16];
+		snprintf(name, sizeof(name), "I2C_%02X", soilSensorRegistry.addresses[i]);
+
+		json_object_set_number(i2cObject, "Transfers", stats->transfers);
+		json_object_set_number(i2cObject, "Failures", stats->failures);
+		json_object_set_number(i2cObject, "Retries", stats->retries);
+		json_object_set_number(i2cObject, "Nacks", stats->nackCount);
+		json_object_set_number(i2cObject, "Timeouts", stats->timeoutCount);
+		json_object_set_number(i2cObject, "ShortTransfers", stats->shortTransferCount);
+		json_object_set_number(i2cObject, "Errors", stats->errorCount);
+		json_object_set_number(i2cObject, "MaxLatencyUs", stats->maxLatencyUs);
+		json_object_set_number(i2cObject, "TotalLatencyUs", (double)stats->totalLatencyUs);
+		json_object_set_number(i2cObject, "AwakeMs", (double)GetSoilSensorAwakeMs(powerState));
+		json_object_set_number(i2cObject, "AwakePerMille", GetSoilSensorAwakePerMille(powerState));
+		json_object_set_number(i2cObject, "Sleeps", powerState->sleepCount);
+		json_object_set_number(i2cObject, "SleepFailures", powerState->sleepFailures);
+		json_object_set_number(i2cObject, "CapacitanceRejected", soilSensorCapacitanceFilters[i].rejectedCount);
+		json_object_set_number(i2cObject, "CapacitanceSpikes", soilSensorCapacitanceFilters[i].spikeCount);
+		json_object_set_string(i2cObject, "Health", SoilSensorHealthStateToString(health->state));
+		json_object_set_number(i2cObject, "HealthRetries", health->retryCount);
+		json_object_set_number(i2cObject, "HealthResets", health->resetCount);
+		json_object_set_number(i2cObject, "HealthQuarantines", health->quarantineCount);
+		json_object_set_number(i2cObject, "HealthRecoveries", health->recoveryCount);
+		json_object_set_number(i2cObject, "TemperatureSent", soilSensorTemperatureSignals[i].sentCount);
+		json_object_set_number(i2cObject, "TemperatureSuppressed", soilSensorTemperatureSignals[i].suppressedCount);
+		json_object_set_number(i2cObject, "CapacitanceSent", soilSensorCapacitanceSignals[i].sentCount);
+		json_object_set_number(i2cObject, "CapacitanceSuppressed", soilSensorCapacitanceSignals[i].suppressedCount);
+		json_object_set_value(rootObject, name, i2cValue);
+	}
+	json_object_dotset_number(rootObject, "I2CBus.Speed", sensorStats->busSpeedStats.speed);
+	json_object_dotset_number(rootObject, "I2CBus.StepDowns", sensorStats->busSpeedStats.stepDowns);
+	json_object_dotset_number(rootObject, "I2CBus.StepUps", sensorStats->busSpeedStats.stepUps);
+	json_object_dotset_number(rootObject, "I2CBus.MuxSwitches", sensorStats->muxStats.channelSwitches);
+	json_object_dotset_number(rootObject, "I2CBus.MuxSwitchesSkipped", sensorStats->muxStats.switchesSkipped);
+	json_object_dotset_number(rootObject, "I2CBus.MuxSwitchTimeUs", (double)sensorStats->muxStats.switchTimeUs);
+
+	char* serialized = json_serialize_to_string(rootValue);
+	json_value_free(rootValue);
+	return serialized;
+}
+
+/// <summary>
+///     Logs the stats of every event handler in eventStatsSources.
+/// </summary>
+static void LogAllEventStats(void)
+{
+	for (size_t i = 0; i < sizeof(eventStatsSources) / sizeof(eventStatsSources[0]); i++)
+	{
+		LogEventStats(eventStatsSources[i].name, eventStatsSources[i].eventData);
+	}
+
+	Log_Debug("Buttons: send message %u samples, %u presses, send orientation %u samples, %u presses\n",
+		sendMessageButton.sampleCount, sendMessageButton.pressCount,
+		sendOrientationButton.sampleCount, sendOrientationButton.pressCount);
+	Log_Debug("Deferred work: high water %u of %d, %u overflows\n", deferredWork.highWaterMark,
+		DEFERRED_WORK_QUEUE_SIZE, deferredWork.overflowCount);
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+	Log_Debug("Sample ring: %u samples dropped\n", atomic_load(&soilSensorSampleRing.droppedCount));
+#endif
+	Log_Debug("Telemetry: %u items, %u %s bytes in %u tick, %u deadline, %u size and %u key messages, %u dropped\n",
+		telemetryBatch.itemsSent, telemetryBatch.bytesSent, telemetryBatch.encoder->name,
+		telemetryBatch.flushCounts[TelemetryBatchFlushReason_Tick],
+		telemetryBatch.flushCounts[TelemetryBatchFlushReason_Deadline],
+		telemetryBatch.flushCounts[TelemetryBatchFlushReason_Size],
+		telemetryBatch.flushCounts[TelemetryBatchFlushReason_Key], telemetryBatch.droppedCount);
+	if (telemetryJournalFd >= 0) {
+		Log_Debug("Telemetry journal: %u to forward, %u appended, %u replayed, %u overwritten, %u corrupt, %u too long, %u write failures\n",
+			GetTelemetryJournalPendingCount(&telemetryJournal), telemetryJournal.appendedCount,
+			telemetryJournal.replayedCount, telemetryJournal.overwrittenCount, telemetryJournal.corruptCount,
+			telemetryJournal.tooLongCount, telemetryJournal.writeFailures);
+	}
+	for (int i = 0; i < MessagePoolClass_Count; i++) {
+		const MessagePoolClassStats* stats = &messagePool.stats[i];
+		Log_Debug("Message pool %zu byte buffers: %u in use, high water %u, %u acquired, %u exhausted\n",
+			GetMessagePoolClassSize((MessagePoolClass)i), stats->inUse, stats->highWaterMark,
+			stats->acquireCount, stats->exhaustedCount);
+	}
+	Log_Debug("Message pool: %u failed, %u truncated, %u twin documents copied to the heap\n",
+		messagePool.failedCount, messagePool.truncatedCount, twinPayloadHeapCount);
+
+	const SoilSensorSamplerSnapshot* sensorStats = GetSoilSensorStats();
+	for (int i = 0; i < sensorStats->sensorCount; i++)
+	{
+		const I2CAddressStats* stats = &sensorStats->addressStats[i];
+		const SoilSensorPowerState* powerState = &sensorStats->powerStates[i];
+		const SoilSensorHealth* health = &sensorStats->health[i];
+		Log_Debug("I2C %02X: %u transfers, %u failed, %u retries, %u NACK, %u timeout, max %u us, awake %llu ms (%u per mille), %u glitches\n",
+			soilSensorRegistry.addresses[i], stats->transfers, stats->failures, stats->retries,
+			stats->nackCount, stats->timeoutCount, stats->maxLatencyUs,
+			(unsigned long long)GetSoilSensorAwakeMs(powerState), GetSoilSensorAwakePerMille(powerState),
+			GetSoilSensorFilterGlitches(&soilSensorCapacitanceFilters[i]));
+		Log_Debug("Soil sensor %02X: %s, %u retries, %u resets, %u quarantines, %u recoveries\n",
+			soilSensorRegistry.addresses[i], SoilSensorHealthStateToString(health->state),
+			health->retryCount, health->resetCount, health->quarantineCount, health->recoveryCount);
+		Log_Debug("Soil sensor %02X telemetry: temperature %u sent, %u suppressed, capacitance %u sent, %u suppressed\n",
+			soilSensorRegistry.addresses[i],
+			soilSensorTemperatureSignals[i].sentCount, soilSensorTemperatureSignals[i].suppressedCount,
+			soilSensorCapacitanceSignals[i].sentCount, soilSensorCapacitanceSignals[i].suppressedCount);
+	}
+}
+
 /// <summary>
 ///     Define GPIOs for relay click as outputs and initialize as low.
 /// </summary>
@@ -746,6 +1552,9 @@ static void ClosePeripheralsAndHandlers(void)
 {
     Log_Debug("Closing file descriptors\n");
 
+	// Stop sampling before the I2C bus is closed, leaving the sensors awake for the next start.
+	StopSoilSensorSampling();
+
     // Leave the LEDs off
     if (deviceTwinStatusLedGpioFd >= 0) {
         GPIO_SetValue(deviceTwinStatusLedGpioFd, GPIO_Value_High);
@@ -756,18 +1565,21 @@ static void ClosePeripheralsAndHandlers(void)
 	GPIO_SetValue(relay1PinFd, GPIO_Value_Low);
 	GPIO_SetValue(relay2PinFd, GPIO_Value_Low);
 
-    CloseFdAndPrintError(buttonPollTimerFd, "ButtonTimer");
-    CloseFdAndPrintError(azureTimerFd, "AzureTimer");
+    StopButtonInput(epollFd, &sendMessageButton);
+    StopButtonInput(epollFd, &sendOrientationButton);
+    CloseFdAndPrintError(timerWheelFd, "TimerWheel");
+    CloseFdAndPrintError(deferredWorkFd, "DeferredWork");
     CloseFdAndPrintError(sendMessageButtonGpioFd, "SendMessageButton");
     CloseFdAndPrintError(sendOrientationButtonGpioFd, "SendOrientationButton");
     CloseFdAndPrintError(deviceTwinStatusLedGpioFd, "StatusLed");
     CloseFdAndPrintError(epollFd, "Epoll");
+	if (telemetryJournalFd >= 0) {
+		CommitTelemetryJournal(&telemetryJournal);
+		CloseFdAndPrintError(telemetryJournalFd, "TelemetryJournal");
+	}
 	CloseFdAndPrintError(i2cFd, "I2C");
 	CloseFdAndPrintError(relay1PinFd, "Relay 1");
 	CloseFdAndPrintError(relay2PinFd, "Relay 2");
-	CloseFdAndPrintError(relayPollTimerFd, "Relay 1");
-	CloseFdAndPrintError(pulse1OneShotTimerFd, "Pulse 1");
-	CloseFdAndPrintError(relay1GracePeriodTimerFd, "Relay 1 Grace Period");
 }
 
 /// <summary>
@@ -781,25 +1593,59 @@ static void HubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
     iothubAuthenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
     Log_Debug("IoT Hub Authenticated: %s\n", GetReasonString(reason));
 
-	if (iothubAuthenticated)
+	// Keep the telemetry and reported properties out of IoTHubDeviceClient_LL_DoWork.
+	if (iothubAuthenticated
+		&& QueueDeferredWork(&deferredWork, &HubAuthenticatedWork, NULL) != 0)
 	{
-		SendDeviceAuthenticatedEvent();
-		SendTelemetryRelay1();
-		SendTelemetryRelay2();
+		Log_Debug("ERROR: Could not queue sensor info report.\n");
+	}
+}
 
-		for (int i = 0; i < 3; i++)
-		{
-			char versionPropertyName[27];
-			char addressPropertyName[27];
-			snprintf(versionPropertyName, sizeof(versionPropertyName), "%s%d", "SoilSensorVersionProperty", i + 1);
-			snprintf(addressPropertyName, sizeof(addressPropertyName), "%s%d", "SoilSensorAddressProperty", i + 1);
-			char* version = malloc(5);
-			char* address = malloc(5);
-			snprintf(version, 5, "0x%02X", GetVersion(moistureSensorsAddresses[i]));
-			snprintf(address, 5, "0x%02X", GetAddress(moistureSensorsAddresses[i]));
-			TwinReportStringState(versionPropertyName, version);
-			TwinReportStringState(addressPropertyName, address);
-		}
+/// <summary>
+///     Deferred work after IoT Hub authentication: send the relay states, and every reading on
+///     the next tick, and report the soil sensor versions and addresses found by the scan.
+/// </summary>
+static void HubAuthenticatedWork(void* context)
+{
+	if (!iothubAuthenticated)
+	{
+		return;
+	}
+
+	ResetTelemetrySignals();
+	if (telemetryJournalFd >= 0)
+	{
+		// Confirmations of records in flight before the reconnect may never arrive.
+		RewindTelemetryJournal(&telemetryJournal);
+	}
+	SendDeviceAuthenticatedEvent();
+	SendTelemetryRelay1();
+	SendTelemetryRelay2();
+	ReportSoilSensorProperties();
+}
+
+/// <summary>
+///     Report the version and address of every registered soil sensor.
+/// </summary>
+static void ReportSoilSensorProperties(void)
+{
+	if (!iothubAuthenticated)
+	{
+		return;
+	}
+
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		char versionPropertyName[27];
+		char addressPropertyName[27];
+		char version[5];
+		char address[11];
+		snprintf(versionPropertyName, sizeof(versionPropertyName), "%s%d", "SoilSensorVersionProperty", i + 1);
+		snprintf(addressPropertyName, sizeof(addressPropertyName), "%s%d", "SoilSensorAddressProperty", i + 1);
+		snprintf(version, sizeof(version), "0x%02X", soilSensorRegistry.versions[i]);
+		snprintf(address, sizeof(address), "0x%02X", soilSensorRegistry.addresses[i]);
+		TwinReportStringState(versionPropertyName, version);
+		TwinReportStringState(addressPropertyName, address);
 	}
 }
 
@@ -807,17 +1653,21 @@ static void SendDeviceAuthenticatedEvent(void) {
 	SendTelemetry("DeviceAuthenticatedEvent", "True"); 
 }
 
+/// <summary>
+///     Seed the sample cache with a first reading of every registered sensor.
+/// </summary>
 void GetMoistureSensorsInfo(void)
 {
-	for (int i = 0; i < 3; i++)
+	for (int i = 0; i < soilSensorRegistry.count; i++)
 	{
-		GetVersion(moistureSensorsAddresses[i]);
-		GetAddress(moistureSensorsAddresses[i]);
-
-		unsigned int soilSensor1Capacitance = GetCapacitance(moistureSensorsAddresses[i]);
-		Log_Debug("Soil sensor (Address: %X) capacitance: %u\n", moistureSensorsAddresses[i], soilSensor1Capacitance);
-		float soilSensor1Temperature = GetTemperature(moistureSensorsAddresses[i]);
-		Log_Debug("Soil sensor (Address: %X) temperature: %.1f\n", moistureSensorsAddresses[i], soilSensor1Temperature);
+		I2C_DeviceAddress address = soilSensorRegistry.addresses[i];
+		SoilSensorSample sample;
+		ReadSoilSensorSample(address, &sample);
+		StoreSoilSensorSample(&sample);
+		if (sample.hasCapacitance)
+			Log_Debug("Soil sensor (Address: %X) capacitance: %u\n", address, sample.capacitance);
+		if (sample.hasTemperature)
+			Log_Debug("Soil sensor (Address: %X) temperature: %d deci-C\n", address, sample.temperatureDeciC);
 	}
 }
 
@@ -852,7 +1702,7 @@ static void SetupAzureClient(void)
         }
 
         struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-        SetTimerFdToPeriod(azureTimerFd, &azureTelemetryPeriod);
+        SetSoftTimerToPeriod(&timerWheel, &azureTimer, &azureTelemetryPeriod);
 
         Log_Debug("ERROR: failure to create IoTHub Handle - will retry in %i seconds.\n",
                   azureIoTPollPeriodSeconds);
@@ -862,7 +1712,7 @@ static void SetupAzureClient(void)
     // Successfully connected, so make sure the polling frequency is back to the default
     azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
     struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-    SetTimerFdToPeriod(azureTimerFd, &azureTelemetryPeriod);
+    SetSoftTimerToPeriod(&timerWheel, &azureTimer, &azureTelemetryPeriod);
 
     iothubAuthenticated = true;
 
@@ -880,7 +1730,8 @@ static void SetupAzureClient(void)
 
 /// <summary>
 ///     Callback invoked when a Device Twin update is received from IoT Hub.
-///     Updates local state for 'showEvents' (bool).
+///     Copies the document and queues it for <see cref="TwinUpdateWork" />. The copy comes from
+///     the message pool, or the heap if the document is larger than every pool buffer.
 /// </summary>
 /// <param name="payload">contains the Device Twin JSON document (desired and reported)</param>
 /// <param name="payloadSize">size of the Device Twin JSON document</param>
@@ -888,7 +1739,11 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
                          size_t payloadSize, void *userContextCallback)
 {
     size_t nullTerminatedJsonSize = payloadSize + 1;
-    char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
+    char *nullTerminatedJsonString = AcquireMessageBuffer(&messagePool, nullTerminatedJsonSize);
+    if (nullTerminatedJsonString == NULL) {
+        twinPayloadHeapCount++;
+        nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
+    }
     if (nullTerminatedJsonString == NULL) {
         Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
         abort();
@@ -899,6 +1754,33 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
     // Add the null terminator at the end.
     nullTerminatedJsonString[nullTerminatedJsonSize - 1] = 0;
 
+    if (QueueDeferredWork(&deferredWork, &TwinUpdateWork, nullTerminatedJsonString) != 0) {
+        Log_Debug("ERROR: Could not queue twin update, dropping it.\n");
+        ReleaseTwinPayload(nullTerminatedJsonString);
+    }
+}
+
+/// <summary>
+///     Releases a Device Twin document copied by <see cref="TwinCallback" />.
+/// </summary>
+static void ReleaseTwinPayload(char* json)
+{
+    if (IsMessagePoolBuffer(&messagePool, json)) {
+        ReleaseMessageBuffer(&messagePool, json);
+    } else {
+        free(json);
+    }
+}
+
+/// <summary>
+///     Deferred work for a Device Twin update: applies the desired properties.
+/// </summary>
+/// <param name="context">Heap allocated null terminated Device Twin JSON document, freed
+/// here</param>
+static void TwinUpdateWork(void *context)
+{
+    char *nullTerminatedJsonString = context;
+
     JSON_Value *rootProperties = NULL;
     rootProperties = json_parse_string(nullTerminatedJsonString);
     if (rootProperties == NULL) {
@@ -969,8 +1851,8 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
 	JSON_Object* Relay1PulseSecondsSetting = json_object_dotget_object(desiredProperties, "Relay1PulseSecondsSetting");
 	if (Relay1PulseSecondsSetting != NULL) {
 		Relay1PulseSecondsSettingValue = (int)json_object_get_number(Relay1PulseSecondsSetting, "value");
-		char* relay1PulseSecondsSettingBuffer = malloc(3);
-		snprintf(relay1PulseSecondsSettingBuffer, 2, "%d", Relay1PulseSecondsSettingValue);
+		char relay1PulseSecondsSettingBuffer[12];
+		FormatInteger(relay1PulseSecondsSettingBuffer, sizeof(relay1PulseSecondsSettingBuffer), Relay1PulseSecondsSettingValue);
 		TwinReportStringState("Relay1PulseSecondsSetting", relay1PulseSecondsSettingBuffer);
 	}
 
@@ -978,8 +1860,8 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
 	JSON_Object* Relay1PulseGraceSecondsSetting = json_object_dotget_object(desiredProperties, "Relay1PulseGraceSecondsSetting");
 	if (Relay1PulseGraceSecondsSetting != NULL) {
 		Relay1PulseGraceSecondsSettingValue = (int)json_object_get_number(Relay1PulseGraceSecondsSetting, "value");
-		char* relay1PulseGraceSecondsSettingBuffer = malloc(7);
-		snprintf(relay1PulseGraceSecondsSettingBuffer, 6, "%d", Relay1PulseGraceSecondsSettingValue);
+		char relay1PulseGraceSecondsSettingBuffer[12];
+		FormatInteger(relay1PulseGraceSecondsSettingBuffer, sizeof(relay1PulseGraceSecondsSettingBuffer), Relay1PulseGraceSecondsSettingValue);
 		TwinReportStringState("Relay1PulseGraceSecondsSetting", relay1PulseGraceSecondsSettingBuffer);
 	}
 
@@ -987,43 +1869,114 @@ static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
 	JSON_Object* SoilMoistureCapacitanceThresholdSetting = json_object_dotget_object(desiredProperties, "SoilMoistureCapacitanceThresholdSetting");
 	if (SoilMoistureCapacitanceThresholdSetting != NULL) {
 		SoilMoistureCapacitanceThresholdSettingValue = (int)json_object_get_number(SoilMoistureCapacitanceThresholdSetting, "value");
-		char* soilMoistureCapacitanceThresholdSettingBuffer = malloc(7);
-		snprintf(soilMoistureCapacitanceThresholdSettingBuffer, 6, "%d", SoilMoistureCapacitanceThresholdSettingValue);
+		char soilMoistureCapacitanceThresholdSettingBuffer[12];
+		FormatInteger(soilMoistureCapacitanceThresholdSettingBuffer, sizeof(soilMoistureCapacitanceThresholdSettingBuffer), SoilMoistureCapacitanceThresholdSettingValue);
 		TwinReportStringState("SoilMoistureCapacitanceThresholdSetting", soilMoistureCapacitanceThresholdSettingBuffer);
 	}
 
+	// Ambient light threshold Setting
+	JSON_Object* AmbientLightThresholdSetting = json_object_dotget_object(desiredProperties, "AmbientLightThresholdSetting");
+	if (AmbientLightThresholdSetting != NULL) {
+		AmbientLightThresholdSettingValue = (int)json_object_get_number(AmbientLightThresholdSetting, "value");
+		char ambientLightThresholdSettingBuffer[12];
+		FormatInteger(ambientLightThresholdSettingBuffer, sizeof(ambientLightThresholdSettingBuffer), AmbientLightThresholdSettingValue);
+		TwinReportStringState("AmbientLightThresholdSetting", ambientLightThresholdSettingBuffer);
+	}
+
+	// Telemetry message size Setting
+	JSON_Object* TelemetryBatchMaxSizeSetting = json_object_dotget_object(desiredProperties, "TelemetryBatchMaxSizeSetting");
+	if (TelemetryBatchMaxSizeSetting != NULL) {
+		size_t maxSize = SetTelemetryMaxMessageSize((size_t)json_object_get_number(TelemetryBatchMaxSizeSetting, "value"));
+		char telemetryBatchMaxSizeSettingBuffer[12];
+		FormatInteger(telemetryBatchMaxSizeSettingBuffer, sizeof(telemetryBatchMaxSizeSettingBuffer), (int32_t)maxSize);
+		TwinReportStringState("TelemetryBatchMaxSizeSetting", telemetryBatchMaxSizeSettingBuffer);
+	}
+
+	// Telemetry deadband and heartbeat Settings
+	JSON_Object* CapacitanceDeadbandSetting = json_object_dotget_object(desiredProperties, "CapacitanceDeadbandSetting");
+	if (CapacitanceDeadbandSetting != NULL) {
+		capacitanceTelemetryPolicy.deadband = (int32_t)json_object_get_number(CapacitanceDeadbandSetting, "value");
+		char capacitanceDeadbandSettingBuffer[12];
+		FormatInteger(capacitanceDeadbandSettingBuffer, sizeof(capacitanceDeadbandSettingBuffer), capacitanceTelemetryPolicy.deadband);
+		TwinReportStringState("CapacitanceDeadbandSetting", capacitanceDeadbandSettingBuffer);
+	}
+	JSON_Object* TemperatureDeadbandSetting = json_object_dotget_object(desiredProperties, "TemperatureDeadbandSetting");
+	if (TemperatureDeadbandSetting != NULL) {
+		temperatureTelemetryPolicy.deadband = (int32_t)json_object_get_number(TemperatureDeadbandSetting, "value");
+		char temperatureDeadbandSettingBuffer[12];
+		FormatInteger(temperatureDeadbandSettingBuffer, sizeof(temperatureDeadbandSettingBuffer), temperatureTelemetryPolicy.deadband);
+		TwinReportStringState("TemperatureDeadbandSetting", temperatureDeadbandSettingBuffer);
+	}
+	JSON_Object* TelemetryHeartbeatSecondsSetting = json_object_dotget_object(desiredProperties, "TelemetryHeartbeatSecondsSetting");
+	if (TelemetryHeartbeatSecondsSetting != NULL) {
+		int32_t heartbeatSeconds = (int32_t)json_object_get_number(TelemetryHeartbeatSecondsSetting, "value");
+		if (heartbeatSeconds < 0) {
+			heartbeatSeconds = 0;
+		}
+		capacitanceTelemetryPolicy.heartbeatMs = (long)heartbeatSeconds * 1000;
+		temperatureTelemetryPolicy.heartbeatMs = (long)heartbeatSeconds * 1000;
+		relayStateTelemetryPolicy.heartbeatMs = (long)heartbeatSeconds * 1000;
+		char telemetryHeartbeatSecondsSettingBuffer[12];
+		FormatInteger(telemetryHeartbeatSecondsSettingBuffer, sizeof(telemetryHeartbeatSecondsSettingBuffer), heartbeatSeconds);
+		TwinReportStringState("TelemetryHeartbeatSecondsSetting", telemetryHeartbeatSecondsSettingBuffer);
+	}
+
+	// Telemetry encoding Setting
+	JSON_Object* TelemetryEncodingSetting = json_object_dotget_object(desiredProperties, "TelemetryEncodingSetting");
+	if (TelemetryEncodingSetting != NULL) {
+		const char* encodingName = json_object_get_string(TelemetryEncodingSetting, "value");
+		const TelemetryEncoder* encoder = encodingName != NULL ? FindTelemetryEncoder(encodingName) : NULL;
+		if (encoder != NULL) {
+			SetTelemetryBatchEncoder(&telemetryBatch, encoder);
+		}
+		else {
+			Log_Debug("WARNING: Unknown telemetry encoding, keeping %s\n", telemetryBatch.encoder->name);
+		}
+		TwinReportStringState("TelemetryEncodingSetting", telemetryBatch.encoder->name);
+	}
+
+	// Soil sensor sleep between samples Setting
+	JSON_Object* SoilSensorSleepSetting = json_object_dotget_object(desiredProperties, "SoilSensorSleepSetting");
+	if (SoilSensorSleepSetting != NULL) {
+		soilSensorSleepEnabled = (bool)json_object_get_boolean(SoilSensorSleepSetting, "value");
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+		SetSoilSensorSamplerSleep(soilSensorSleepEnabled);
+#endif
+		TwinReportBoolState("SoilSensorSleepSetting", soilSensorSleepEnabled);
+	}
+
 	// Water tank threshold Setting
 	JSON_Object* WaterTankCapacitanceThresholdSetting = json_object_dotget_object(desiredProperties, "WaterTankCapacitanceThresholdSetting");
 	if (WaterTankCapacitanceThresholdSetting != NULL) {
 		WaterTankCapacitanceThresholdSettingValue = (int)json_object_get_number(WaterTankCapacitanceThresholdSetting, "value");
-		char* waterTankCapacitanceThresholdSettingBuffer = malloc(7);
-		snprintf(waterTankCapacitanceThresholdSettingBuffer, 6, "%d", WaterTankCapacitanceThresholdSettingValue);
+		char waterTankCapacitanceThresholdSettingBuffer[12];
+		FormatInteger(waterTankCapacitanceThresholdSettingBuffer, sizeof(waterTankCapacitanceThresholdSettingBuffer), WaterTankCapacitanceThresholdSettingValue);
 		TwinReportStringState("WaterTankCapacitanceThresholdSetting", waterTankCapacitanceThresholdSettingBuffer);
 	}
 
 cleanup:
     // Release the allocated memory.
     json_value_free(rootProperties);
-    free(nullTerminatedJsonString);
+    ReleaseTwinPayload(nullTerminatedJsonString);
 }
 
 void ParseHourMinuteFromJson(JSON_Object* Relay2OnTimeSetting, int *hours, int *minutes)
 {
-	size_t nullTerminatedJsonDateTimeSize = 24 + 1;
 	int jsonDateTimeHourStartIndex = 11;
 	int jsonDateTimeMinuteStartIndex = 14;
 	char relay2OnTimeHourBuffer[2 + 1] = "00";
 	char relay2OnTimeMinuteBuffer[2 + 1] = "00";
-	char* nullTerminatedRelay2OnDateTime = (char*)malloc(nullTerminatedJsonDateTimeSize);
-	// Copy the provided buffer to a null terminated buffer.
-	memcpy(nullTerminatedRelay2OnDateTime, json_object_get_string(Relay2OnTimeSetting, "value"), nullTerminatedJsonDateTimeSize);
-	// Add the null terminator at the end.
-	nullTerminatedRelay2OnDateTime[nullTerminatedJsonDateTimeSize - 1] = 0;
-	memcpy(relay2OnTimeHourBuffer, &nullTerminatedRelay2OnDateTime[jsonDateTimeHourStartIndex], 2);
-	memcpy(relay2OnTimeMinuteBuffer, &nullTerminatedRelay2OnDateTime[jsonDateTimeMinuteStartIndex], 2);
+	const char* relay2OnDateTime = json_object_get_string(Relay2OnTimeSetting, "value");
+	// Expects an ISO 8601 date time, e.g. 2019-12-01T07:30:00.000Z.
+	if (relay2OnDateTime == NULL || strlen(relay2OnDateTime) < (size_t)jsonDateTimeMinuteStartIndex + 2) {
+		Log_Debug("WARNING: Invalid date time, using 00:00\n");
+	}
+	else {
+		memcpy(relay2OnTimeHourBuffer, &relay2OnDateTime[jsonDateTimeHourStartIndex], 2);
+		memcpy(relay2OnTimeMinuteBuffer, &relay2OnDateTime[jsonDateTimeMinuteStartIndex], 2);
+	}
 	*hours = atoi(relay2OnTimeHourBuffer);
 	*minutes = atoi(relay2OnTimeMinuteBuffer);
-	free(nullTerminatedRelay2OnDateTime);
 }
 
 /// <summary>
@@ -1048,14 +2001,44 @@ static void EnableRelay2WorkingHours(void)
 	}
 }
 
+/// <summary>
+///     Send the relay 1 state if it changed since it was last sent, or the heartbeat is due.
+/// </summary>
 static void SendTelemetryRelay1(void)
 {
-	SendTelemetry("Relay1State", relaystate(relaysState, relay1_rd) == 1 ? "On" : "Off");
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int on = relaystate(relaysState, relay1_rd) == 1;
+	if (ShouldSendTelemetrySignal(&relay1StateSignal, &relayStateTelemetryPolicy, on, &now)) {
+		SendTelemetry("Relay1State", on ? "On" : "Off");
+	}
 }
 
+/// <summary>
+///     Send the relay 2 state if it changed since it was last sent, or the heartbeat is due.
+/// </summary>
 static void SendTelemetryRelay2(void)
 {
-	SendTelemetry("Relay2State", relaystate(relaysState, relay2_rd) == 1 ? "On" : "Off");
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int on = relaystate(relaysState, relay2_rd) == 1;
+	if (ShouldSendTelemetrySignal(&relay2StateSignal, &relayStateTelemetryPolicy, on, &now)) {
+		SendTelemetry("Relay2State", on ? "On" : "Off");
+	}
+}
+
+/// <summary>
+///     Forget the values sent of every signal, so that each is sent with its next value.
+/// </summary>
+static void ResetTelemetrySignals(void)
+{
+	for (int i = 0; i < SOILSENSOR_REGISTRY_MAX_SENSORS; i++)
+	{
+		InitTelemetrySignal(&soilSensorCapacitanceSignals[i]);
+		InitTelemetrySignal(&soilSensorTemperatureSignals[i]);
+	}
+	InitTelemetrySignal(&relay1StateSignal);
+	InitTelemetrySignal(&relay2StateSignal);
 }
 
 /// <summary>
@@ -1115,45 +2098,181 @@ static const char *getAzureSphereProvisioningResultString(
 }
 
 /// <summary>
-///     Sends telemetry to IoT Hub
+///     Queues telemetry for IoT Hub in telemetryBatch. The batch is sent at the end of the
+///     Azure tick, or after telemetryBatchMaxDelay when queued in between.
 /// </summary>
 /// <param name="key">The telemetry item to update</param>
 /// <param name="value">new telemetry value</param>
 static void SendTelemetry(const unsigned char *key, const unsigned char *value)
 {
-    static char eventBuffer[100] = {0};
-    static const char *EventMsgTemplate = "{ \"%s\": \"%s\" }";
-    int len = snprintf(eventBuffer, sizeof(eventBuffer), EventMsgTemplate, key, value);
-    if (len < 0)
+    bool wasEmpty = IsTelemetryBatchEmpty(&telemetryBatch);
+    if (AddTelemetryBatchItem(&telemetryBatch, key, value) != 0) {
+        Log_Debug("WARNING: telemetry item %s does not fit in a message, dropping it\n", key);
+        return;
+    }
+
+    if (wasEmpty) {
+        SetSoftTimerToSingleExpiry(&timerWheel, &telemetryBatchTimer, &telemetryBatchMaxDelay);
+    }
+}
+
+/// <summary>
+///     Queues a numeric reading like <see cref="SendTelemetry" />. JSON sends it as text, as
+///     before; CBOR as a number.
+/// </summary>
+/// <param name="key">The telemetry item to update</param>
+/// <param name="value">Value in units of 10^-decimals</param>
+/// <param name="decimals">Number of digits after the decimal point</param>
+static void SendTelemetryFixedPoint(const char *key, int32_t value, int decimals)
+{
+    bool wasEmpty = IsTelemetryBatchEmpty(&telemetryBatch);
+    if (AddTelemetryBatchFixedPoint(&telemetryBatch, key, value, decimals) != 0) {
+        Log_Debug("WARNING: telemetry item %s does not fit in a message, dropping it\n", key);
+        return;
+    }
+
+    if (wasEmpty) {
+        SetSoftTimerToSingleExpiry(&timerWheel, &telemetryBatchTimer, &telemetryBatchMaxDelay);
+    }
+}
+
+/// <summary>
+///     Sends the queued telemetry now, see <see cref="SendTelemetry" />.
+/// </summary>
+/// <param name="reason">Why the batch is sent, for the statistics</param>
+static void FlushTelemetry(TelemetryBatchFlushReason reason)
+{
+    CancelSoftTimer(&timerWheel, &telemetryBatchTimer);
+    FlushTelemetryBatch(&telemetryBatch, reason);
+}
+
+/// <summary>
+///     Sends a telemetry message to IoT Hub. Called by telemetryBatch with each batch.
+/// </summary>
+/// <param name="data">The encoded message</param>
+/// <param name="length">Length of the message in bytes</param>
+/// <param name="encoder">Encoder of the message</param>
+/// <param name="context">Unused</param>
+static void SendTelemetryMessage(const uint8_t *data, size_t length, const TelemetryEncoder *encoder, void *context)
+{
+    // Journaled messages go first, so telemetry is forwarded in the order it was produced.
+    if (telemetryJournalFd >= 0 &&
+        (!iothubAuthenticated || GetTelemetryJournalPendingCount(&telemetryJournal) > 0)) {
+        JournalTelemetryMessage(data, length, encoder);
         return;
+    }
 
-    Log_Debug("Sending IoT Hub Message: %s\n", eventBuffer);
+    if (SendIoTHubMessage(data, length, encoder, -1, NULL) != 0 && telemetryJournalFd >= 0) {
+        JournalTelemetryMessage(data, length, encoder);
+    }
+}
 
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(eventBuffer);
+/// <summary>
+///     Sets the maximum telemetry message size. While the journal is open it is capped to the
+///     journal's record payload, so that any batch can be journaled while offline.
+/// </summary>
+/// <param name="maxSize">The requested maximum size in bytes</param>
+/// <returns>The maximum size in effect</returns>
+static size_t SetTelemetryMaxMessageSize(size_t maxSize)
+{
+    if (telemetryJournalFd >= 0 && maxSize > TELEMETRY_JOURNAL_PAYLOAD_SIZE) {
+        maxSize = TELEMETRY_JOURNAL_PAYLOAD_SIZE;
+    }
+    return SetTelemetryBatchMaxSize(&telemetryBatch, maxSize);
+}
+
+/// <summary>
+///     Logs a telemetry message: JSON as text, other encodings by size.
+/// </summary>
+static void LogTelemetryMessage(const char *action, const uint8_t *data, size_t length, const TelemetryEncoder *encoder)
+{
+    if (encoder->encoding == TelemetryEncoding_Json) {
+        Log_Debug("%s IoT Hub Message: %.*s\n", action, (int)length, (const char *)data);
+    } else {
+        Log_Debug("%s IoT Hub Message: %zu bytes of %s\n", action, length, encoder->contentType);
+    }
+}
+
+/// <summary>
+///     Appends a telemetry message to the journal, to be forwarded once connected.
+/// </summary>
+/// <param name="data">The encoded message</param>
+/// <param name="length">Length of the message in bytes</param>
+/// <param name="encoder">Encoder of the message, stored with it</param>
+static void JournalTelemetryMessage(const uint8_t *data, size_t length, const TelemetryEncoder *encoder)
+{
+    if (AppendTelemetryJournal(&telemetryJournal, data, length, (uint16_t)encoder->encoding, (int64_t)time(NULL)) != 0) {
+        LogTelemetryMessage("WARNING: could not journal telemetry, dropping", data, length, encoder);
+        return;
+    }
+    Log_Debug("INFO: %u journaled messages to forward\n", GetTelemetryJournalPendingCount(&telemetryJournal));
+    LogTelemetryMessage("Journaled", data, length, encoder);
+}
+
+/// <summary>
+///     Hands a message to the IoT Hub client, with the content type of its encoding.
+/// </summary>
+/// <param name="data">The encoded message</param>
+/// <param name="length">Length of the message in bytes</param>
+/// <param name="encoder">Encoder of the message</param>
+/// <param name="creationTime">CLOCK_REALTIME seconds when a replayed message was created, set
+/// as its iothub-creation-time-utc property, or -1 for a live message</param>
+/// <param name="context">Passed to SendMessageCallback: the journal sequence of a replayed
+/// message, or NULL</param>
+/// <returns>0 if the client accepted the message, or -1</returns>
+static int SendIoTHubMessage(const uint8_t *data, size_t length, const TelemetryEncoder *encoder,
+                             int64_t creationTime, void *context)
+{
+    LogTelemetryMessage("Sending", data, length, encoder);
+
+    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromByteArray(data, length);
 
     if (messageHandle == 0) {
         Log_Debug("WARNING: unable to create a new IoTHubMessage\n");
-        return;
+        return -1;
+    }
+
+    IoTHubMessage_SetContentTypeSystemProperty(messageHandle, encoder->contentType);
+    if (encoder->contentEncoding != NULL) {
+        IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, encoder->contentEncoding);
+    }
+
+    if (creationTime >= 0) {
+        time_t creationSeconds = (time_t)creationTime;
+        struct tm creationUtc;
+        char creationTimeText[24];
+        if (gmtime_r(&creationSeconds, &creationUtc) != NULL &&
+            strftime(creationTimeText, sizeof(creationTimeText), "%Y-%m-%dT%H:%M:%SZ", &creationUtc) > 0) {
+            IoTHubMessage_SetProperty(messageHandle, "iothub-creation-time-utc", creationTimeText);
+        }
     }
 
+    int result = 0;
     if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
-                                             /*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
+                                             context) != IOTHUB_CLIENT_OK) {
         Log_Debug("WARNING: failed to hand over the message to IoTHubClient\n");
+        result = -1;
     } else {
         Log_Debug("INFO: IoTHubClient accepted the message for delivery\n");
     }
 
     IoTHubMessage_Destroy(messageHandle);
+    return result;
 }
 
 /// <summary>
-///     Callback confirming message delivered to IoT Hub.
+///     Callback confirming message delivered to IoT Hub. Records the outcome of replayed
+///     journal messages; a failure replays them again.
 /// </summary>
 /// <param name="result">Message delivery status</param>
-/// <param name="context">User specified context</param>
+/// <param name="context">The journal sequence of a replayed message, or NULL</param>
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
     //Log_Debug("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    if (context != NULL && telemetryJournalFd >= 0) {
+        AcknowledgeTelemetryJournalRecord(&telemetryJournal, (uint32_t)(uintptr_t)context,
+                                          result == IOTHUB_CLIENT_CONFIRMATION_OK);
+    }
 }
 
 /// <summary>
@@ -1168,20 +2287,29 @@ static void TwinReportBoolState(const char *propertyName, bool propertyValue)
     if (iothubClientHandle == NULL) {
         Log_Debug("ERROR: client not initialized\n");
     } else {
-        static char reportedPropertiesString[30] = {0};
-        int len = snprintf(reportedPropertiesString, 30, "{\"%s\":%s}", propertyName,
-                           (propertyValue == true ? "true" : "false"));
-        if (len < 0)
+        // The SDK copies the report, so the buffer goes back to the pool once it is queued.
+        size_t size = strlen(propertyName) + sizeof("{\"\":false}");
+        char *reportedPropertiesString = AcquireMessageBuffer(&messagePool, size);
+        if (reportedPropertiesString == NULL) {
+            Log_Debug("ERROR: No message buffer to report '%s'.\n", propertyName);
             return;
+        }
+        int len = FormatMessage(&messagePool, reportedPropertiesString, size, "{\"%s\":%s}",
+                                propertyName, (propertyValue == true ? "true" : "false"));
+        if (len < 0) {
+            ReleaseMessageBuffer(&messagePool, reportedPropertiesString);
+            return;
+        }
 
         if (IoTHubDeviceClient_LL_SendReportedState(
                 iothubClientHandle, (unsigned char *)reportedPropertiesString,
-                strlen(reportedPropertiesString), ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
+                (size_t)len, ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
             Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
         } else {
             Log_Debug("INFO: Reported state for '%s' to value '%s'.\n", propertyName,
                       (propertyValue == true ? "true" : "false"));
         }
+        ReleaseMessageBuffer(&messagePool, reportedPropertiesString);
     }
 }
 
@@ -1198,21 +2326,30 @@ static void TwinReportStringState(const unsigned char* propertyName, const unsig
 		Log_Debug("ERROR: client not initialized\n");
 	}
 	else {
-		static char reportedPropertiesString[60] = { 0 };
-		int len = snprintf(reportedPropertiesString, 60, "{\"%s\":\"%s\"}", propertyName,
+		// The SDK copies the report, so the buffer goes back to the pool once it is queued.
+		size_t size = strlen((const char*)propertyName) + strlen((const char*)propertyValue) + sizeof("{\"\":\"\"}");
+		char* reportedPropertiesString = AcquireMessageBuffer(&messagePool, size);
+		if (reportedPropertiesString == NULL) {
+			Log_Debug("ERROR: No message buffer to report '%s'.\n", propertyName);
+			return;
+		}
+		int len = FormatMessage(&messagePool, reportedPropertiesString, size, "{\"%s\":\"%s\"}", propertyName,
 			propertyValue);
-		if (len < 0)
+		if (len < 0) {
+			ReleaseMessageBuffer(&messagePool, reportedPropertiesString);
 			return;
+		}
 		Log_Debug("Sending IoT Hub Message Reported state: %s\n", reportedPropertiesString);
 		if (IoTHubDeviceClient_LL_SendReportedState(
 			iothubClientHandle, (unsigned char*)reportedPropertiesString,
-			strlen(reportedPropertiesString), ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
+			(size_t)len, ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
 			Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
 		}
 		else {
 			Log_Debug("INFO: Reported state for '%s' to value '%s'.\n", propertyName,
 				propertyValue);
 		}
+		ReleaseMessageBuffer(&messagePool, reportedPropertiesString);
 	}
 }
 
@@ -1224,60 +2361,265 @@ static void ReportStatusCallback(int result, void *context)
     Log_Debug("INFO: Device Twin reported properties update result: HTTP status code %d\n", result);
 }
 
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
 /// <summary>
-///     Collect sensor readings and send to IoT Central.
+/// Soil sensor sampler event: Move published samples into the sample cache.
 /// </summary>
-void SendTelemetryMoisture(void)
+static void SoilSensorSamplerEventHandler(EventData* eventData)
+{
+	if (ConsumeTimerFdEvent(soilSensorSamplerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+	SoilSensorSample sample;
+	while (PopSoilSensorSample(&soilSensorSampleRing, &sample))
+	{
+		StoreSoilSensorSample(&sample);
+	}
+}
+#else
+/// <summary>
+/// Soil sensor measurement timer event: Start the light measurement when it is due, then a
+/// measurement of every sensor which is neither being measured, converting light, settling
+/// after a reset nor quarantined. Conversions of all sensors run concurrently.
+/// </summary>
+static void SoilSensorMeasurementTimerEventHandler(EventData* eventData)
 {
-	for (int i = 0; i < 3; i++)
+	// Only read sensors when motor is idle. The motor generates a lot of noise, see project description.
+	if (relaystate(relaysState, relay1_rd))
 	{
-		float sensorTemperature = -1;
-		unsigned int sensorCapacitance = 0;
+		return;
+	}
 
+	// Measurements of the last period have completed by now unless a sensor hangs, in which
+	// case the light measurement waits for the next period.
+	bool measurementRunning = false;
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		measurementRunning |= IsSoilSensorMeasurementRunning(&soilSensorMeasurements[i]);
+	}
+	if (soilSensorLightDue && !measurementRunning && !IsSoilSensorLightMeasurementRunning(&soilSensorLightMeasurement))
+	{
+		soilSensorLightDue = false;
+		soilSensorLightMeasurement.sleepAfterRead = soilSensorSleepEnabled;
+		StartSoilSensorLightMeasurement(&timerWheel, &soilSensorLightMeasurement);
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
+		if (!IsSoilSensorMeasurementRunning(&soilSensorMeasurements[i])
+			&& !IsSoilSensorLightPending(&soilSensorLightMeasurement, i)
+			&& IsSoilSensorAvailable(&soilSensorHealth[i], &now))
+		{
+			soilSensorMeasurements[i].sleepAfterRead = soilSensorSleepEnabled;
+			if (StartSoilSensorMeasurement(&timerWheel, &soilSensorMeasurements[i]) != 0)
+			{
+				UpdateSoilSensorHealthFromEventLoop(i, false);
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Soil sensor measurement completed: Advance the sensor's recovery ladder and store the
+/// sample, unless the pump started meanwhile and the bus was noisy.
+/// </summary>
+static void SoilSensorMeasurementCompleted(SoilSensorMeasurement* measurement,
+	SoilSensorMeasurementStatus status, const SoilSensorSample* sample)
+{
+	if (relaystate(relaysState, relay1_rd))
+	{
+		return;
+	}
+
+	int sensorIndex = (int)(measurement - soilSensorMeasurements);
+	bool ok = status == SoilSensorMeasurementStatus_Ok && IsSoilSensorSamplePlausible(sample);
+	UpdateSoilSensorHealthFromEventLoop(sensorIndex, ok);
+	if (status == SoilSensorMeasurementStatus_Ok)
+	{
+		StoreSoilSensorSample(sample);
+	}
+}
+
+/// <summary>
+/// Record the outcome of reading a sensor and reset it if its recovery ladder says so.
+/// </summary>
+static void UpdateSoilSensorHealthFromEventLoop(int sensorIndex, bool ok)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	SoilSensorHealthState previousState = soilSensorHealth[sensorIndex].state;
+	I2C_DeviceAddress address = soilSensorRegistry.addresses[sensorIndex];
+
+	if (UpdateSoilSensorHealth(&soilSensorHealth[sensorIndex], ok, &now) == SoilSensorHealthAction_Reset)
+	{
+		// A sleeping sensor ignores the transfer which wakes it, so wait until it is up.
+		static const struct timespec wakePeriod = { 0, SOILMOISTURESENSOR_WAKE_MS * 1000 * 1000 };
+		if (WakeManagedSoilSensor(address, &soilSensorPowerStates[sensorIndex]))
+		{
+			nanosleep(&wakePeriod, NULL);
+		}
+		ResetSoilSensor(address);
+	}
+	if (soilSensorHealth[sensorIndex].state != previousState)
+	{
+		Log_Debug("Soil sensor (Address: %X) %s -> %s\n", address, SoilSensorHealthStateToString(previousState),
+			SoilSensorHealthStateToString(soilSensorHealth[sensorIndex].state));
+	}
+}
+
+/// <summary>
+/// Soil sensor light measurement of one sensor completed: Store the reading.
+/// </summary>
+static void SoilSensorLightMeasured(SoilSensorLightMeasurement* measurement, int sensorIndex,
+	const SoilSensorSample* sample)
+{
+	StoreSoilSensorSample(sample);
+}
+#endif
+
+/// <summary>
+/// Soil sensor light timer event: Ask for a light measurement of all sensors.
+/// </summary>
+static void SoilSensorLightTimerEventHandler(EventData* eventData)
+{
+#ifdef SOIL_SENSOR_SAMPLING_THREAD
+	RequestSoilSensorSamplerLight();
+#else
+	soilSensorLightDue = true;
+#endif
+}
+
+/// <summary>
+///     Store a new reading of a sensor in the sample cache, with its capacitance filtered, or
+///     a light reading in the light cache unless the lamp is on.
+/// </summary>
+static void StoreSoilSensorSample(const SoilSensorSample* sample)
+{
+	if (sample->hasLight)
+	{
+		if (!relaystate(relaysState, relay2_rd))
+		{
+			UpdateSoilSensorSampleCache(&soilSensorLightCache, sample);
+		}
+		return;
+	}
+
+	int sensorIndex = FindSoilSensor(&soilSensorRegistry, sample->address);
+	if (sensorIndex < 0)
+	{
+		Log_Debug("WARNING: Soil sensor sample from unexpected address %X\n", sample->address);
+		return;
+	}
+
+	// Readings the recovery ladder counts as failed are not cached, so the last good one is used
+	// until it is too old.
+	if (!IsSoilSensorSamplePlausible(sample))
+	{
+		if (sample->hasTemperature || sample->hasCapacitance)
+		{
+			Log_Debug("WARNING: Soil sensor (Address: %X) reading out of range: temperature %d, capacitance %u\n",
+				sample->address, sample->temperatureDeciC, sample->capacitance);
+		}
+		return;
+	}
+	SoilSensorSample filtered = *sample;
+	if (filtered.hasCapacitance
+		&& !UpdateSoilSensorFilter(&soilSensorCapacitanceFilters[sensorIndex], &filtered.capacitance))
+	{
+		Log_Debug("WARNING: Soil sensor (Address: %X) capacitance glitch: %u\n", sample->address, sample->capacitance);
+		filtered.hasCapacitance = false;
+	}
+	if (!filtered.hasTemperature && !filtered.hasCapacitance)
+	{
+		return;
+	}
+	UpdateSoilSensorSampleCache(&soilSensorSampleCache, &filtered);
+	RecordStartupMilestone(&firstSampleMs, "First soil sensor sample");
+}
+
+/// <summary>
+///     Get the latest reading of a sensor if it was taken at most maxAgeMs ago.
+/// </summary>
+/// <returns>false if no fresh reading is available</returns>
+static bool GetSoilSensorSample(int sensorIndex, long maxAgeMs, SoilSensorSample* sample)
+{
+	return GetCachedSoilSensorSample(&soilSensorSampleCache, sensorIndex, maxAgeMs, sample);
+}
+
+/// <summary>
+///     Get the capacitance of a sensor for the watering decision, see GetSoilSensorSample.
+/// </summary>
+/// <returns>false if no fresh capacitance reading is available</returns>
+static bool GetSoilSensorCapacitance(int sensorIndex, uint16_t* capacitance)
+{
+	SoilSensorSample sample;
+	if (!GetSoilSensorSample(sensorIndex, SoilSensorControlMaxAgeMs, &sample) || !sample.hasCapacitance)
+	{
+		return false;
+	}
+	*capacitance = sample.capacitance;
+	return true;
+}
+
+/// <summary>
+///     Collect sensor readings and send those which moved past their deadband, or whose
+///     heartbeat is due, to IoT Central. Readings stay integers up to here and are formatted
+///     without printf.
+/// </summary>
+void SendTelemetryMoisture(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < soilSensorRegistry.count; i++)
+	{
 		// Only read sensors when motor is idle. The motor generates a lot of noise, see project description.
 		if (!relaystate(relaysState, relay1_rd))
 		{
-			if (IsBusy(moistureSensorsAddresses[i]))
+			SoilSensorSample sample;
+			if (!GetSoilSensorSample(i, SoilSensorTelemetryMaxAgeMs, &sample))
+			{
+				Log_Debug("Soil sensor (Address: %X) has no recent reading\n", soilSensorRegistry.addresses[i]);
+				continue;
+			}
+
+			// Tenths of a degree, only formatted for the log: at most "-3276.8".
+			char temperatureText[8];
+			if (!sample.hasTemperature)
 			{
 				Log_Debug("Soil sensor is busy\n");
 			}
 			else {
-				sensorTemperature = GetTemperature(moistureSensorsAddresses[i]);
-				if (sensorTemperature > 1000) {
-					// Must be false reading, restart sensor.
-					Log_Debug("ERROR: Soil sensor (Address: %X) temperature: %.1f\n", moistureSensorsAddresses[i], sensorTemperature);
-					terminationRequired = true;
-					return;
-				}
-				Log_Debug("Soil sensor (Address: %X) temperature: %.1f\n", moistureSensorsAddresses[i], sensorTemperature);
+				// Out of range readings were already dropped and the sensor's recovery ladder advanced.
+				FormatFixedPoint(temperatureText, sizeof(temperatureText), sample.temperatureDeciC, 1);
+				Log_Debug("Soil sensor (Address: %X) temperature: %s\n", soilSensorRegistry.addresses[i], temperatureText);
 			}
-			if (IsBusy(moistureSensorsAddresses[i]))
+			if (!sample.hasCapacitance)
 			{
 				Log_Debug("Soil sensor is busy\n");
 			}
 			else {
-				sensorCapacitance = GetCapacitance(moistureSensorsAddresses[i]);
-				if (sensorCapacitance > 1000) {
-					// Must be false reading, restart sensor.
-					Log_Debug("ERROR: Soil sensor (Address: %X) temperature: %.1f\n", moistureSensorsAddresses[i], sensorTemperature);
-					terminationRequired = true;
-					return;
-				}
-				Log_Debug("Soil sensor (Address: %X) capacitance: %u\n", moistureSensorsAddresses[i], sensorCapacitance);
+				// Glitches were already rejected by the capacitance filter.
+				Log_Debug("Soil sensor (Address: %X) capacitance: %u\n", soilSensorRegistry.addresses[i], sample.capacitance);
 			}
 
-			if (sensorTemperature > -1) {
-				char tempBuffer[20] = { 0 };
-				int len = snprintf(tempBuffer, 20, "%3.1f", sensorTemperature);
-				if (len > 0)
-					SendTelemetry(temperatureSensorNames[i], tempBuffer);
+			if (sample.hasTemperature
+				&& ShouldSendTelemetrySignal(&soilSensorTemperatureSignals[i], &temperatureTelemetryPolicy, sample.temperatureDeciC, &now)) {
+				char name[24];
+				FormatSoilSensorName(&soilSensorRegistry, i, "Temperature", name, sizeof(name));
+				SendTelemetryFixedPoint(name, sample.temperatureDeciC, 1);
+				RecordStartupMilestone(&firstTelemetryMs, "First soil sensor telemetry");
 			}
 
-			if (sensorCapacitance > 0) {
-				char tempBuffer[20] = { 0 };
-				int len = snprintf(tempBuffer, 20, "%u", sensorCapacitance);
-				if (len > 0)
-					SendTelemetry(capacitanceSensorNames[i], tempBuffer);
+			if (sample.hasCapacitance && sample.capacitance > 0
+				&& ShouldSendTelemetrySignal(&soilSensorCapacitanceSignals[i], &capacitanceTelemetryPolicy, sample.capacitance, &now)) {
+				char name[24];
+				FormatSoilSensorName(&soilSensorRegistry, i, "Capacitance", name, sizeof(name));
+				SendTelemetryFixedPoint(name, sample.capacitance, 0);
+				RecordStartupMilestone(&firstTelemetryMs, "First soil sensor telemetry");
 			}
 		}
 		else {
@@ -1286,38 +2628,13 @@ void SendTelemetryMoisture(void)
 	}
 }
 
-/// <summary>
-///     Check whether a given button has just been pressed.
-/// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>true if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
-{
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        terminationRequired = true;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
-    }
-
-    return isButtonPressed;
-}
-
 /// <summary>
 /// Pressing button A will:
 ///     Send a 'Button Pressed' event to Azure IoT Central
 /// </summary>
 static void SendMessageButtonHandler(void)
 {
-    if (IsButtonPressed(sendMessageButtonGpioFd, &sendMessageButtonState)) {
-        SendTelemetry("ButtonPress", "True");
-    }
+    SendTelemetry("ButtonPress", "True");
 }
 
 /// <summary>
@@ -1326,23 +2643,15 @@ static void SendMessageButtonHandler(void)
 /// </summary>
 static void SendOrientationButtonHandler(void)
 {
-    if (IsButtonPressed(sendOrientationButtonGpioFd, &sendOrientationButtonState)) {
-        deviceIsUp = !deviceIsUp;
-        SendTelemetry("Orientation", deviceIsUp ? "Up" : "Down");
-    }
+    deviceIsUp = !deviceIsUp;
+    SendTelemetry("Orientation", deviceIsUp ? "Up" : "Down");
 }
 
 /// <summary>
 /// Change address of a soil sensor. Do not change addresses with more than 
-/// one sensor connected with the same address.
+/// one sensor connected with the same address. The caller must own the I2C bus.
 /// </summary>
-static void ChangeSoilMoistureI2cAddress(I2C_DeviceAddress originAddress, I2C_DeviceAddress desiredAddress)
+static I2CStatus ChangeSoilMoistureI2cAddress(I2C_DeviceAddress originAddress, I2C_DeviceAddress desiredAddress)
 {
-	SetAddress(originAddress, desiredAddress, true);
-	//GetAddress(originAddress);
-	//GetAddress(desiredAddress);
-	while(true)
-	{
-		// Program should not continue, stop and update new addresses.
-	}
+	return ChangeSoilSensorAddress(originAddress, desiredAddress, 1000);
 }
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include "message_pool.h"
+#include <stdio.h>
+#include <string.h>
+
+static const size_t classSizes[MessagePoolClass_Count] = {
+    MESSAGE_POOL_SMALL_SIZE, MESSAGE_POOL_MEDIUM_SIZE, MESSAGE_POOL_LARGE_SIZE};
+static const unsigned int classCounts[MessagePoolClass_Count] = {
+    MESSAGE_POOL_SMALL_COUNT, MESSAGE_POOL_MEDIUM_COUNT, MESSAGE_POOL_LARGE_COUNT};
+
+static uint8_t *ClassStorage(const MessagePool *pool, MessagePoolClass poolClass)
+{
+    switch (poolClass) {
+    case MessagePoolClass_Small:
+        return (uint8_t *)pool->smallBuffers;
+    case MessagePoolClass_Medium:
+        return (uint8_t *)pool->mediumBuffers;
+    default:
+        return (uint8_t *)pool->largeBuffers;
+    }
+}
+
+// Finds the class and index of a pool buffer. Returns false if buffer is not one.
+static bool FindBuffer(const MessagePool *pool, const void *buffer, MessagePoolClass *poolClass,
+                       unsigned int *index)
+{
+    const uint8_t *address = buffer;
+    for (int c = 0; c < MessagePoolClass_Count; c++) {
+        const uint8_t *storage = ClassStorage(pool, (MessagePoolClass)c);
+        size_t classBytes = classSizes[c] * classCounts[c];
+        if (address >= storage && address < storage + classBytes &&
+            (size_t)(address - storage) % classSizes[c] == 0) {
+            *poolClass = (MessagePoolClass)c;
+            *index = (unsigned int)((size_t)(address - storage) / classSizes[c]);
+            return true;
+        }
+    }
+    return false;
+}
+
+void InitMessagePool(MessagePool *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+}
+
+void *AcquireMessageBuffer(MessagePool *pool, size_t size)
+{
+    bool fitted = false;
+    for (int c = 0; c < MessagePoolClass_Count; c++) {
+        if (size > classSizes[c]) {
+            continue;
+        }
+        for (unsigned int i = 0; i < classCounts[c]; i++) {
+            if (!(pool->inUseMasks[c] & (1u << i))) {
+                MessagePoolClassStats *stats = &pool->stats[c];
+                pool->inUseMasks[c] |= 1u << i;
+                stats->acquireCount++;
+                if (++stats->inUse > stats->highWaterMark) {
+                    stats->highWaterMark = stats->inUse;
+                }
+                return ClassStorage(pool, (MessagePoolClass)c) + i * classSizes[c];
+            }
+        }
+        // Only the smallest fitting class counts as exhausted; larger ones are a fallback.
+        if (!fitted) {
+            pool->stats[c].exhaustedCount++;
+        }
+        fitted = true;
+    }
+
+    pool->failedCount++;
+    return NULL;
+}
+
+void ReleaseMessageBuffer(MessagePool *pool, void *buffer)
+{
+    MessagePoolClass poolClass;
+    unsigned int index;
+    if (buffer == NULL || !FindBuffer(pool, buffer, &poolClass, &index) ||
+        !(pool->inUseMasks[poolClass] & (1u << index))) {
+        return;
+    }
+    pool->inUseMasks[poolClass] &= ~(1u << index);
+    pool->stats[poolClass].inUse--;
+}
+
+bool IsMessagePoolBuffer(const MessagePool *pool, const void *buffer)
+{
+    MessagePoolClass poolClass;
+    unsigned int index;
+    return buffer != NULL && FindBuffer(pool, buffer, &poolClass, &index);
+}
+
+size_t GetMessagePoolClassSize(MessagePoolClass poolClass)
+{
+    return (unsigned int)poolClass < MessagePoolClass_Count ? classSizes[poolClass] : 0;
+}
+
+int FormatMessageV(MessagePool *pool, char *buffer, size_t size, const char *format, va_list args)
+{
+    int length = vsnprintf(buffer, size, format, args);
+    if (length < 0) {
+        return -1;
+    }
+    if ((size_t)length >= size) {
+        pool->truncatedCount++;
+        return -1;
+    }
+    return length;
+}
+
+int FormatMessage(MessagePool *pool, char *buffer, size_t size, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = FormatMessageV(pool, buffer, size, format, args);
+    va_end(args);
+    return length;
+}
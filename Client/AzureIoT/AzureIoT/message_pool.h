@@ -0,0 +1,108 @@
+#pragma once
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Buffer size and number of buffers of each capacity class of a <see cref="MessagePool" />,
+///     at most 32 buffers per class. Small holds reported properties and command contexts,
+///     medium direct method payloads, large Device Twin updates.
+/// </summary>
+#define MESSAGE_POOL_SMALL_SIZE 64
+#define MESSAGE_POOL_SMALL_COUNT 8
+#define MESSAGE_POOL_MEDIUM_SIZE 512
+#define MESSAGE_POOL_MEDIUM_COUNT 4
+#define MESSAGE_POOL_LARGE_SIZE 4096
+#define MESSAGE_POOL_LARGE_COUNT 2
+
+/// <summary>
+///     Capacity classes of a <see cref="MessagePool" />, smallest first.
+/// </summary>
+typedef enum {
+    MessagePoolClass_Small,
+    MessagePoolClass_Medium,
+    MessagePoolClass_Large,
+    MessagePoolClass_Count
+} MessagePoolClass;
+
+/// <summary>
+///     Usage of one capacity class.
+/// </summary>
+typedef struct MessagePoolClassStats {
+    unsigned int inUse;
+    unsigned int highWaterMark;
+    uint32_t acquireCount;
+    /// <summary>
+    /// Requests which fitted the class but found every buffer in use; they are served from a
+    /// larger class if one is free.
+    /// </summary>
+    uint32_t exhaustedCount;
+} MessagePoolClassStats;
+
+/// <summary>
+/// <para>Preallocated message buffers in fixed capacity classes, so that messages are built
+/// without heap allocations and the heap of a long running device does not fragment.</para>
+/// <para>A request is served by the smallest class whose buffers are large enough, or the next
+/// larger class if they are all in use. The pool is not thread safe and must only be used from
+/// the event loop thread.</para>
+/// </summary>
+typedef struct MessagePool {
+    uint8_t smallBuffers[MESSAGE_POOL_SMALL_COUNT][MESSAGE_POOL_SMALL_SIZE];
+    uint8_t mediumBuffers[MESSAGE_POOL_MEDIUM_COUNT][MESSAGE_POOL_MEDIUM_SIZE];
+    uint8_t largeBuffers[MESSAGE_POOL_LARGE_COUNT][MESSAGE_POOL_LARGE_SIZE];
+    uint32_t inUseMasks[MessagePoolClass_Count];
+    MessagePoolClassStats stats[MessagePoolClass_Count];
+    /// <summary>
+    /// Requests not served, larger than the largest class or with every fitting buffer in use.
+    /// </summary>
+    uint32_t failedCount;
+    /// <summary>Messages truncated by <see cref="FormatMessage" />.</summary>
+    uint32_t truncatedCount;
+} MessagePool;
+
+/// <summary>
+///     Initializes a message pool with every buffer free.
+/// </summary>
+/// <param name="pool">The pool</param>
+void InitMessagePool(MessagePool *pool);
+
+/// <summary>
+///     Takes a buffer from the pool.
+/// </summary>
+/// <param name="pool">The pool</param>
+/// <param name="size">Bytes needed</param>
+/// <returns>A buffer of at least size bytes, or NULL if none is free</returns>
+void *AcquireMessageBuffer(MessagePool *pool, size_t size);
+
+/// <summary>
+///     Returns a buffer to the pool. NULL is ignored.
+/// </summary>
+/// <param name="pool">The pool</param>
+/// <param name="buffer">A buffer returned by <see cref="AcquireMessageBuffer" /></param>
+void ReleaseMessageBuffer(MessagePool *pool, void *buffer);
+
+/// <summary>
+///     Returns true if buffer belongs to the pool, as opposed to the heap.
+/// </summary>
+bool IsMessagePoolBuffer(const MessagePool *pool, const void *buffer);
+
+/// <summary>
+///     Returns the buffer size of a capacity class.
+/// </summary>
+size_t GetMessagePoolClassSize(MessagePoolClass poolClass);
+
+/// <summary>
+///     Formats a message like vsnprintf, treating truncation as an error.
+/// </summary>
+/// <param name="pool">The pool counting truncated messages</param>
+/// <param name="buffer">Buffer receiving the null terminated message</param>
+/// <param name="size">Size of buffer</param>
+/// <param name="format">printf format</param>
+/// <returns>The length of the message, or -1 if it was truncated or could not be formatted</returns>
+int FormatMessage(MessagePool *pool, char *buffer, size_t size, const char *format, ...);
+
+/// <summary>
+///     va_list variant of <see cref="FormatMessage" />.
+/// </summary>
+int FormatMessageV(MessagePool *pool, char *buffer, size_t size, const char *format, va_list args);
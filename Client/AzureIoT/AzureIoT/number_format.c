@@ -0,0 +1,40 @@
+#include "number_format.h"
+#include <stdbool.h>
+
+int FormatInteger(char *buffer, size_t size, int32_t value)
+{
+    return FormatFixedPoint(buffer, size, value, 0);
+}
+
+int FormatFixedPoint(char *buffer, size_t size, int32_t value, int decimals)
+{
+    // Digits are produced least significant first, into a buffer large enough for any int32_t
+    // with its decimal point and sign.
+    char digits[12];
+    size_t count = 0;
+    bool negative = value < 0;
+    uint32_t magnitude = negative ? 0u - (uint32_t)value : (uint32_t)value;
+
+    do {
+        if (decimals > 0 && count == (size_t)decimals) {
+            digits[count++] = '.';
+        }
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0 || count <= (size_t)decimals);
+
+    size_t length = count + (negative ? 1 : 0);
+    if (length + 1 > size) {
+        return -1;
+    }
+
+    char *out = buffer;
+    if (negative) {
+        *out++ = '-';
+    }
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    *out = '\0';
+    return (int)length;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Formats an integer as decimal digits without going through printf.
+/// </summary>
+/// <param name="buffer">Buffer receiving the null terminated text</param>
+/// <param name="size">Size of buffer, including the terminator</param>
+/// <param name="value">Value to format</param>
+/// <returns>The length of the text, or -1 if it does not fit</returns>
+int FormatInteger(char *buffer, size_t size, int32_t value);
+
+/// <summary>
+///     Formats a fixed-point integer with a number of decimals, e.g. -35 with one decimal as
+///     "-3.5", without going through printf.
+/// </summary>
+/// <param name="buffer">Buffer receiving the null terminated text</param>
+/// <param name="size">Size of buffer, including the terminator</param>
+/// <param name="value">Value in units of 10^-decimals</param>
+/// <param name="decimals">Number of digits after the decimal point, 0 to 9</param>
+/// <returns>The length of the text, or -1 if it does not fit</returns>
+int FormatFixedPoint(char *buffer, size_t size, int32_t value, int decimals);
@@ -0,0 +1,151 @@
+#include "telemetry_batch.h"
+#include <string.h>
+
+// While items are collected the buffer holds the encoder's begin and the items, without its end.
+// Flushing appends the end, whose size is reserved in every size check.
+
+typedef struct TelemetryBatchItem {
+    const char *key;
+    const char *text;
+    int32_t value;
+    int decimals;
+} TelemetryBatchItem;
+
+void InitTelemetryBatch(TelemetryBatch *batch, size_t maxSize, const TelemetryEncoder *encoder,
+                        TelemetryBatchSendHandler sendHandler, void *context)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->encoder = encoder;
+    batch->sendHandler = sendHandler;
+    batch->context = context;
+    SetTelemetryBatchMaxSize(batch, maxSize);
+}
+
+size_t SetTelemetryBatchMaxSize(TelemetryBatch *batch, size_t maxSize)
+{
+    if (maxSize < TELEMETRY_BATCH_MIN_SIZE) {
+        maxSize = TELEMETRY_BATCH_MIN_SIZE;
+    } else if (maxSize > TELEMETRY_BATCH_BUFFER_SIZE) {
+        maxSize = TELEMETRY_BATCH_BUFFER_SIZE;
+    }
+
+    if (batch->length + batch->encoder->endSize > maxSize) {
+        FlushTelemetryBatch(batch, TelemetryBatchFlushReason_Size);
+    }
+    batch->maxSize = maxSize;
+    return maxSize;
+}
+
+void SetTelemetryBatchEncoder(TelemetryBatch *batch, const TelemetryEncoder *encoder)
+{
+    if (encoder != batch->encoder) {
+        FlushTelemetryBatch(batch, TelemetryBatchFlushReason_Tick);
+        batch->encoder = encoder;
+    }
+}
+
+// FNV-1a.
+static uint32_t HashKey(const char *key)
+{
+    uint32_t hash = 2166136261u;
+    for (; *key != '\0'; key++) {
+        hash = (hash ^ (uint8_t)*key) * 16777619u;
+    }
+    return hash;
+}
+
+static bool ContainsKey(const TelemetryBatch *batch, uint32_t keyHash)
+{
+    for (unsigned int i = 0; i < batch->itemCount; i++) {
+        if (batch->keyHashes[i] == keyHash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Encodes an item after the items in the batch, beginning the message if it is empty. Returns
+// false, leaving the batch as it was, if the item does not fit.
+static bool EncodeItem(TelemetryBatch *batch, const TelemetryBatchItem *item)
+{
+    const TelemetryEncoder *encoder = batch->encoder;
+    size_t length = batch->length;
+    if (batch->itemCount == 0) {
+        length = encoder->begin(batch->buffer, batch->maxSize - encoder->endSize);
+        if (length == 0) {
+            return false;
+        }
+    }
+
+    uint8_t *next = batch->buffer + length;
+    size_t available = batch->maxSize - encoder->endSize - length;
+    bool first = batch->itemCount == 0;
+    size_t itemLength =
+        item->text != NULL
+            ? encoder->addText(next, available, first, item->key, item->text)
+            : encoder->addFixedPoint(next, available, first, item->key, item->value, item->decimals);
+    if (itemLength == 0) {
+        return false;
+    }
+
+    batch->length = length + itemLength;
+    return true;
+}
+
+static int AddItem(TelemetryBatch *batch, const TelemetryBatchItem *item)
+{
+    uint32_t keyHash = HashKey(item->key);
+    if (ContainsKey(batch, keyHash)) {
+        FlushTelemetryBatch(batch, TelemetryBatchFlushReason_Key);
+    } else if (batch->itemCount == TELEMETRY_BATCH_MAX_ITEMS) {
+        FlushTelemetryBatch(batch, TelemetryBatchFlushReason_Size);
+    }
+
+    if (!EncodeItem(batch, item)) {
+        if (batch->itemCount == 0) {
+            batch->droppedCount++;
+            return -1;
+        }
+        FlushTelemetryBatch(batch, TelemetryBatchFlushReason_Size);
+        if (!EncodeItem(batch, item)) {
+            batch->droppedCount++;
+            return -1;
+        }
+    }
+
+    batch->keyHashes[batch->itemCount++] = keyHash;
+    return 0;
+}
+
+int AddTelemetryBatchItem(TelemetryBatch *batch, const char *key, const char *value)
+{
+    TelemetryBatchItem item = {.key = key, .text = value};
+    return AddItem(batch, &item);
+}
+
+int AddTelemetryBatchFixedPoint(TelemetryBatch *batch, const char *key, int32_t value, int decimals)
+{
+    TelemetryBatchItem item = {.key = key, .value = value, .decimals = decimals};
+    return AddItem(batch, &item);
+}
+
+void FlushTelemetryBatch(TelemetryBatch *batch, TelemetryBatchFlushReason reason)
+{
+    if (batch->itemCount == 0) {
+        return;
+    }
+
+    batch->length += batch->encoder->end(batch->buffer + batch->length, batch->encoder->endSize);
+    batch->flushCounts[reason]++;
+    batch->itemsSent += batch->itemCount;
+    batch->bytesSent += (uint32_t)batch->length;
+    batch->sendHandler(batch->buffer, batch->length, batch->encoder, batch->context);
+
+    batch->length = 0;
+    batch->itemCount = 0;
+}
+
+bool IsTelemetryBatchEmpty(const TelemetryBatch *batch)
+{
+    return batch->itemCount == 0;
+}
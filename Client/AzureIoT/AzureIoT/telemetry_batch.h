@@ -0,0 +1,126 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "telemetry_encoder.h"
+
+/// <summary>
+///     Capacity of a <see cref="TelemetryBatch" /> buffer, the smallest maximum message size it
+///     accepts, and the most items in one message.
+/// </summary>
+#define TELEMETRY_BATCH_BUFFER_SIZE 1024
+#define TELEMETRY_BATCH_MIN_SIZE 64
+#define TELEMETRY_BATCH_MAX_ITEMS 64
+
+/// <summary>
+///     Function signature for sending a completed batch.
+/// </summary>
+/// <param name="data">The encoded message</param>
+/// <param name="length">Length of the message in bytes</param>
+/// <param name="encoder">The encoder of the message, giving its content type</param>
+/// <param name="context">The context passed to <see cref="InitTelemetryBatch" /></param>
+typedef void (*TelemetryBatchSendHandler)(const uint8_t *data, size_t length,
+                                          const TelemetryEncoder *encoder, void *context);
+
+/// <summary>
+///     Why a batch was sent.
+/// </summary>
+typedef enum {
+    /// <summary>The owner flushed the batch, e.g. at the end of a telemetry tick.</summary>
+    TelemetryBatchFlushReason_Tick,
+    /// <summary>The batch was held for its longest allowed delay.</summary>
+    TelemetryBatchFlushReason_Deadline,
+    /// <summary>The next item would not fit within the maximum message size.</summary>
+    TelemetryBatchFlushReason_Size,
+    /// <summary>The next item has a key already in the batch.</summary>
+    TelemetryBatchFlushReason_Key,
+    TelemetryBatchFlushReason_Count
+} TelemetryBatchFlushReason;
+
+/// <summary>
+/// <para>Collects telemetry key/value pairs into a single message, so that readings taken
+/// together are sent with one IoT Hub publish instead of one publish per key. The message is
+/// encoded by a <see cref="TelemetryEncoder" />, JSON or CBOR.</para>
+/// <para>An item which would push the message past maxSize, or repeat a key, sends the batch
+/// collected so far first. A batch holds one value per key, so consecutive values of a key, such
+/// as an on and an off event, are sent in order in separate messages. The batch is not thread
+/// safe and must only be used from the event loop thread.</para>
+/// </summary>
+typedef struct TelemetryBatch {
+    uint8_t buffer[TELEMETRY_BATCH_BUFFER_SIZE];
+    size_t length;
+    size_t maxSize;
+    const TelemetryEncoder *encoder;
+    unsigned int itemCount;
+    /// <summary>Hashes of the keys in the batch; a collision only sends a batch early.</summary>
+    uint32_t keyHashes[TELEMETRY_BATCH_MAX_ITEMS];
+    TelemetryBatchSendHandler sendHandler;
+    void *context;
+    /// <summary>
+    /// Messages sent per flush reason, items and bytes sent, and items dropped because they do
+    /// not fit in a message of their own.
+    /// </summary>
+    uint32_t flushCounts[TelemetryBatchFlushReason_Count];
+    uint32_t itemsSent;
+    uint32_t bytesSent;
+    uint32_t droppedCount;
+} TelemetryBatch;
+
+/// <summary>
+///     Initializes an empty telemetry batch.
+/// </summary>
+/// <param name="batch">The batch</param>
+/// <param name="maxSize">Maximum message size in bytes, see <see cref="SetTelemetryBatchMaxSize" /></param>
+/// <param name="encoder">Encoder of the messages</param>
+/// <param name="sendHandler">Called with each completed message</param>
+/// <param name="context">Passed to sendHandler</param>
+void InitTelemetryBatch(TelemetryBatch *batch, size_t maxSize, const TelemetryEncoder *encoder,
+                        TelemetryBatchSendHandler sendHandler, void *context);
+
+/// <summary>
+///     Changes the maximum message size, sending the batch first if it is larger than the new
+///     maximum.
+/// </summary>
+/// <param name="batch">The batch</param>
+/// <param name="maxSize">Maximum message size in bytes, clamped to
+/// TELEMETRY_BATCH_MIN_SIZE..TELEMETRY_BATCH_BUFFER_SIZE</param>
+/// <returns>The maximum size in effect</returns>
+size_t SetTelemetryBatchMaxSize(TelemetryBatch *batch, size_t maxSize);
+
+/// <summary>
+///     Changes the encoder, sending the batch collected so far with the previous one.
+/// </summary>
+/// <param name="batch">The batch</param>
+/// <param name="encoder">Encoder of the next messages</param>
+void SetTelemetryBatchEncoder(TelemetryBatch *batch, const TelemetryEncoder *encoder);
+
+/// <summary>
+///     Adds a text valued item to the batch. Keys and values are not escaped.
+/// </summary>
+/// <param name="batch">The batch</param>
+/// <param name="key">The telemetry item name</param>
+/// <param name="value">The telemetry value</param>
+/// <returns>0 on success, or -1 if the item does not fit in a message of its own</returns>
+int AddTelemetryBatchItem(TelemetryBatch *batch, const char *key, const char *value);
+
+/// <summary>
+///     Adds a fixed-point number item to the batch, e.g. 215 with one decimal for 21.5.
+/// </summary>
+/// <param name="batch">The batch</param>
+/// <param name="key">The telemetry item name</param>
+/// <param name="value">Value in units of 10^-decimals</param>
+/// <param name="decimals">Number of digits after the decimal point, 0 to 9</param>
+/// <returns>0 on success, or -1 if the item does not fit in a message of its own</returns>
+int AddTelemetryBatchFixedPoint(TelemetryBatch *batch, const char *key, int32_t value, int decimals);
+
+/// <summary>
+///     Sends the batch, if it holds any items, and empties it.
+/// </summary>
+/// <param name="batch">The batch</param>
+/// <param name="reason">Why the batch is sent, for the statistics</param>
+void FlushTelemetryBatch(TelemetryBatch *batch, TelemetryBatchFlushReason reason);
+
+/// <summary>
+///     Returns true if the batch holds no items.
+/// </summary>
+bool IsTelemetryBatchEmpty(const TelemetryBatch *batch);
@@ -0,0 +1,32 @@
+#include "telemetry_deadband.h"
+#include <string.h>
+
+void InitTelemetrySignal(TelemetrySignal *signal)
+{
+    memset(signal, 0, sizeof(*signal));
+}
+
+static long ElapsedMs(const struct timespec *from, const struct timespec *to)
+{
+    return (long)(to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / (1000 * 1000);
+}
+
+bool ShouldSendTelemetrySignal(TelemetrySignal *signal, const TelemetryDeadbandPolicy *policy,
+                               int32_t value, const struct timespec *now)
+{
+    if (signal->hasSent && policy->deadband >= 0 &&
+        ElapsedMs(&signal->lastSentTime, now) < policy->heartbeatMs) {
+        // Widened so that the difference of any two int32_t values is exact.
+        int64_t change = (int64_t)value - signal->lastSentValue;
+        if (change <= policy->deadband && -change <= policy->deadband) {
+            signal->suppressedCount++;
+            return false;
+        }
+    }
+
+    signal->hasSent = true;
+    signal->lastSentValue = value;
+    signal->lastSentTime = *now;
+    signal->sentCount++;
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/// <summary>
+///     When a telemetry signal is worth sending, shared by the signals of one kind.
+/// </summary>
+typedef struct TelemetryDeadbandPolicy {
+    /// <summary>
+    /// A value is sent when it differs from the last value sent by more than deadband, in the
+    /// signal's integer units. 0 sends every change, a negative deadband every value.
+    /// </summary>
+    int32_t deadband;
+    /// <summary>
+    /// Longest time in ms a signal stays silent; the value is sent regardless after this.
+    /// </summary>
+    long heartbeatMs;
+} TelemetryDeadbandPolicy;
+
+/// <summary>
+///     The last value sent of one telemetry signal, e.g. the capacitance of one sensor.
+/// </summary>
+typedef struct TelemetrySignal {
+    bool hasSent;
+    int32_t lastSentValue;
+    struct timespec lastSentTime;
+    /// <summary>
+    /// Values sent, and values suppressed because they were within the deadband.
+    /// </summary>
+    uint32_t sentCount;
+    uint32_t suppressedCount;
+} TelemetrySignal;
+
+/// <summary>
+///     Initializes a signal which has not been sent yet, so that its first value is sent.
+/// </summary>
+/// <param name="signal">The signal</param>
+void InitTelemetrySignal(TelemetrySignal *signal);
+
+/// <summary>
+///     Decides whether a new value of a signal is sent, and records the value as sent if so.
+/// </summary>
+/// <param name="signal">The signal</param>
+/// <param name="policy">The deadband and heartbeat of the signal</param>
+/// <param name="value">The new value</param>
+/// <param name="now">The current CLOCK_MONOTONIC time</param>
+/// <returns>true if the value is to be sent, false if it is suppressed</returns>
+bool ShouldSendTelemetrySignal(TelemetrySignal *signal, const TelemetryDeadbandPolicy *policy,
+                               int32_t value, const struct timespec *now);
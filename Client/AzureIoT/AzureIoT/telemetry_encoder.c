@@ -0,0 +1,222 @@
+#include "telemetry_encoder.h"
+#include <string.h>
+#include <strings.h>
+#include "number_format.h"
+
+// JSON: {"key":"value",...}. Numbers are sent as strings, as they always were, so that existing
+// IoT Central templates keep working.
+
+static size_t JsonBegin(uint8_t *buffer, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    buffer[0] = '{';
+    return 1;
+}
+
+static size_t JsonAddText(uint8_t *buffer, size_t size, bool first, const char *key, const char *value)
+{
+    size_t keyLength = strlen(key);
+    size_t valueLength = strlen(value);
+    size_t length = (first ? 0 : 1) + keyLength + valueLength + 5;
+    if (length > size) {
+        return 0;
+    }
+
+    uint8_t *next = buffer;
+    if (!first) {
+        *next++ = ',';
+    }
+    *next++ = '"';
+    memcpy(next, key, keyLength);
+    next += keyLength;
+    memcpy(next, "\":\"", 3);
+    next += 3;
+    memcpy(next, value, valueLength);
+    next += valueLength;
+    *next++ = '"';
+    return length;
+}
+
+static size_t JsonAddFixedPoint(uint8_t *buffer, size_t size, bool first, const char *key, int32_t value,
+                                int decimals)
+{
+    char text[16];
+    if (FormatFixedPoint(text, sizeof(text), value, decimals) < 0) {
+        return 0;
+    }
+    return JsonAddText(buffer, size, first, key, text);
+}
+
+static size_t JsonEnd(uint8_t *buffer, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    buffer[0] = '}';
+    return 1;
+}
+
+// CBOR: an indefinite length map, so that the item count need not be known up front, of text
+// keys to text strings, integers or decimal fractions.
+
+#define CBOR_UNSIGNED 0x00
+#define CBOR_NEGATIVE 0x20
+#define CBOR_TEXT 0x60
+#define CBOR_ARRAY 0x80
+#define CBOR_TAG 0xC0
+#define CBOR_MAP_INDEFINITE 0xBF
+#define CBOR_BREAK 0xFF
+#define CBOR_TAG_DECIMAL_FRACTION 4
+
+// Writes the head of a data item: its major type and argument.
+static size_t CborPutHead(uint8_t *buffer, size_t size, uint8_t majorType, uint32_t argument)
+{
+    size_t length = argument < 24 ? 1 : argument <= UINT8_MAX ? 2 : argument <= UINT16_MAX ? 3 : 5;
+    if (length > size) {
+        return 0;
+    }
+
+    switch (length) {
+    case 1:
+        buffer[0] = (uint8_t)(majorType | argument);
+        break;
+    case 2:
+        buffer[0] = majorType | 24;
+        buffer[1] = (uint8_t)argument;
+        break;
+    case 3:
+        buffer[0] = majorType | 25;
+        buffer[1] = (uint8_t)(argument >> 8);
+        buffer[2] = (uint8_t)argument;
+        break;
+    default:
+        buffer[0] = majorType | 26;
+        buffer[1] = (uint8_t)(argument >> 24);
+        buffer[2] = (uint8_t)(argument >> 16);
+        buffer[3] = (uint8_t)(argument >> 8);
+        buffer[4] = (uint8_t)argument;
+        break;
+    }
+    return length;
+}
+
+static size_t CborPutText(uint8_t *buffer, size_t size, const char *text)
+{
+    size_t textLength = strlen(text);
+    size_t headLength = CborPutHead(buffer, size, CBOR_TEXT, (uint32_t)textLength);
+    if (headLength == 0 || headLength + textLength > size) {
+        return 0;
+    }
+    memcpy(buffer + headLength, text, textLength);
+    return headLength + textLength;
+}
+
+static size_t CborPutInteger(uint8_t *buffer, size_t size, int32_t value)
+{
+    // A negative value n is encoded as -1 - n.
+    return value >= 0 ? CborPutHead(buffer, size, CBOR_UNSIGNED, (uint32_t)value)
+                      : CborPutHead(buffer, size, CBOR_NEGATIVE, (uint32_t)(-1 - value));
+}
+
+static size_t CborBegin(uint8_t *buffer, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    buffer[0] = CBOR_MAP_INDEFINITE;
+    return 1;
+}
+
+static size_t CborAddText(uint8_t *buffer, size_t size, bool first, const char *key, const char *value)
+{
+    // CBOR map entries need no separator.
+    (void)first;
+    size_t keyLength = CborPutText(buffer, size, key);
+    if (keyLength == 0) {
+        return 0;
+    }
+    size_t valueLength = CborPutText(buffer + keyLength, size - keyLength, value);
+    return valueLength == 0 ? 0 : keyLength + valueLength;
+}
+
+static size_t CborAddFixedPoint(uint8_t *buffer, size_t size, bool first, const char *key, int32_t value,
+                                int decimals)
+{
+    (void)first;
+    size_t length = CborPutText(buffer, size, key);
+    if (length == 0) {
+        return 0;
+    }
+
+    if (decimals > 0) {
+        // Tag 4 [exponent, mantissa]: value * 10^-decimals.
+        size_t headLength = CborPutHead(buffer + length, size - length, CBOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+        if (headLength == 0) {
+            return 0;
+        }
+        length += headLength;
+        headLength = CborPutHead(buffer + length, size - length, CBOR_ARRAY, 2);
+        if (headLength == 0) {
+            return 0;
+        }
+        length += headLength;
+        headLength = CborPutInteger(buffer + length, size - length, -decimals);
+        if (headLength == 0) {
+            return 0;
+        }
+        length += headLength;
+    }
+
+    size_t valueLength = CborPutInteger(buffer + length, size - length, value);
+    return valueLength == 0 ? 0 : length + valueLength;
+}
+
+static size_t CborEnd(uint8_t *buffer, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    buffer[0] = CBOR_BREAK;
+    return 1;
+}
+
+static const TelemetryEncoder encoders[TelemetryEncoding_Count] = {
+    [TelemetryEncoding_Json] = {.encoding = TelemetryEncoding_Json,
+                                .name = "Json",
+                                .contentType = "application/json",
+                                .contentEncoding = "utf-8",
+                                .endSize = 1,
+                                .begin = JsonBegin,
+                                .addText = JsonAddText,
+                                .addFixedPoint = JsonAddFixedPoint,
+                                .end = JsonEnd},
+    [TelemetryEncoding_Cbor] = {.encoding = TelemetryEncoding_Cbor,
+                                .name = "Cbor",
+                                .contentType = "application/cbor",
+                                .contentEncoding = NULL,
+                                .endSize = 1,
+                                .begin = CborBegin,
+                                .addText = CborAddText,
+                                .addFixedPoint = CborAddFixedPoint,
+                                .end = CborEnd},
+};
+
+const TelemetryEncoder *GetTelemetryEncoder(TelemetryEncoding encoding)
+{
+    if ((unsigned int)encoding >= TelemetryEncoding_Count) {
+        return NULL;
+    }
+    return &encoders[encoding];
+}
+
+const TelemetryEncoder *FindTelemetryEncoder(const char *name)
+{
+    for (int i = 0; i < TelemetryEncoding_Count; i++) {
+        if (strcasecmp(encoders[i].name, name) == 0) {
+            return &encoders[i];
+        }
+    }
+    return NULL;
+}
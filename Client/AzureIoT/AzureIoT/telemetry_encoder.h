@@ -0,0 +1,55 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Wire formats of telemetry messages. The values are stored in the telemetry journal and
+///     must not change.
+/// </summary>
+typedef enum {
+    /// <summary>A JSON object of string values, e.g. {"Relay1State":"On","Temperature":"21.5"}.</summary>
+    TelemetryEncoding_Json = 0,
+    /// <summary>
+    /// A CBOR (RFC 8949) map of text keys to text or numbers; numbers with decimals are decimal
+    /// fractions (tag 4), so 21.5 is sent exactly.
+    /// </summary>
+    TelemetryEncoding_Cbor = 1,
+    TelemetryEncoding_Count
+} TelemetryEncoding;
+
+/// <summary>
+/// <para>Encodes telemetry items into a message buffer. Every function writes at the start of
+/// the buffer it is given and returns the number of bytes written, or 0 if they do not fit in
+/// size.</para>
+/// <para>A message is begin, one add per item and end. first is true for the first item.</para>
+/// </summary>
+typedef struct TelemetryEncoder {
+    TelemetryEncoding encoding;
+    /// <summary>Name used by the TelemetryEncodingSetting twin property, e.g. "Json".</summary>
+    const char *name;
+    /// <summary>Content type and encoding system properties of the IoT Hub message.</summary>
+    const char *contentType;
+    const char *contentEncoding;
+    /// <summary>Bytes written by end, reserved while items are added.</summary>
+    size_t endSize;
+    size_t (*begin)(uint8_t *buffer, size_t size);
+    size_t (*addText)(uint8_t *buffer, size_t size, bool first, const char *key, const char *value);
+    size_t (*addFixedPoint)(uint8_t *buffer, size_t size, bool first, const char *key, int32_t value,
+                            int decimals);
+    size_t (*end)(uint8_t *buffer, size_t size);
+} TelemetryEncoder;
+
+/// <summary>
+///     Returns the encoder of a wire format.
+/// </summary>
+/// <param name="encoding">The wire format</param>
+/// <returns>The encoder, or NULL if encoding is unknown</returns>
+const TelemetryEncoder *GetTelemetryEncoder(TelemetryEncoding encoding);
+
+/// <summary>
+///     Returns the encoder with a name, compared case insensitively.
+/// </summary>
+/// <param name="name">Encoder name, e.g. "Cbor"</param>
+/// <returns>The encoder, or NULL if there is none with that name</returns>
+const TelemetryEncoder *FindTelemetryEncoder(const char *name);
@@ -0,0 +1,290 @@
+#include "telemetry_journal.h"
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Record layout, native byte order:
+//   0 magic, 4 sequence, 8 timestamp, 16 message length, 18 message format, 20 message,
+//   RECORD_SIZE - 4 CRC-32 of everything before it.
+// Header layout, in the first bytes of slots 0 and 1:
+//   0 magic, 4 generation, 8 acknowledged sequence, 12 CRC-32 of everything before it.
+#define RECORD_MAGIC 0x4C524A54u // "TJRL"
+#define HEADER_MAGIC 0x44484A54u // "TJHD"
+#define RECORD_MESSAGE_OFFSET 20
+#define RECORD_CRC_OFFSET (TELEMETRY_JOURNAL_RECORD_SIZE - 4)
+#define HEADER_SIZE 16
+#define HEADER_SLOTS 2
+
+static uint8_t recordBuffer[TELEMETRY_JOURNAL_RECORD_SIZE];
+
+static uint32_t Crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t GetUint32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static void PutUint32(uint8_t *data, uint32_t value)
+{
+    memcpy(data, &value, sizeof(value));
+}
+
+static off_t SlotOffset(int slot)
+{
+    return (off_t)slot * TELEMETRY_JOURNAL_RECORD_SIZE;
+}
+
+static off_t RecordOffset(uint32_t sequence)
+{
+    return SlotOffset(HEADER_SLOTS + (int)(sequence % TELEMETRY_JOURNAL_CAPACITY));
+}
+
+// Reads length bytes at offset. Returns the number of bytes read, short at the end of the file,
+// or -1 on error.
+static ssize_t ReadAt(int fd, off_t offset, uint8_t *data, size_t length)
+{
+    if (lseek(fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    size_t total = 0;
+    while (total < length) {
+        ssize_t count = read(fd, data + total, length - total);
+        if (count < 0) {
+            return -1;
+        }
+        if (count == 0) {
+            break;
+        }
+        total += (size_t)count;
+    }
+    return (ssize_t)total;
+}
+
+// Writes and syncs data at offset, so that a record or header counts as written only once it is
+// on storage. Otherwise a reset could lose a record reported as appended, or a committed
+// acknowledgement and replay the records it covered.
+static int WriteAt(int fd, off_t offset, const uint8_t *data, size_t length)
+{
+    if (lseek(fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    size_t total = 0;
+    while (total < length) {
+        ssize_t count = write(fd, data + total, length - total);
+        if (count <= 0) {
+            return -1;
+        }
+        total += (size_t)count;
+    }
+    return fsync(fd);
+}
+
+// Reads the record of a sequence into recordBuffer. Returns 1 if it is intact and holds that
+// sequence, 0 if not, or -1 on error.
+static int ReadRecord(const TelemetryJournal *journal, uint32_t sequence)
+{
+    ssize_t count = ReadAt(journal->fd, RecordOffset(sequence), recordBuffer, sizeof(recordBuffer));
+    if (count < 0) {
+        return -1;
+    }
+    return count == sizeof(recordBuffer) && GetUint32(recordBuffer) == RECORD_MAGIC &&
+           GetUint32(recordBuffer + 4) == sequence &&
+           GetUint32(recordBuffer + RECORD_CRC_OFFSET) == Crc32(recordBuffer, RECORD_CRC_OFFSET);
+}
+
+// Moves the acknowledged sequence past the records delivered out of order right after it.
+static void SkipDelivered(TelemetryJournal *journal)
+{
+    while (journal->deliveredMask & 1u) {
+        journal->ackedSequence++;
+        journal->deliveredMask >>= 1;
+    }
+}
+
+static void MarkDelivered(TelemetryJournal *journal, uint32_t sequence)
+{
+    uint32_t bit = sequence - journal->ackedSequence - 1;
+    if (bit < 32) {
+        journal->deliveredMask |= 1u << bit;
+    }
+    SkipDelivered(journal);
+}
+
+int OpenTelemetryJournal(TelemetryJournal *journal, int fd)
+{
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = fd;
+
+    uint8_t header[HEADER_SIZE];
+    bool hasHeader = false;
+    for (int slot = 0; slot < HEADER_SLOTS; slot++) {
+        ssize_t count = ReadAt(fd, SlotOffset(slot), header, sizeof(header));
+        if (count < 0) {
+            return -1;
+        }
+        if (count == sizeof(header) && GetUint32(header) == HEADER_MAGIC &&
+            GetUint32(header + 12) == Crc32(header, 12) &&
+            (!hasHeader || GetUint32(header + 4) > journal->headerGeneration)) {
+            hasHeader = true;
+            journal->headerGeneration = GetUint32(header + 4);
+            journal->ackedSequence = GetUint32(header + 8);
+        }
+    }
+
+    // The newest intact record gives the write position. A slot holding a sequence of another
+    // slot is left over from an older file and ignored.
+    uint32_t newestSequence = 0;
+    for (int slot = 0; slot < TELEMETRY_JOURNAL_CAPACITY; slot++) {
+        ssize_t count = ReadAt(fd, SlotOffset(HEADER_SLOTS + slot), recordBuffer, sizeof(recordBuffer));
+        if (count < 0) {
+            return -1;
+        }
+        uint32_t sequence = GetUint32(recordBuffer + 4);
+        if (count == sizeof(recordBuffer) && GetUint32(recordBuffer) == RECORD_MAGIC &&
+            sequence % TELEMETRY_JOURNAL_CAPACITY == (uint32_t)slot &&
+            GetUint32(recordBuffer + RECORD_CRC_OFFSET) == Crc32(recordBuffer, RECORD_CRC_OFFSET) &&
+            sequence > newestSequence) {
+            newestSequence = sequence;
+        }
+    }
+
+    journal->writeSequence = newestSequence + 1;
+    if (journal->ackedSequence > newestSequence) {
+        journal->ackedSequence = newestSequence;
+    }
+    if (newestSequence - journal->ackedSequence > TELEMETRY_JOURNAL_CAPACITY) {
+        journal->ackedSequence = newestSequence - TELEMETRY_JOURNAL_CAPACITY;
+    }
+    journal->committedAckedSequence = journal->ackedSequence;
+    journal->replaySequence = journal->ackedSequence + 1;
+    return 0;
+}
+
+int AppendTelemetryJournal(TelemetryJournal *journal, const uint8_t *message, size_t length,
+                           uint16_t format, int64_t timestamp)
+{
+    if (length > TELEMETRY_JOURNAL_PAYLOAD_SIZE) {
+        journal->tooLongCount++;
+        return -1;
+    }
+
+    uint32_t sequence = journal->writeSequence;
+    memset(recordBuffer, 0, sizeof(recordBuffer));
+    PutUint32(recordBuffer, RECORD_MAGIC);
+    PutUint32(recordBuffer + 4, sequence);
+    memcpy(recordBuffer + 8, &timestamp, sizeof(timestamp));
+    uint16_t messageLength = (uint16_t)length;
+    memcpy(recordBuffer + 16, &messageLength, sizeof(messageLength));
+    memcpy(recordBuffer + 18, &format, sizeof(format));
+    memcpy(recordBuffer + RECORD_MESSAGE_OFFSET, message, length);
+    PutUint32(recordBuffer + RECORD_CRC_OFFSET, Crc32(recordBuffer, RECORD_CRC_OFFSET));
+    if (WriteAt(journal->fd, RecordOffset(sequence), recordBuffer, sizeof(recordBuffer)) != 0) {
+        journal->writeFailures++;
+        return -1;
+    }
+
+    journal->writeSequence++;
+    journal->appendedCount++;
+
+    // The record overwrote the oldest one if it was not acknowledged yet.
+    if (sequence - journal->ackedSequence > TELEMETRY_JOURNAL_CAPACITY) {
+        journal->overwrittenCount++;
+        journal->ackedSequence++;
+        journal->deliveredMask >>= 1;
+        SkipDelivered(journal);
+        if (journal->replaySequence <= journal->ackedSequence) {
+            journal->replaySequence = journal->ackedSequence + 1;
+        }
+    }
+    return 0;
+}
+
+uint32_t GetTelemetryJournalPendingCount(const TelemetryJournal *journal)
+{
+    return journal->writeSequence - 1 - journal->ackedSequence;
+}
+
+bool ReadNextTelemetryJournalRecord(TelemetryJournal *journal, TelemetryJournalRecord *record)
+{
+    while (journal->replaySequence < journal->writeSequence &&
+           journal->replaySequence - journal->ackedSequence - 1 < TELEMETRY_JOURNAL_MAX_IN_FLIGHT) {
+        uint32_t sequence = journal->replaySequence++;
+        int result = ReadRecord(journal, sequence);
+        if (result < 0) {
+            journal->replaySequence = sequence;
+            return false;
+        }
+        if (result == 0) {
+            // Torn by a reset while it was written; there is nothing to deliver.
+            journal->corruptCount++;
+            MarkDelivered(journal, sequence);
+            continue;
+        }
+
+        uint16_t length;
+        memcpy(&length, recordBuffer + 16, sizeof(length));
+        if (length > TELEMETRY_JOURNAL_PAYLOAD_SIZE) {
+            length = TELEMETRY_JOURNAL_PAYLOAD_SIZE;
+        }
+        record->sequence = sequence;
+        memcpy(&record->timestamp, recordBuffer + 8, sizeof(record->timestamp));
+        memcpy(&record->format, recordBuffer + 18, sizeof(record->format));
+        record->length = length;
+        memcpy(record->message, recordBuffer + RECORD_MESSAGE_OFFSET, length);
+        journal->replayedCount++;
+        return true;
+    }
+    return false;
+}
+
+void AcknowledgeTelemetryJournalRecord(TelemetryJournal *journal, uint32_t sequence, bool delivered)
+{
+    if (sequence <= journal->ackedSequence || sequence >= journal->replaySequence) {
+        return;
+    }
+    if (!delivered) {
+        RewindTelemetryJournal(journal);
+        return;
+    }
+    MarkDelivered(journal, sequence);
+}
+
+void RewindTelemetryJournal(TelemetryJournal *journal)
+{
+    journal->replaySequence = journal->ackedSequence + 1;
+    journal->deliveredMask = 0;
+}
+
+int CommitTelemetryJournal(TelemetryJournal *journal)
+{
+    if (journal->ackedSequence == journal->committedAckedSequence) {
+        return 0;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    uint32_t generation = journal->headerGeneration + 1;
+    PutUint32(header, HEADER_MAGIC);
+    PutUint32(header + 4, generation);
+    PutUint32(header + 8, journal->ackedSequence);
+    PutUint32(header + 12, Crc32(header, 12));
+    if (WriteAt(journal->fd, SlotOffset((int)(generation % HEADER_SLOTS)), header, sizeof(header)) != 0) {
+        journal->writeFailures++;
+        return -1;
+    }
+
+    journal->headerGeneration = generation;
+    journal->committedAckedSequence = journal->ackedSequence;
+    return 0;
+}
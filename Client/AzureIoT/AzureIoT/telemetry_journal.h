@@ -0,0 +1,121 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Size of a journal record on storage, the longest message a record holds, and the number
+///     of records in the ring. The journal file holds two header copies of one record size each
+///     followed by the ring, 62 KiB in total, within the 64 KiB of mutable storage requested in
+///     app_manifest.json.
+/// </summary>
+#define TELEMETRY_JOURNAL_RECORD_SIZE 512
+#define TELEMETRY_JOURNAL_PAYLOAD_SIZE (TELEMETRY_JOURNAL_RECORD_SIZE - 24)
+#define TELEMETRY_JOURNAL_CAPACITY 122
+
+/// <summary>
+///     Most records replayed but not yet acknowledged, at most 32.
+/// </summary>
+#define TELEMETRY_JOURNAL_MAX_IN_FLIGHT 8
+
+/// <summary>
+///     A record read back for replay.
+/// </summary>
+typedef struct TelemetryJournalRecord {
+    uint32_t sequence;
+    /// <summary>CLOCK_REALTIME seconds when the record was appended.</summary>
+    int64_t timestamp;
+    /// <summary>Format of the message, as passed to <see cref="AppendTelemetryJournal" />.</summary>
+    uint16_t format;
+    uint16_t length;
+    uint8_t message[TELEMETRY_JOURNAL_PAYLOAD_SIZE];
+} TelemetryJournalRecord;
+
+/// <summary>
+/// <para>A crash-safe, append-only ring of telemetry messages in a file, used to store telemetry
+/// while IoT Hub is unreachable and forward it once connected.</para>
+/// <para>Records have a fixed size and a sequence number starting at 1, and record n lives in
+/// slot n % TELEMETRY_JOURNAL_CAPACITY, so the write position is recovered from the records
+/// alone. Each record and header carries a CRC; a record torn by a reset fails it and is
+/// skipped. Only the sequence acknowledged by IoT Hub is kept in the header, written to two
+/// alternating copies so that one survives a torn write. Every record and header write is
+/// synced before it returns. When the ring is full the oldest records are overwritten.</para>
+/// <para>The journal works on any file descriptor: mutable storage on the device, a plain file
+/// on Linux. It is not thread safe and must only be used from the event loop thread.</para>
+/// </summary>
+typedef struct TelemetryJournal {
+    int fd;
+    /// <summary>Sequence of the next record appended.</summary>
+    uint32_t writeSequence;
+    /// <summary>Every record up to this sequence was delivered.</summary>
+    uint32_t ackedSequence;
+    uint32_t committedAckedSequence;
+    uint32_t headerGeneration;
+    /// <summary>Sequence of the next record replayed.</summary>
+    uint32_t replaySequence;
+    /// <summary>Records after ackedSequence delivered out of order, bit 0 is ackedSequence + 1.</summary>
+    uint32_t deliveredMask;
+    uint32_t appendedCount;
+    uint32_t replayedCount;
+    uint32_t overwrittenCount;
+    uint32_t corruptCount;
+    uint32_t tooLongCount;
+    uint32_t writeFailures;
+} TelemetryJournal;
+
+/// <summary>
+///     Opens a journal on a file, recovering its records and acknowledged sequence.
+/// </summary>
+/// <param name="journal">The journal</param>
+/// <param name="fd">Readable and writable file descriptor, owned by the caller. An empty file
+/// is an empty journal.</param>
+/// <returns>0 on success, or -1 if the file cannot be read</returns>
+int OpenTelemetryJournal(TelemetryJournal *journal, int fd);
+
+/// <summary>
+///     Appends a message, overwriting the oldest record if the ring is full.
+/// </summary>
+/// <param name="journal">The journal</param>
+/// <param name="message">The message</param>
+/// <param name="length">Length of the message in bytes, at most TELEMETRY_JOURNAL_PAYLOAD_SIZE</param>
+/// <param name="format">Format of the message, e.g. its encoding, returned on replay</param>
+/// <param name="timestamp">CLOCK_REALTIME seconds when the message was created</param>
+/// <returns>0 on success, or -1 if the message is too long or cannot be written</returns>
+int AppendTelemetryJournal(TelemetryJournal *journal, const uint8_t *message, size_t length,
+                           uint16_t format, int64_t timestamp);
+
+/// <summary>
+///     Returns the number of records not yet acknowledged.
+/// </summary>
+uint32_t GetTelemetryJournalPendingCount(const TelemetryJournal *journal);
+
+/// <summary>
+///     Reads the next record to replay, skipping records which are corrupt. Returns false when
+///     every record was replayed or TELEMETRY_JOURNAL_MAX_IN_FLIGHT await acknowledgement.
+/// </summary>
+/// <param name="journal">The journal</param>
+/// <param name="record">Receives the record</param>
+/// <returns>true if a record was read</returns>
+bool ReadNextTelemetryJournalRecord(TelemetryJournal *journal, TelemetryJournalRecord *record);
+
+/// <summary>
+///     Records the outcome of sending a replayed record. A failure rewinds the replay to the
+///     oldest record not acknowledged.
+/// </summary>
+/// <param name="journal">The journal</param>
+/// <param name="sequence">Sequence of the record</param>
+/// <param name="delivered">true if IoT Hub confirmed the record</param>
+void AcknowledgeTelemetryJournalRecord(TelemetryJournal *journal, uint32_t sequence, bool delivered);
+
+/// <summary>
+///     Replays again from the oldest record not acknowledged, e.g. after a reconnect dropped the
+///     records in flight.
+/// </summary>
+void RewindTelemetryJournal(TelemetryJournal *journal);
+
+/// <summary>
+///     Writes the acknowledged sequence to storage if it changed. Acknowledgements are only
+///     committed here, so that storage is written once per replay batch rather than per record.
+/// </summary>
+/// <returns>0 on success, or -1 if the header cannot be written</returns>
+int CommitTelemetryJournal(TelemetryJournal *journal);
@@ -0,0 +1,190 @@
+// Drives the soil sensor driver and the I2C access layer against the simulated bus: reset,
+// conversions, readdressing, pump noise, the bus speed fallback and mux channel switching.
+// Built and run by make -C host check.
+#include <stdio.h>
+#include <unistd.h>
+#include "I2CSimulation.h"
+#include "SoilMoistureI2cSensor.h"
+#include "SoilSensorRegistry.h"
+#include "test_check.h"
+
+int i2cFd = -1;
+
+// Short conversion and reboot times, so that the test does not wait for the real sensor's.
+static const I2CSimulationConfig fastConfig = { .conversionMs = 5, .lightConversionMs = 10, .resetMs = 20, .wakeMs = 2, .seed = 1 };
+
+// Starts a test on an empty simulated bus, reopened in fast mode.
+static void ResetBus(const I2CSimulationConfig* config) {
+	ResetI2CSimulation(config);
+	if (i2cFd >= 0) {
+		close(i2cFd);
+	}
+	CHECK(OpenI2CBus(0, 100) >= 0);
+}
+
+static long ElapsedUs(const struct timespec* start, const struct timespec* end) {
+	return (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+static void SleepMs(long ms) {
+	struct timespec delay = { ms / 1000, (ms % 1000) * 1000 * 1000 };
+	nanosleep(&delay, NULL);
+}
+
+static void TestMeasurement(void) {
+	ResetBus(&fastConfig);
+	AddSimulatedSoilSensor(0x20, 0x23, 300, 215, 0);
+	const I2C_DeviceAddress address = 0x20;
+	CHECK(InitializeSoilSensors(&address, 1, 1000) == 1);
+
+	uint8_t version;
+	CHECK(GetVersion(0x20, &version) == I2CStatus_Ok && version == 0x23);
+
+	// A conversion latches the values set before it; reads return the old ones until then.
+	SetSimulatedSoilSensorValues(0x20, 410, -35, 0);
+	uint16_t capacitance;
+	int16_t temperature;
+	CHECK(TriggerMeasurement(0x20) == I2CStatus_Ok);
+	CHECK(IsBusy(0x20));
+	CHECK(GetCapacitance(0x20, &capacitance) == I2CStatus_Ok && capacitance == 300);
+	SleepMs(fastConfig.conversionMs + 5);
+	CHECK(!IsBusy(0x20));
+	CHECK(GetCapacitance(0x20, &capacitance) == I2CStatus_Ok && capacitance == 410);
+	CHECK(GetTemperature(0x20, &temperature) == I2CStatus_Ok && temperature == -35);
+
+	// An absent sensor is retried, then reported as NACK without touching the output.
+	capacitance = 1;
+	CHECK(GetCapacitance(0x30, &capacitance) == I2CStatus_Nack && capacitance == 1);
+	const I2CAddressStats* stats = GetI2CAddressStats(0x30);
+	CHECK(stats != NULL && stats->failures == 1 && stats->retries == I2C_TRANSFER_ATTEMPTS - 1);
+}
+
+static void TestReaddressing(void) {
+	ResetBus(&fastConfig);
+	AddSimulatedSoilSensor(0x20, 0x23, 300, 215, 0);
+	CHECK(ChangeSoilSensorAddress(0x20, 0x25, 1000) == I2CStatus_Ok);
+
+	uint8_t reportedAddress;
+	CHECK(GetAddress(0x25, &reportedAddress) == I2CStatus_Ok && reportedAddress == 0x25);
+	CHECK(GetAddress(0x20, &reportedAddress) == I2CStatus_Nack);
+}
+
+static void TestPumpSpikes(void) {
+	I2CSimulationConfig config = fastConfig;
+	config.pumpSpikePerMille = 1000;
+	ResetBus(&config);
+	AddSimulatedSoilSensor(0x20, 0x23, 300, 215, 0);
+
+	// Every transfer while the pump runs either fails or reads 0xFFFF.
+	SetSimulatedPumpRunning(true);
+	for (int i = 0; i < 20; i++) {
+		uint16_t capacitance;
+		I2CStatus status = GetCapacitance(0x20, &capacitance);
+		CHECK(status != I2CStatus_Ok || capacitance == 0xFFFF);
+	}
+	SetSimulatedPumpRunning(false);
+	uint16_t capacitance;
+	CHECK(GetCapacitance(0x20, &capacitance) == I2CStatus_Ok && capacitance == 300);
+
+	I2CSimulationStats stats;
+	GetI2CSimulationStats(&stats);
+	CHECK(stats.pumpSpikes >= 20);
+}
+
+// A 10% NACK rate exceeds the 5% allowed per window, so the bus steps down to standard mode.
+static void TestBusSpeedFallback(void) {
+	I2CSimulationConfig config = fastConfig;
+	config.nackPerMille = 100;
+	config.seed = 3;
+	ResetBus(&config);
+	AddSimulatedSoilSensor(0x20, 0x23, 300, 215, 0);
+	const I2CBusSpeedStats* speedStats = GetI2CBusSpeedStats();
+	CHECK(speedStats->speed == I2C_BUS_SPEED_FAST);
+
+	uint32_t stepDowns = speedStats->stepDowns;
+	for (int i = 0; i < 200; i++) {
+		uint16_t capacitance;
+		GetCapacitance(0x20, &capacitance);
+	}
+	CHECK(speedStats->speed == I2C_BUS_SPEED_STANDARD);
+	CHECK(speedStats->stepDowns == stepDowns + 1);
+	printf("Bus speed: %u Hz after 200 reads at 10%% NACKs, %u step-downs\n", speedStats->speed,
+		speedStats->stepDowns - stepDowns);
+}
+
+// 32 sensors, two on each channel of two muxes. Reading them in registry order switches each
+// channel once per round; an interleaved order switches on almost every read.
+static void TestMuxSwitching(void) {
+	ResetBus(&fastConfig);
+	AddSimulatedI2CMux(0x70);
+	AddSimulatedI2CMux(0x71);
+	for (int mux = 0; mux < 2; mux++) {
+		for (int channel = 0; channel < I2C_MUX_CHANNELS; channel++) {
+			for (int device = 0; device < 2; device++) {
+				AddSimulatedSoilSensor(I2C_MUXED_ADDRESS(0x70 + mux, channel, 0x20 + device), 0x23,
+					(uint16_t)(300 + channel), 215, 0);
+			}
+		}
+	}
+
+	static SoilSensorRegistry registry;
+	int count = ScanSoilSensors(&registry, 0x22);
+	CHECK(count == 32);
+	if (count == 0) {
+		return;
+	}
+
+	static const int rounds = 10;
+	const I2CMuxStats* muxStats = GetI2CMuxStats();
+	uint32_t switchesPerRound[2];
+	for (int pass = 0; pass < 2; pass++) {
+		uint32_t switches = muxStats->channelSwitches;
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int round = 0; round < rounds; round++) {
+			for (int j = 0; j < count; j++) {
+				int i = pass == 0 ? j : (j * 7) % count;
+				uint16_t capacitance;
+				CHECK(GetCapacitance(registry.addresses[i], &capacitance) == I2CStatus_Ok);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		switchesPerRound[pass] = (muxStats->channelSwitches - switches) / rounds;
+		printf("Mux %s reads: %u switches and %.1f ms per round of %d sensors\n",
+			pass == 0 ? "grouped" : "interleaved", switchesPerRound[pass],
+			ElapsedUs(&start, &end) / 1000.0 / rounds, count);
+	}
+
+	// 16 channel selects plus a disconnect each time the round moves to the other mux.
+	CHECK(switchesPerRound[0] == 18);
+	CHECK(switchesPerRound[1] > switchesPerRound[0]);
+}
+
+// Only the sensor directly on the bus at the water tank address measures the water tank.
+static void TestWaterTankRole(void) {
+	ResetBus(&fastConfig);
+	AddSimulatedI2CMux(0x70);
+	AddSimulatedSoilSensor(0x20, 0x23, 300, 215, 0);
+	AddSimulatedSoilSensor(I2C_MUXED_ADDRESS(0x70, 1, 0x22), 0x23, 300, 215, 0);
+
+	static SoilSensorRegistry registry;
+	CHECK(ScanSoilSensors(&registry, 0x22) == 2);
+	for (int i = 0; i < registry.count; i++) {
+		CHECK(registry.roles[i] == SoilSensorRole_Soil && registry.soilNumbers[i] == i + 1);
+	}
+
+	AddSimulatedSoilSensor(0x22, 0x23, 300, 215, 0);
+	CHECK(ScanSoilSensors(&registry, 0x22) == 2);
+	int tank = FindSoilSensor(&registry, 0x22);
+	CHECK(tank >= 0 && registry.roles[tank] == SoilSensorRole_WaterTank);
+}
+
+int main(void) {
+	TestMeasurement();
+	TestReaddressing();
+	TestPumpSpikes();
+	TestBusSpeedFallback();
+	TestMuxSwitching();
+	TestWaterTankRole();
+	return TEST_RESULT();
+}
@@ -0,0 +1,168 @@
+// Runs the sampling thread over the simulated bus with transfer latency while a slow consumer
+// drains the sample ring, and checks that no reading is lost, reordered or torn. Built and run
+// by make -C host check.
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "I2CSimulation.h"
+#include "SoilSensorSampler.h"
+#include "test_check.h"
+
+int i2cFd = -1;
+
+static const I2CSimulationConfig slowBusConfig = { .latencyUs = 100, .conversionMs = 5, .lightConversionMs = 10, .resetMs = 20, .wakeMs = 2, .seed = 1 };
+// Long enough for a pass over SOILSENSOR_SAMPLER_MAX_SENSORS with sleep enabled.
+static const long SamplerPeriodMs = 100;
+// The consumer drains the ring this often, i.e. every one and a half sampler periods.
+static const long ConsumerPeriodMs = 150;
+static const long RunMs = 2000;
+
+static I2C_DeviceAddress addresses[SOILSENSOR_SAMPLER_MAX_SENSORS];
+static SoilSensorSampleRing ring;
+static SoilSensorPowerState powerStates[SOILSENSOR_SAMPLER_MAX_SENSORS];
+static SoilSensorHealth health[SOILSENSOR_SAMPLER_MAX_SENSORS];
+
+// Every sensor reports values derived from its index, so that a torn sample is detected.
+static uint16_t Capacitance(int sensor) {
+	return (uint16_t)(300 + 11 * sensor);
+}
+
+static int16_t Temperature(int sensor) {
+	return (int16_t)(200 + 7 * sensor);
+}
+
+static long ElapsedMs(const struct timespec* start, const struct timespec* end) {
+	return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / (1000 * 1000);
+}
+
+static void SleepMs(long ms) {
+	struct timespec delay = { ms / 1000, (ms % 1000) * 1000 * 1000 };
+	nanosleep(&delay, NULL);
+}
+
+// Starts the sampler on sensorCount fresh sensors at 0x20 onwards. Returns its eventfd.
+static int StartSampler(int sensorCount, bool sleepEnabled) {
+	ResetI2CSimulation(&slowBusConfig);
+	if (i2cFd >= 0) {
+		close(i2cFd);
+	}
+	CHECK(OpenI2CBus(0, 100) >= 0);
+	for (int i = 0; i < sensorCount; i++) {
+		addresses[i] = (I2C_DeviceAddress)(0x20 + i);
+		AddSimulatedSoilSensor(addresses[i], 0x23, Capacitance(i), Temperature(i), 0);
+		InitSoilSensorPowerState(&powerStates[i]);
+		InitSoilSensorHealth(&health[i]);
+	}
+	CHECK(InitializeSoilSensors(addresses, sensorCount, 1000) == sensorCount);
+
+	ring = (SoilSensorSampleRing){ 0 };
+	SetSoilSensorSamplerSleep(sleepEnabled);
+	struct timespec period = { 0, SamplerPeriodMs * 1000 * 1000 };
+	int eventFd = StartSoilSensorSampler(addresses, sensorCount, &period, &ring, powerStates, health);
+	CHECK(eventFd >= 0);
+	return eventFd;
+}
+
+static void TestSlowConsumer(int sensorCount, bool sleepEnabled) {
+	int eventFd = StartSampler(sensorCount, sleepEnabled);
+	if (eventFd < 0) {
+		return;
+	}
+
+	uint32_t received[SOILSENSOR_SAMPLER_MAX_SENSORS] = { 0 };
+	struct timespec lastTimestamp[SOILSENSOR_SAMPLER_MAX_SENSORS] = { 0 };
+	uint32_t bad = 0;
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		SleepMs(ConsumerPeriodMs);
+		struct pollfd pollFd = { .fd = eventFd, .events = POLLIN };
+		if (poll(&pollFd, 1, 0) == 1) {
+			uint64_t signals;
+			CHECK(read(eventFd, &signals, sizeof(signals)) == sizeof(signals));
+		}
+
+		SoilSensorSample sample;
+		while (PopSoilSensorSample(&ring, &sample)) {
+			int sensor = (int)(sample.address - addresses[0]);
+			if (sensor < 0 || sensor >= sensorCount) {
+				bad++;
+				continue;
+			}
+			received[sensor]++;
+			if (!sample.hasCapacitance || sample.capacitance != Capacitance(sensor)
+				|| !sample.hasTemperature || sample.temperatureDeciC != Temperature(sensor)) {
+				bad++;
+			}
+			// Samples of one sensor arrive in the order they were taken.
+			if (ElapsedMs(&lastTimestamp[sensor], &sample.timestamp) < 0) {
+				bad++;
+			}
+			lastTimestamp[sensor] = sample.timestamp;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (ElapsedMs(&start, &now) < RunMs);
+	StopSoilSensorSampler();
+
+	// Every period reads each sensor once, so no sensor may fall behind another.
+	uint32_t expected = (uint32_t)(RunMs / SamplerPeriodMs);
+	uint32_t fewest = received[0], most = received[0];
+	for (int i = 0; i < sensorCount; i++) {
+		fewest = received[i] < fewest ? received[i] : fewest;
+		most = received[i] > most ? received[i] : most;
+		CHECK(health[i].state == SoilSensorHealthState_Healthy);
+	}
+	CHECK(fewest >= expected / 2);
+	CHECK(most <= fewest + 1);
+
+	// The snapshot of the last pass counts the transfers of every sensor.
+	static SoilSensorSamplerSnapshot snapshot;
+	GetSoilSensorSamplerSnapshot(&snapshot);
+	CHECK(snapshot.sensorCount == sensorCount);
+	for (int i = 0; i < sensorCount; i++) {
+		CHECK(snapshot.addressStats[i].transfers >= 2 * fewest);
+		CHECK(snapshot.health[i].state == SoilSensorHealthState_Healthy);
+	}
+	CHECK(bad == 0);
+	CHECK(atomic_load(&ring.droppedCount) == 0);
+
+	I2CSimulationStats stats;
+	GetI2CSimulationStats(&stats);
+	printf("Sampler %s, %d sensors: %u to %u samples each in %ld ms, %u bad, %u dropped, %u transfers\n",
+		sleepEnabled ? "with sleep" : "awake", sensorCount, fewest, most, RunMs, bad,
+		atomic_load(&ring.droppedCount), stats.transfers);
+}
+
+// A consumer stalled for longer than the ring holds loses the newest samples, counts them and
+// still reads intact ones.
+static void TestStalledConsumer(int sensorCount) {
+	if (StartSampler(sensorCount, false) < 0) {
+		return;
+	}
+	// Enough passes to fill the ring one and a half times over.
+	long passes = (3 * SOILSENSOR_SAMPLE_RING_SIZE / 2 + sensorCount - 1) / sensorCount + 1;
+	SleepMs(passes * SamplerPeriodMs);
+	StopSoilSensorSampler();
+
+	uint32_t popped = 0;
+	SoilSensorSample sample;
+	while (PopSoilSensorSample(&ring, &sample)) {
+		int sensor = (int)(sample.address - addresses[0]);
+		CHECK(sensor >= 0 && sensor < sensorCount);
+		CHECK(sample.capacitance == Capacitance(sensor) && sample.temperatureDeciC == Temperature(sensor));
+		popped++;
+	}
+	CHECK(popped == SOILSENSOR_SAMPLE_RING_SIZE);
+	CHECK(atomic_load(&ring.droppedCount) > 0);
+	printf("Stalled consumer, %d sensors: %u samples kept, %u dropped\n", sensorCount, popped,
+		atomic_load(&ring.droppedCount));
+}
+
+int main(void) {
+	TestSlowConsumer(3, false);
+	TestSlowConsumer(3, true);
+	TestSlowConsumer(SOILSENSOR_SAMPLER_MAX_SENSORS, false);
+	TestSlowConsumer(SOILSENSOR_SAMPLER_MAX_SENSORS, true);
+	TestStalledConsumer(SOILSENSOR_SAMPLER_MAX_SENSORS);
+	return TEST_RESULT();
+}
@@ -0,0 +1,209 @@
+// Exercises the telemetry journal on a plain file: append and replay, reopening with and without
+// acknowledged records, overwriting the oldest records of a full ring, and recovering from a
+// torn record or header. Built and run by make -C host check.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "telemetry_journal.h"
+#include "test_check.h"
+
+// Record and header offsets, as laid out by telemetry_journal.c.
+#define HEADER_SLOTS 2
+#define RECORD_OFFSET(sequence) \
+    ((off_t)(HEADER_SLOTS + (sequence) % TELEMETRY_JOURNAL_CAPACITY) * TELEMETRY_JOURNAL_RECORD_SIZE)
+
+static TelemetryJournal journal;
+
+// Starts a test on an empty journal file, removed once it is closed.
+static int CreateJournal(void)
+{
+    char path[] = "/tmp/telemetry_journal_test_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    unlink(path);
+    CHECK(OpenTelemetryJournal(&journal, fd) == 0);
+    return fd;
+}
+
+// Appends a message naming its sequence, so that replay can check which record it got.
+static int AppendNumbered(uint32_t number)
+{
+    char message[32];
+    int length = snprintf(message, sizeof(message), "{\"Message\":%u}", number);
+    return AppendTelemetryJournal(&journal, (const uint8_t *)message, (size_t)length, 1,
+                                  1000 + (int64_t)number);
+}
+
+static bool IsNumbered(const TelemetryJournalRecord *record, uint32_t number)
+{
+    char message[32];
+    int length = snprintf(message, sizeof(message), "{\"Message\":%u}", number);
+    return record->sequence == number && record->length == length &&
+           memcmp(record->message, message, (size_t)length) == 0 && record->format == 1 &&
+           record->timestamp == 1000 + (int64_t)number;
+}
+
+// Replays and acknowledges every record, checking that they come in order from first.
+static void ReplayAll(uint32_t first, uint32_t count)
+{
+    TelemetryJournalRecord record;
+    uint32_t replayed = 0;
+    while (ReadNextTelemetryJournalRecord(&journal, &record)) {
+        CHECK(IsNumbered(&record, first + replayed));
+        AcknowledgeTelemetryJournalRecord(&journal, record.sequence, true);
+        replayed++;
+    }
+    CHECK(replayed == count);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == 0);
+}
+
+static void TestAppendAndReplay(void)
+{
+    int fd = CreateJournal();
+    TelemetryJournalRecord record;
+    CHECK(GetTelemetryJournalPendingCount(&journal) == 0);
+    CHECK(!ReadNextTelemetryJournalRecord(&journal, &record));
+
+    for (uint32_t i = 1; i <= 3; i++) {
+        CHECK(AppendNumbered(i) == 0);
+    }
+    CHECK(GetTelemetryJournalPendingCount(&journal) == 3);
+
+    // A failed send rewinds the replay to the oldest record not acknowledged.
+    CHECK(ReadNextTelemetryJournalRecord(&journal, &record) && IsNumbered(&record, 1));
+    AcknowledgeTelemetryJournalRecord(&journal, 1, true);
+    CHECK(ReadNextTelemetryJournalRecord(&journal, &record) && IsNumbered(&record, 2));
+    AcknowledgeTelemetryJournalRecord(&journal, 2, false);
+    ReplayAll(2, 2);
+    CHECK(journal.replayedCount == 4);
+    close(fd);
+}
+
+// Appending beyond the replay window holds back the rest until records are acknowledged.
+static void TestInFlightLimit(void)
+{
+    int fd = CreateJournal();
+    for (uint32_t i = 1; i <= TELEMETRY_JOURNAL_MAX_IN_FLIGHT + 2; i++) {
+        CHECK(AppendNumbered(i) == 0);
+    }
+    TelemetryJournalRecord record;
+    uint32_t read = 0;
+    while (ReadNextTelemetryJournalRecord(&journal, &record)) {
+        read++;
+    }
+    CHECK(read == TELEMETRY_JOURNAL_MAX_IN_FLIGHT);
+
+    // Out of order acknowledgements only advance past the oldest record once it is delivered.
+    AcknowledgeTelemetryJournalRecord(&journal, 2, true);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == TELEMETRY_JOURNAL_MAX_IN_FLIGHT + 2);
+    AcknowledgeTelemetryJournalRecord(&journal, 1, true);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == TELEMETRY_JOURNAL_MAX_IN_FLIGHT);
+    close(fd);
+}
+
+// Only committed acknowledgements survive a reopen; the rest is replayed again.
+static void TestReopen(void)
+{
+    int fd = CreateJournal();
+    for (uint32_t i = 1; i <= 5; i++) {
+        CHECK(AppendNumbered(i) == 0);
+    }
+    TelemetryJournalRecord record;
+    for (uint32_t i = 1; i <= 2; i++) {
+        CHECK(ReadNextTelemetryJournalRecord(&journal, &record));
+        AcknowledgeTelemetryJournalRecord(&journal, record.sequence, true);
+    }
+    CHECK(CommitTelemetryJournal(&journal) == 0);
+    CHECK(ReadNextTelemetryJournalRecord(&journal, &record));
+    AcknowledgeTelemetryJournalRecord(&journal, record.sequence, true);
+
+    CHECK(OpenTelemetryJournal(&journal, fd) == 0);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == 3);
+    ReplayAll(3, 3);
+    CHECK(CommitTelemetryJournal(&journal) == 0);
+
+    // Sequences continue after the newest record, even with nothing pending.
+    CHECK(OpenTelemetryJournal(&journal, fd) == 0);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == 0);
+    CHECK(AppendNumbered(6) == 0);
+    ReplayAll(6, 1);
+    close(fd);
+}
+
+// A full ring overwrites its oldest records, counts them and replays from the oldest kept.
+static void TestOverwrite(void)
+{
+    int fd = CreateJournal();
+    static const uint32_t extra = 10;
+    for (uint32_t i = 1; i <= TELEMETRY_JOURNAL_CAPACITY + extra; i++) {
+        CHECK(AppendNumbered(i) == 0);
+    }
+    CHECK(journal.overwrittenCount == extra);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == TELEMETRY_JOURNAL_CAPACITY);
+
+    CHECK(OpenTelemetryJournal(&journal, fd) == 0);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == TELEMETRY_JOURNAL_CAPACITY);
+    ReplayAll(extra + 1, TELEMETRY_JOURNAL_CAPACITY);
+    close(fd);
+}
+
+// A record torn by a reset is skipped and counted; so is a torn header, falling back to the
+// other copy.
+static void TestTornWrites(void)
+{
+    int fd = CreateJournal();
+    for (uint32_t i = 1; i <= 4; i++) {
+        CHECK(AppendNumbered(i) == 0);
+    }
+    TelemetryJournalRecord record;
+    CHECK(ReadNextTelemetryJournalRecord(&journal, &record));
+    AcknowledgeTelemetryJournalRecord(&journal, record.sequence, true);
+    CHECK(CommitTelemetryJournal(&journal) == 0);
+    CHECK(ReadNextTelemetryJournalRecord(&journal, &record));
+    AcknowledgeTelemetryJournalRecord(&journal, record.sequence, true);
+    CHECK(CommitTelemetryJournal(&journal) == 0);
+
+    // Tear record 3 and the newest header, generation 2 in slot 0.
+    const uint8_t garbage[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    CHECK(pwrite(fd, garbage, sizeof(garbage), RECORD_OFFSET(3) + 24) == sizeof(garbage));
+    CHECK(pwrite(fd, garbage, sizeof(garbage), 4) == sizeof(garbage));
+
+    CHECK(OpenTelemetryJournal(&journal, fd) == 0);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == 3);
+    CHECK(ReadNextTelemetryJournalRecord(&journal, &record) && IsNumbered(&record, 2));
+    AcknowledgeTelemetryJournalRecord(&journal, 2, true);
+    CHECK(ReadNextTelemetryJournalRecord(&journal, &record) && IsNumbered(&record, 4));
+    AcknowledgeTelemetryJournalRecord(&journal, 4, true);
+    CHECK(journal.corruptCount == 1);
+    CHECK(GetTelemetryJournalPendingCount(&journal) == 0);
+    close(fd);
+}
+
+// A message of a full payload fits a record; a longer one is refused and counted.
+static void TestMessageLength(void)
+{
+    int fd = CreateJournal();
+    static uint8_t message[TELEMETRY_JOURNAL_PAYLOAD_SIZE + 1];
+    memset(message, 'x', sizeof(message));
+    CHECK(AppendTelemetryJournal(&journal, message, TELEMETRY_JOURNAL_PAYLOAD_SIZE, 2, 0) == 0);
+    CHECK(AppendTelemetryJournal(&journal, message, sizeof(message), 2, 0) != 0);
+    CHECK(journal.tooLongCount == 1);
+
+    TelemetryJournalRecord record;
+    CHECK(ReadNextTelemetryJournalRecord(&journal, &record));
+    CHECK(record.length == TELEMETRY_JOURNAL_PAYLOAD_SIZE && record.format == 2);
+    CHECK(memcmp(record.message, message, TELEMETRY_JOURNAL_PAYLOAD_SIZE) == 0);
+    close(fd);
+}
+
+int main(void)
+{
+    TestAppendAndReplay();
+    TestInFlightLimit();
+    TestReopen();
+    TestOverwrite();
+    TestTornWrites();
+    TestMessageLength();
+    return TEST_RESULT();
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdio.h>
+
+// Minimal checks for the host tests. A failed CHECK prints its location and is counted; a test
+// program returns TEST_RESULT() from main, so that make check fails if any check did.
+
+static int testFailures = 0;
+
+#define CHECK(condition)                                                                   \
+	do {                                                                                   \
+		if (!(condition)) {                                                                \
+			fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+			testFailures++;                                                                \
+		}                                                                                  \
+	} while (0)
+
+#define TEST_RESULT() (testFailures == 0 ? 0 : 1)